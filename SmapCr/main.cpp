@@ -1,139 +1,5892 @@
 ﻿#define _CRT_SECURE_NO_WARNINGS
+// SMAP_TOOL - консольная сборка smap_tool (diff/merge .smap): без raylib, окна и редактора
+#ifndef SMAP_TOOL
 #define RAYGUI_IMPLEMENTATION
 #define GRAPHICS_API_VULKAN
 #include <raylib.h>
 #include <raygui.h>
+#endif
 #include <cstddef>
 #include <map>
 #include <vector>
 #include <string>
 #include "json.hpp"
 #include <functional>
+#ifndef SMAP_TOOL
 #include <nfd.h>
 #include <rlgl.h>
+#endif
 #include <float.h>
 #include <cmath>
 #include <random>
 #include <raymath.h>
+#include <chrono>
+#include <deque>
+#include <queue>
+#include <thread>
+#include <memory>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstdint>
+#include <climits>
+#include <filesystem>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <array>
+#include <charconv>
+#include <string_view>
+#include <iterator>
+#include <optional>
+#ifdef SMAP_TOOL
+// в редакторе sdefl/sinfl собраны внутри raylib, без него - здесь
+#define SDEFL_IMPLEMENTATION
+#define SINFL_IMPLEMENTATION
+#endif
+#include <mmx/sdefl.h>
+#include <mmx/sinfl.h>
+#ifdef _WIN32
+// windows.h конфликтует с raylib (Rectangle, CloseWindow, DrawText...), поэтому только нужные функции
+extern "C" {
+	__declspec(dllimport) void* __stdcall CreateFileA(const char*, unsigned long, unsigned long, void*, unsigned long, unsigned long, void*);
+	__declspec(dllimport) void* __stdcall CreateFileMappingA(void*, void*, unsigned long, unsigned long, unsigned long, const char*);
+	__declspec(dllimport) void* __stdcall MapViewOfFile(void*, unsigned long, unsigned long, unsigned long, size_t);
+	__declspec(dllimport) int __stdcall UnmapViewOfFile(const void*);
+	__declspec(dllimport) int __stdcall CloseHandle(void*);
+	__declspec(dllimport) int __stdcall GetFileSizeEx(void*, long long*);
+	__declspec(dllimport) int __stdcall FlushFileBuffers(void*);
+}
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <fstream>
+#ifndef SMAP_TOOL
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+// сам cgltf (парсер) уже собран в raylib, здесь только запись
+#define CGLTF_WRITE_IMPLEMENTATION
+#include <cgltf_write.h>
+#else
+#include <cstdarg>
+// из raylib инструменту нужны только типы (Vector3, Matrix - из raymath.h) и лог
+struct Texture2D {
+	unsigned int id;
+	int width, height, mipmaps, format;
+};
+enum { LOG_INFO = 3, LOG_WARNING = 4, LOG_ERROR = 5 };
+void TraceLog(int level, const char* fmt, ...) {
+	va_list a;
+	va_start(a, fmt);
+	fprintf(stderr, level >= LOG_WARNING ? "WARNING: " : "INFO: ");
+	vfprintf(stderr, fmt, a);
+	fprintf(stderr, "\n");
+	va_end(a);
+}
+#endif
 using json = nlohmann::json;
 
-json r;
-float seed;
-std::map<std::string, std::pair<Texture2D, std::string>> texs; // текстуры и их base64 данные для сохранения в json
-std::vector<const char*> texs_for_list;
-enum TOOL {TILE, OBJP, SELECT};
+json r;
+float seed;
+struct TexRef {
+	Texture2D tex = { 0 }; // 0 - еще не декодирована
+	uint64_t asset = 0; // хеш байтов файла в паке ассетов, 0 - только в памяти
+	bool failed = false;
+};
+std::map<std::string, TexRef> texs; // tid -> текстура, байты лежат в паке рядом с картой
+Texture2D tex_get(const std::string& tid);
+std::vector<const char*> texs_for_list;
+enum TOOL {TILE, OBJP, SELECT};
+
+struct Tile {
+	int id;
+	int bid; // 0 - ничего ++++++ 1 - холм +++++++++ 2 - лесок ++++++ 3 - лес ++++++++ 4 - море +++++++++ 5 - речка
+	std::string tid; // texs 
+	float h;
+	json j;
+};
+struct OBJ {
+	int id;
+	std::string tid; // texs, как у тайла: индекс в списке текстур съезжает при добавлении новых
+	int proch; // 0-100 прочность предмета. Подходит и для еды
+	Vector3 vec3; // x, Y(выс), z 
+	float pov; // поворот 
+	float razm; // размер
+	void (*onclck)(OBJ& self); // колбек на клик 
+	json j;
+	std::string anim; //потом заменить на нормальную анимацию объекта, а пока это просто текстуры по кадрам 1_3_5 (tid)
+};
+Vector3 playerPos = { 0.0f, 10.0f, 0.0f };
+std::vector<OBJ>OBJS;
+std::vector<Tile>tiles;
+TOOL ct;
+bool sjw = false;
+char jb[4096] = "{\n\tur json\n}";
+Tile* st = nullptr;
+OBJ* so = nullptr;
+int MAP_W = 1000;
+int MAP_H = 1000;
+const int MAX_MAP_SIDE = 1 << 16; // больше из файла не принимаем - битый заголовок
+const size_t MAX_LOAD_TILES = (size_t)8192 * 8192; // целиком в память не больше, крупнее - только страницами
+int tool_s;
+int sc_idx;
+int act_idx;
+int foc_idx;
+
+struct generator_set {
+	// 1. Общий масштаб (насколько всё крупное: и горы, и равнины)
+	float gen_frequency = 0.05f;  // Чем меньше, тем больше объекты
+
+	// 2. Интенсивность высот (насколько горы высокие)
+	float gen_amplitude = 15.0f;
+
+	// 3. Порог гор (при каком значении биома начинаются горы)
+	float gen_mountain_cutoff = 0.7f;
+
+	// 4. Кривизна (экспонента для холмов, делает их пологими или резкими)
+	float gen_hill_exp = 2.0f;
+
+	// 5. Сила искривления рек (насколько они "пьяные")
+	float gen_river_warp = 10.0f;
+	float gen_scale = 0.02f;      // Масштаб всего (меньше = больше объектов)
+	float gen_roughness = 0.5f;   // Насколько поверхность "шершавая"
+	float gen_lacunarity = 2.0f;  // Детализация между слоями
+	float gen_distort = 4.0f;     // Сила искривления (убирает параллельность)
+	float gen_octaves = 4;
+};
+generator_set g_set;
+
+// Потоки для par_for создаются один раз и спят между вызовами: кисть зовет par_for каждый кадр
+struct ParPool {
+	std::vector<std::thread> th;
+	std::mutex m;
+	std::condition_variable go, done;
+	std::atomic<bool> used = false; // занят вызовом; вложенный или параллельный par_for идет мимо пула
+	const std::function<void(int, int)>* fn = nullptr;
+	int n = 0, parts = 0, left = 0, busy = 0;
+	std::atomic<int> next = 0;
+	uint64_t gen = 0;
+	bool stop = false;
+	ParPool(int workers) {
+		for (int i = 0; i < workers; i++) th.emplace_back([this] { loop(); });
+	}
+	~ParPool() {
+		{
+			std::lock_guard<std::mutex> l(m);
+			stop = true;
+		}
+		go.notify_all();
+		for (std::thread& t : th) t.join();
+	}
+	void work() {
+		int k;
+		while ((k = next++) < parts) {
+			(*fn)((int)((long long)n * k / parts), (int)((long long)n * (k + 1) / parts));
+			std::lock_guard<std::mutex> l(m);
+			if (--left == 0) done.notify_all();
+		}
+	}
+	void loop() {
+		uint64_t seen = 0;
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> l(m);
+				go.wait(l, [&] { return stop || gen != seen; });
+				if (stop) return;
+				seen = gen;
+				busy++;
+			}
+			work();
+			std::lock_guard<std::mutex> l(m);
+			if (--busy == 0) done.notify_all();
+		}
+	}
+	void run(int n_, int parts_, const std::function<void(int, int)>& f) {
+		{
+			// опоздавший с прошлого вызова поток еще может читать parts
+			std::unique_lock<std::mutex> l(m);
+			done.wait(l, [&] { return busy == 0; });
+			fn = &f;
+			n = n_;
+			parts = left = parts_;
+			next = 0;
+			gen++;
+		}
+		go.notify_all();
+		work();
+		std::unique_lock<std::mutex> l(m);
+		done.wait(l, [&] { return left == 0; });
+	}
+};
+// Делит [0, n) на куски по потокам; fn(a, b) обрабатывает [a, b). Маленькие n - в текущем потоке
+void par_for(int n, const std::function<void(int, int)>& fn, int min_chunk = 16) {
+	static const int hw = std::max(1u, std::thread::hardware_concurrency());
+	int parts = std::min(hw, std::max(1, n / std::max(1, min_chunk)));
+	if (parts <= 1) {
+		if (n > 0) fn(0, n);
+		return;
+	}
+	static ParPool pool(hw - 1);
+	if (!pool.used.exchange(true)) {
+		pool.run(n, parts, fn);
+		pool.used = false;
+		return;
+	}
+	std::vector<std::thread> th;
+	th.reserve(parts - 1);
+	for (int i = 1; i < parts; i++) {
+		th.emplace_back(fn, (int)((long long)n * i / parts), (int)((long long)n * (i + 1) / parts));
+	}
+	fn(0, (int)((long long)n / parts));
+	for (std::thread& t : th) t.join();
+}
+
+// ===== Профайлер кадра: фазы, счетчики отрисовки, график, дамп в chrome trace =====
+struct ProfEvent {
+	const char* name;
+	double ts; // мкс от старта
+	double dur;
+};
+struct Profiler {
+	bool show = false;
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	std::deque<ProfEvent> ev; // последние PROF_MAX_EV событий для дампа
+	float ft[240] = { 0 }; // время кадра, мс
+	int ft_i = 0;
+	double frame_ts = -1.0;
+	// счетчики текущего кадра и их значения за прошлый кадр
+	int draws = 0, verts = 0, binds = 0;
+	int l_draws = 0, l_verts = 0, l_binds = 0;
+	unsigned int last_tex = 0xFFFFFFFF;
+};
+const size_t PROF_MAX_EV = 20000;
+Profiler prof;
+size_t hf_gpu_last_upload();
+
+double prof_now() {
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - prof.t0).count();
+}
+struct ProfScope {
+	const char* name;
+	double ts;
+	ProfScope(const char* n) : name(n), ts(prof_now()) {}
+	~ProfScope() {
+		prof.ev.push_back({ name, ts, prof_now() - ts });
+		if (prof.ev.size() > PROF_MAX_EV) prof.ev.pop_front();
+	}
+};
+// смена текстуры в батче rlgl = новый draw call
+void prof_bind(unsigned int id) {
+	if (id == prof.last_tex) return;
+	prof.last_tex = id;
+	prof.binds++;
+	prof.draws++;
+}
+// вызывается в начале каждого кадра: закрывает прошлый
+void prof_frame() {
+	double now = prof_now();
+	if (prof.frame_ts >= 0.0) {
+		prof.ev.push_back({ "frame", prof.frame_ts, now - prof.frame_ts });
+		if (prof.ev.size() > PROF_MAX_EV) prof.ev.pop_front();
+		prof.ft[prof.ft_i] = (float)((now - prof.frame_ts) / 1000.0);
+		prof.ft_i = (prof.ft_i + 1) % 240;
+	}
+	prof.frame_ts = now;
+	prof.l_draws = prof.draws; prof.l_verts = prof.verts; prof.l_binds = prof.binds;
+	prof.draws = prof.verts = prof.binds = 0;
+	prof.last_tex = 0xFFFFFFFF;
+}
+bool prof_dump(const char* path) {
+	json tr;
+	tr["traceEvents"] = json::array();
+	for (const ProfEvent& e : prof.ev) {
+		tr["traceEvents"].push_back({ {"name", e.name}, {"ph", "X"}, {"ts", e.ts}, {"dur", e.dur}, {"pid", 1}, {"tid", 1} });
+	}
+	std::ofstream f(path);
+	if (!f) return false;
+	f << tr.dump();
+	return true;
+}
+#ifndef SMAP_TOOL
+void prof_overlay(Vector2 ws) {
+	if (IsKeyPressed(KEY_F3)) prof.show = !prof.show;
+	if (IsKeyPressed(KEY_F4)) {
+		std::string path = TextFormat("trace_%lld.json", (long long)std::time(nullptr));
+		TraceLog(prof_dump(path.c_str()) ? LOG_INFO : LOG_WARNING, "PROF: trace -> %s", path.c_str());
+	}
+	if (!prof.show) return;
+	float sorted[240];
+	std::copy(prof.ft, prof.ft + 240, sorted);
+	std::sort(sorted, sorted + 240);
+	float w = 240.0f * 1.5f, h = 80.0f;
+	float x = ws.x * 0.5f - w * 0.5f, y = 10.0f;
+	DrawRectangle((int)x, (int)y, (int)w, (int)h + 70, Fade(BLACK, 0.7f));
+	// график: 0..33 мс, линии 8.3 мс (120 fps) и 16.6 мс
+	for (int i = 0; i < 240; i++) {
+		float v = prof.ft[(prof.ft_i + i) % 240];
+		float bh = std::min(v / 33.3f, 1.0f) * h;
+		DrawRectangle((int)(x + i * 1.5f), (int)(y + h - bh), 2, (int)bh, v > 16.6f ? RED : (v > 8.4f ? YELLOW : GREEN));
+	}
+	DrawLine((int)x, (int)(y + h - h * 8.33f / 33.3f), (int)(x + w), (int)(y + h - h * 8.33f / 33.3f), GRAY);
+	DrawLine((int)x, (int)(y + h - h * 16.6f / 33.3f), (int)(x + w), (int)(y + h - h * 16.6f / 33.3f), GRAY);
+	DrawText(TextFormat("p50 %.2f  p95 %.2f  p99 %.2f  max %.2f ms", sorted[120], sorted[228], sorted[237], sorted[239]), (int)x + 4, (int)(y + h + 4), 10, WHITE);
+	DrawText(TextFormat("draws %d  verts %d  binds %d  upload %zu B", prof.l_draws, prof.l_verts, prof.l_binds, hf_gpu_last_upload()), (int)x + 4, (int)(y + h + 18), 10, WHITE);
+	// фазы прошлого (полностью завершенного) кадра
+	int line = 0;
+	auto it = prof.ev.rbegin();
+	while (it != prof.ev.rend() && std::string(it->name) != "frame") ++it;
+	if (it != prof.ev.rend()) ++it;
+	for (; it != prof.ev.rend() && line < 4; ++it) {
+		if (std::string(it->name) == "frame") break;
+		DrawText(TextFormat("%-8s %.3f ms", it->name, it->dur / 1000.0), (int)x + 4 + (line % 2) * 180, (int)(y + h + 32 + (line / 2) * 14), 10, LIGHTGRAY);
+		line++;
+	}
+}
+#endif
+// Прямоугольник тайлов [x0, x1) x [z0, z1)
+struct DirtyRect {
+	int x0 = 0, z0 = 0, x1 = 0, z1 = 0;
+	bool empty() const { return x0 >= x1 || z0 >= z1; }
+};
+
+float GetVertexHeight(int x, int z) {
+	if (x < 0 || x >= MAP_W || z < 0 || z >= MAP_H) return 0.0f;
+	return (float)tiles[z * MAP_W + x].h;
+}
+float GetInterpolatedHeight(float x, float z) {
+	int x0 = (int)std::floor(x);
+	int z0 = (int)std::floor(z);
+	float h00 = GetVertexHeight(x0, z0);
+	float h10 = GetVertexHeight(x0 + 1, z0);
+	float h01 = GetVertexHeight(x0, z0 + 1);
+	float h11 = GetVertexHeight(x0 + 1, z0 + 1);
+	float sx = x - (float)x0;
+	float sz = z - (float)z0;
+	float lerpTop = h00 + sx * (h10 - h00);
+	float lerpBottom = h01 + sx * (h11 - h01);
+	return lerpTop + sz * (lerpBottom - lerpTop);
+}
+#ifndef SMAP_TOOL
+int autotile_variant(int x, int z);
+const std::string& autotile_overlay(int x, int z);
+// area - рисовать только этот прямоугольник тайлов (экспорт), иначе вокруг camera.target
+void DrawMap(Camera3D camera, const DirtyRect* area = nullptr) {
+	int viewDist = (int)(camera.fovy * 1.5f);
+
+	int startX = (int)camera.target.x - viewDist;
+	int endX = (int)camera.target.x + viewDist;
+	int startZ = (int)camera.target.z - viewDist;
+	int endZ = (int)camera.target.z + viewDist;
+	if (area) {
+		startX = area->x0; endX = area->x1;
+		startZ = area->z0; endZ = area->z1;
+	}
+	startX = std::max(0, startX);
+	endX = std::min(MAP_W - 1, endX);
+	startZ = std::max(0, startZ);
+	endZ = std::min(MAP_H - 1, endZ);
+
+	for (int z = startZ; z < endZ; z++) {
+		for (int x = startX; x < endX; x++) {
+			int idx = z * MAP_W + x;
+			Tile& t = tiles[idx];
+			float h00 = GetVertexHeight(x, z);        
+			float h10 = GetVertexHeight(x + 1, z);    
+			float h11 = GetVertexHeight(x + 1, z + 1); 
+			float h01 = GetVertexHeight(x, z + 1);    
+			Texture2D texture = tex_get(t.tid);
+			prof_bind(texture.id);
+			rlSetTexture(texture.id);
+			rlBegin(RL_QUADS);
+			rlColor4ub(255, 255, 255, 255);
+			rlTexCoord2f(0.0f, 0.0f);
+			rlVertex3f((float)x, h00, (float)z);
+			rlTexCoord2f(0.0f, 1.0f);
+			rlVertex3f((float)x, h01, (float)z + 1.0f);
+			rlTexCoord2f(1.0f, 1.0f);
+			rlVertex3f((float)x + 1.0f, h11, (float)z + 1.0f);
+			rlTexCoord2f(1.0f, 0.0f);
+			rlVertex3f((float)x + 1.0f, h10, (float)z);
+			rlEnd();
+			// автотайл: материал соседа поверх, прозрачность по углам из маски (как в шейдере GPU-режима)
+			if (int m = autotile_variant(x, z)) {
+				auto corner = [m](int a, int b, int c) { return (unsigned char)(((m >> a) | (m >> b) | (m >> c)) & 1 ? 200 : 0); };
+				unsigned char a00 = corner(0, 3, 7), a10 = corner(0, 1, 4), a11 = corner(1, 2, 5), a01 = corner(2, 3, 6);
+				Texture2D ot = tex_get(autotile_overlay(x, z));
+				prof_bind(ot.id);
+				rlSetTexture(ot.id);
+				rlBegin(RL_QUADS);
+				rlColor4ub(255, 255, 255, a00);
+				rlTexCoord2f(0.0f, 0.0f);
+				rlVertex3f((float)x, h00 + 0.01f, (float)z);
+				rlColor4ub(255, 255, 255, a01);
+				rlTexCoord2f(0.0f, 1.0f);
+				rlVertex3f((float)x, h01 + 0.01f, (float)z + 1.0f);
+				rlColor4ub(255, 255, 255, a11);
+				rlTexCoord2f(1.0f, 1.0f);
+				rlVertex3f((float)x + 1.0f, h11 + 0.01f, (float)z + 1.0f);
+				rlColor4ub(255, 255, 255, a10);
+				rlTexCoord2f(1.0f, 0.0f);
+				rlVertex3f((float)x + 1.0f, h10 + 0.01f, (float)z);
+				rlEnd();
+				prof.verts += 4;
+			}
+			rlSetTexture(0);
+			prof_bind(rlGetTextureIdDefault());
+			prof.verts += 8;
+			DrawLine3D({ (float)x, h00, (float)z }, { (float)x + 1, h10, (float)z }, DARKGRAY);
+			DrawLine3D({ (float)x, h00, (float)z }, { (float)x, h01, (float)z + 1 }, DARKGRAY);
+		}
+	}
+}
+// ===== GPU-режим: одна сетка, высоты из float-текстуры =====
+const int HF_GRID = 128; // квадов на сторону у переиспользуемой сетки
+const char* HF_VS = R"(#version 330
+in vec3 vertexPosition;
+uniform mat4 mvp;
+uniform mat4 matModel;
+uniform sampler2D texture0;
+uniform ivec2 mapSize;
+out vec3 fragPos;
+out vec3 fragNormal;
+float hgt(ivec2 p) {
+	if (p.x < 0 || p.y < 0 || p.x >= mapSize.x || p.y >= mapSize.y) return 0.0;
+	return texelFetch(texture0, p, 0).r;
+}
+void main() {
+	vec4 wp = matModel * vec4(vertexPosition, 1.0);
+	// последний патч торчит за край карты - его вершины прижимаются к последней вершине с высотой
+	// (как DrawMap, до MAP_W - 1), лишние треугольники вырождаются
+	vec2 cw = min(wp.xz, vec2(mapSize - 1));
+	vec2 lp = vertexPosition.xz + (cw - wp.xz);
+	ivec2 p = ivec2(round(cw));
+	float h = hgt(p);
+	fragNormal = vec3(hgt(p - ivec2(1, 0)) - hgt(p + ivec2(1, 0)), 2.0, hgt(p - ivec2(0, 1)) - hgt(p + ivec2(0, 1)));
+	fragPos = vec3(cw.x, h, cw.y);
+	gl_Position = mvp * vec4(lp.x, h, lp.y, 1.0);
+})";
+const char* HF_FS = R"(#version 330
+in vec3 fragPos;
+in vec3 fragNormal;
+uniform sampler2D texture1;
+uniform sampler2D texture2;
+uniform sampler2D texture3;
+uniform ivec2 mapSize;
+out vec4 finalColor;
+void main() {
+	ivec2 t = clamp(ivec2(floor(fragPos.xz)), ivec2(0), mapSize - 1);
+	int m = int(texelFetch(texture1, t, 0).r * 255.0 + 0.5);
+	vec3 c = texelFetch(texture2, ivec2(m, 0), 0).rgb;
+	// автотайл: маска соседей с материалом старше нашего + материал перехода
+	vec4 at = texelFetch(texture3, t, 0);
+	int mask = int(at.r * 255.0 + 0.5);
+	if (mask != 0) {
+		vec2 f = fract(fragPos.xz);
+		float w = 0.0;
+		if ((mask & 1) != 0) w = max(w, 1.0 - f.y);
+		if ((mask & 2) != 0) w = max(w, f.x);
+		if ((mask & 4) != 0) w = max(w, f.y);
+		if ((mask & 8) != 0) w = max(w, 1.0 - f.x);
+		if ((mask & 16) != 0) w = max(w, min(f.x, 1.0 - f.y));
+		if ((mask & 32) != 0) w = max(w, min(f.x, f.y));
+		if ((mask & 64) != 0) w = max(w, min(1.0 - f.x, f.y));
+		if ((mask & 128) != 0) w = max(w, min(1.0 - f.x, 1.0 - f.y));
+		vec3 oc = texelFetch(texture2, ivec2(int(at.a * 255.0 + 0.5), 0), 0).rgb;
+		c = mix(c, oc, smoothstep(0.4, 1.0, w));
+	}
+	float l = 0.45 + 0.55 * max(dot(normalize(fragNormal), normalize(vec3(0.4, 1.0, 0.3))), 0.0);
+	vec2 g = fract(fragPos.xz);
+	if (min(g.x, g.y) < 0.03) c *= 0.35;
+	finalColor = vec4(c * l, 1.0);
+})";
+
+std::vector<std::string> tex_pal; // индекс материала -> tid, нужен для R8-текстуры материалов
+std::vector<Color> tex_pal_col;
+std::unordered_map<std::string, unsigned char> tex_pal_map; // tid -> индекс в tex_pal
+
+Color tex_avg_color(const std::string& tid) {
+	Texture2D tx = tex_get(tid);
+	if (tx.id > 0) {
+		Image im = LoadImageFromTexture(tx);
+		Color* px = LoadImageColors(im);
+		unsigned long long r = 0, g = 0, b = 0, n = (unsigned long long)im.width * im.height;
+		for (unsigned long long i = 0; i < n; i++) { r += px[i].r; g += px[i].g; b += px[i].b; }
+		UnloadImageColors(px);
+		UnloadImage(im);
+		if (n) return { (unsigned char)(r / n), (unsigned char)(g / n), (unsigned char)(b / n), 255 };
+	}
+	// текстуры нет - для базовых имен из генератора свой цвет, остальное по хешу имени
+	if (tid == "water") return { 40, 90, 200, 255 };
+	if (tid == "grass") return { 80, 160, 60, 255 };
+	size_t hs = std::hash<std::string>{}(tid);
+	return { (unsigned char)(64 + hs % 160), (unsigned char)(64 + (hs >> 8) % 160), (unsigned char)(64 + (hs >> 16) % 160), 255 };
+}
+unsigned char tex_pal_idx(const std::string& tid) {
+	auto it = tex_pal_map.find(tid);
+	if (it != tex_pal_map.end()) return it->second;
+	if (tex_pal.size() >= 256) return 0;
+	tex_pal.push_back(tid);
+	tex_pal_col.push_back(tex_avg_color(tid));
+	tex_pal_map.emplace(tid, (unsigned char)(tex_pal.size() - 1));
+	return (unsigned char)(tex_pal.size() - 1);
+}
+
+// ===== Автотайлинг: переходы между материалами по 8 соседям =====
+// Ранг материала: кто "наползает" на соседа. Вода ниже всех, остальные по порядку палитры
+// mask - биты соседей старшего ранга: 0 N, 1 E, 2 S, 3 W, 4 NE, 5 SE, 6 SW, 7 NW (индекс варианта 8-битного blob-тайлсета)
+// Ранги u16: палитра до 256 материалов плюс нулевой ранг воды/рамки не влезают в u8
+struct AutoTile {
+	int w = 0, h = 0;
+	std::vector<uint16_t> rank; // (w + 2) x (h + 2), рамка нулевого ранга
+	std::vector<unsigned char> mask;
+	std::vector<uint16_t> over; // ранг материала перехода
+	uint16_t rank_of[256];
+	unsigned char idx_of_rank[257];
+	int dx0 = 0, dz0 = 0, dx1 = 0, dz1 = 0;
+};
+AutoTile atile;
+
+void autotile_mark(int x0, int z0, int x1, int z1) {
+	AutoTile& a = atile;
+	if (a.dx0 >= a.dx1) { a.dx0 = x0; a.dz0 = z0; a.dx1 = x1; a.dz1 = z1; return; }
+	a.dx0 = std::min(a.dx0, x0); a.dz0 = std::min(a.dz0, z0);
+	a.dx1 = std::max(a.dx1, x1); a.dz1 = std::max(a.dz1, z1);
+}
+void autotile_masks(int x0, int z0, int x1, int z1);
+void autotile_sync() {
+	AutoTile& a = atile;
+	if (a.w != MAP_W || a.h != MAP_H) {
+		a.w = MAP_W; a.h = MAP_H;
+		a.rank.assign((size_t)(MAP_W + 2) * (MAP_H + 2), 0);
+		a.mask.assign((size_t)MAP_W * MAP_H, 0);
+		a.over.assign((size_t)MAP_W * MAP_H, 0);
+		a.dx0 = 0; a.dz0 = 0; a.dx1 = MAP_W; a.dz1 = MAP_H;
+	}
+	int x0 = std::max(0, a.dx0), z0 = std::max(0, a.dz0);
+	int x1 = std::min(MAP_W, a.dx1), z1 = std::min(MAP_H, a.dz1);
+	a.dx1 = a.dx0;
+	if (x0 >= x1 || z0 >= z1) return;
+	const int PW = MAP_W + 2;
+	// 1. плоскость рангов по строкам во всех потоках. tex_pal_map только читается; новые tid
+	// собираются, добавляются в палитру после прохода, и тогда проход повторяется
+	std::mutex mu;
+	std::vector<std::string> fresh;
+	auto ranks = [&](int ja, int jb) {
+		std::vector<std::string> miss;
+		const std::string* last = nullptr;
+		uint16_t last_rank = 0;
+		for (int z = z0 + ja; z < z0 + jb; z++) {
+			const Tile* row = &tiles[(size_t)z * MAP_W];
+			uint16_t* rr = &a.rank[(size_t)(z + 1) * PW + 1];
+			for (int x = x0; x < x1; x++) {
+				if (!last || row[x].tid != *last) {
+					last = &row[x].tid;
+					auto it = tex_pal_map.find(row[x].tid);
+					if (it == tex_pal_map.end()) {
+						// палитра полна - как tex_pal_idx, материал 0
+						if (miss.empty() || miss.back() != row[x].tid) miss.push_back(row[x].tid);
+						last_rank = a.rank_of[0];
+					}
+					else last_rank = a.rank_of[it->second];
+				}
+				rr[x] = last_rank;
+			}
+		}
+		if (!miss.empty()) {
+			std::lock_guard<std::mutex> lk(mu);
+			fresh.insert(fresh.end(), miss.begin(), miss.end());
+		}
+	};
+	auto rank_table = [&] {
+		// вода ниже всех, остальные по порядку палитры: i + 1, до 256 включительно
+		for (int i = 0; i < 256; i++) {
+			int r = i < (int)tex_pal.size() && tex_pal[i] == "water" ? 0 : i + 1;
+			a.rank_of[i] = (uint16_t)r;
+			a.idx_of_rank[r] = (unsigned char)i;
+		}
+	};
+	rank_table();
+	par_for(z1 - z0, ranks, 16);
+	if (!fresh.empty()) {
+		for (const std::string& t : fresh) tex_pal_idx(t);
+		rank_table();
+		fresh.clear();
+		par_for(z1 - z0, ranks, 16);
+	}
+	autotile_masks(x0, z0, x1, z1);
+}
+// Маски по готовой плоскости рангов: только сравнения без ветвлений, компилятор векторизует внутренний цикл
+void autotile_masks(int x0, int z0, int x1, int z1) {
+	AutoTile& a = atile;
+	const int PW = MAP_W + 2;
+	if (x0 >= x1 || z0 >= z1) return;
+	par_for(z1 - z0, [&](int ja, int jb) {
+		for (int z = z0 + ja; z < z0 + jb; z++) {
+			const uint16_t* c = &a.rank[(size_t)(z + 1) * PW + 1];
+			const uint16_t* up = c - PW;
+			const uint16_t* dn = c + PW;
+			unsigned char* mk = &a.mask[(size_t)z * MAP_W];
+			uint16_t* ov = &a.over[(size_t)z * MAP_W];
+			for (int x = x0; x < x1; x++) {
+				uint16_t r = c[x];
+				mk[x] = (unsigned char)((up[x] > r) | ((c[x + 1] > r) << 1) | ((dn[x] > r) << 2) | ((c[x - 1] > r) << 3) |
+					((up[x + 1] > r) << 4) | ((dn[x + 1] > r) << 5) | ((dn[x - 1] > r) << 6) | ((up[x - 1] > r) << 7));
+				uint16_t o = std::max(std::max(std::max(up[x], dn[x]), std::max(c[x - 1], c[x + 1])),
+					std::max(std::max(up[x - 1], up[x + 1]), std::max(dn[x - 1], dn[x + 1])));
+				ov[x] = std::max(o, r);
+			}
+		}
+	}, 16);
+}
+// Окно подкачки сдвинулось на (dx, dz) тайлов: плоскости переезжают вместе с тайлами. Приходящие
+// тайлы помечает вызывающий; здесь пересчитываются только маски у края окна - их соседи ушли в рамку
+void autotile_shift(int dx, int dz) {
+	AutoTile& a = atile;
+	if (a.w != MAP_W || a.h != MAP_H || a.rank.empty()) return;
+	const int W = MAP_W, H = MAP_H, PW = W + 2;
+	int x0 = std::max(0, -dx), x1 = std::min(W, W - dx);
+	std::vector<uint16_t> nr(a.rank.size(), 0), nov(a.over.size(), 0);
+	std::vector<unsigned char> nm(a.mask.size(), 0);
+	if (x0 < x1)
+		par_for(H, [&](int ja, int jb) {
+			for (int z = ja; z < jb; z++) {
+				int sz = z + dz;
+				if (sz < 0 || sz >= H) continue;
+				size_t n = (size_t)(x1 - x0);
+				memcpy(&nr[(size_t)(z + 1) * PW + 1 + x0], &a.rank[(size_t)(sz + 1) * PW + 1 + x0 + dx], n * sizeof(uint16_t));
+				memcpy(&nov[(size_t)z * W + x0], &a.over[(size_t)sz * W + x0 + dx], n * sizeof(uint16_t));
+				memcpy(&nm[(size_t)z * W + x0], &a.mask[(size_t)sz * W + x0 + dx], n);
+			}
+		}, 16);
+	a.rank.swap(nr);
+	a.over.swap(nov);
+	a.mask.swap(nm);
+	if (a.dx0 < a.dx1) { a.dx0 -= dx; a.dx1 -= dx; a.dz0 -= dz; a.dz1 -= dz; }
+	autotile_masks(0, 0, W, 1);
+	autotile_masks(0, H - 1, W, H);
+	autotile_masks(0, 0, 1, H);
+	autotile_masks(W - 1, 0, W, H);
+}
+// Вариант перехода тайла (0 - без перехода) и материал, который на него наползает
+int autotile_variant(int x, int z) {
+	autotile_sync();
+	return atile.mask[(size_t)z * MAP_W + x];
+}
+const std::string& autotile_overlay(int x, int z) {
+	autotile_sync();
+	return tex_pal[atile.idx_of_rank[atile.over[(size_t)z * MAP_W + x]]];
+}
+
+struct HeightGpu {
+	bool ready = false;
+	Shader sh = { 0 };
+	Mesh grid = { 0 };
+	Material mat = { 0 };
+	Texture2D htex = { 0 }; // R32: высота в вершине (x, z)
+	Texture2D mtex = { 0 }; // R8: индекс в tex_pal
+	Texture2D ptex = { 0 }; // палитра 256x1
+	Texture2D attex = { 0 }; // GRAY_ALPHA: маска автотайла, индекс материала перехода
+	int loc_size = -1;
+	int pal_n = 0;
+	// грязные прямоугольники; далекие правки не сливаются в один общий
+	std::vector<DirtyRect> dirty;
+	std::vector<float> hup;
+	std::vector<unsigned char> mup;
+	std::vector<unsigned char> aup;
+	size_t last_upload = 0; // байт залито за последний кадр
+};
+HeightGpu hf_gpu;
+bool gpu_terrain = false;
+const int HF_DIRTY_MAX = 8;
+
+Mesh hf_gen_grid(int n) {
+	Mesh m = { 0 };
+	m.vertexCount = (n + 1) * (n + 1);
+	m.triangleCount = n * n * 2;
+	m.vertices = (float*)MemAlloc(m.vertexCount * 3 * sizeof(float));
+	m.indices = (unsigned short*)MemAlloc(m.triangleCount * 3 * sizeof(unsigned short));
+	for (int z = 0; z <= n; z++) {
+		for (int x = 0; x <= n; x++) {
+			float* v = m.vertices + (z * (n + 1) + x) * 3;
+			v[0] = (float)x; v[1] = 0.0f; v[2] = (float)z;
+		}
+	}
+	int k = 0;
+	for (int z = 0; z < n; z++) {
+		for (int x = 0; x < n; x++) {
+			unsigned short a = (unsigned short)(z * (n + 1) + x);
+			unsigned short b = (unsigned short)(a + 1);
+			unsigned short c = (unsigned short)(a + n + 1);
+			unsigned short d = (unsigned short)(c + 1);
+			m.indices[k++] = a; m.indices[k++] = c; m.indices[k++] = b;
+			m.indices[k++] = b; m.indices[k++] = c; m.indices[k++] = d;
+		}
+	}
+	UploadMesh(&m, false);
+	return m;
+}
+void hf_gpu_mark(int x0, int z0, int x1, int z1) {
+	x0 = std::max(0, x0); z0 = std::max(0, z0);
+	x1 = std::min(MAP_W, x1); z1 = std::min(MAP_H, z1);
+	if (x0 >= x1 || z0 >= z1) return;
+	HeightGpu& g = hf_gpu;
+	auto join = [](const DirtyRect& a, const DirtyRect& b) {
+		return DirtyRect{ std::min(a.x0, b.x0), std::min(a.z0, b.z0), std::max(a.x1, b.x1), std::max(a.z1, b.z1) };
+	};
+	auto area = [](const DirtyRect& a) { return (long long)(a.x1 - a.x0) * (a.z1 - a.z0); };
+	DirtyRect r = { x0, z0, x1, z1 };
+	// пересекается или касается - расширяем его
+	for (DirtyRect& d : g.dirty)
+		if (r.x0 <= d.x1 && d.x0 <= r.x1 && r.z0 <= d.z1 && d.z0 <= r.z1) {
+			d = join(d, r);
+			return;
+		}
+	if (g.dirty.size() < HF_DIRTY_MAX) {
+		g.dirty.push_back(r);
+		return;
+	}
+	// список полон - сливаем с тем, чья площадь вырастет меньше всего
+	size_t best = 0;
+	long long grow = LLONG_MAX;
+	for (size_t i = 0; i < g.dirty.size(); i++) {
+		long long d = area(join(g.dirty[i], r)) - area(g.dirty[i]);
+		if (d < grow) { grow = d; best = i; }
+	}
+	g.dirty[best] = join(g.dirty[best], r);
+}
+void hf_gpu_init() {
+	HeightGpu& g = hf_gpu;
+	if (g.ready && g.htex.width == MAP_W && g.htex.height == MAP_H) return;
+	if (g.ready) {
+		UnloadTexture(g.htex);
+		UnloadTexture(g.mtex);
+		UnloadTexture(g.attex);
+	}
+	else {
+		g.sh = LoadShaderFromMemory(HF_VS, HF_FS);
+		g.loc_size = GetShaderLocation(g.sh, "mapSize");
+		g.grid = hf_gen_grid(HF_GRID);
+		g.mat = LoadMaterialDefault();
+		g.sh.locs[SHADER_LOC_MAP_ROUGHNESS] = GetShaderLocation(g.sh, "texture3");
+		g.mat.shader = g.sh;
+		Image pal = GenImageColor(256, 1, WHITE);
+		g.ptex = LoadTextureFromImage(pal);
+		UnloadImage(pal);
+	}
+	Image hi = { MemAlloc(MAP_W * MAP_H * sizeof(float)), MAP_W, MAP_H, 1, PIXELFORMAT_UNCOMPRESSED_R32 };
+	g.htex = LoadTextureFromImage(hi);
+	UnloadImage(hi);
+	Image mi = { MemAlloc(MAP_W * MAP_H), MAP_W, MAP_H, 1, PIXELFORMAT_UNCOMPRESSED_GRAYSCALE };
+	g.mtex = LoadTextureFromImage(mi);
+	UnloadImage(mi);
+	Image ai = { MemAlloc(MAP_W * MAP_H * 2), MAP_W, MAP_H, 1, PIXELFORMAT_UNCOMPRESSED_GRAY_ALPHA };
+	g.attex = LoadTextureFromImage(ai);
+	UnloadImage(ai);
+	SetTextureFilter(g.attex, TEXTURE_FILTER_POINT);
+	SetTextureFilter(g.htex, TEXTURE_FILTER_POINT);
+	SetTextureFilter(g.mtex, TEXTURE_FILTER_POINT);
+	SetTextureFilter(g.ptex, TEXTURE_FILTER_POINT);
+	g.mat.maps[MATERIAL_MAP_ALBEDO].texture = g.htex;
+	g.mat.maps[MATERIAL_MAP_METALNESS].texture = g.mtex;
+	g.mat.maps[MATERIAL_MAP_NORMAL].texture = g.ptex;
+	g.mat.maps[MATERIAL_MAP_ROUGHNESS].texture = g.attex;
+	int sz[2] = { MAP_W, MAP_H };
+	SetShaderValue(g.sh, g.loc_size, sz, SHADER_UNIFORM_IVEC2);
+	g.pal_n = 0;
+	g.ready = true;
+	g.dirty.assign(1, { 0, 0, MAP_W, MAP_H });
+}
+// Заливаем только грязные прямоугольники, меш не трогаем
+void hf_gpu_upload() {
+	HeightGpu& g = hf_gpu;
+	g.last_upload = 0;
+	autotile_sync();
+	for (const DirtyRect& d : g.dirty) {
+		int w = d.x1 - d.x0, h = d.z1 - d.z0;
+		g.hup.resize((size_t)w * h);
+		g.mup.resize((size_t)w * h);
+		g.aup.resize((size_t)w * h * 2);
+		const std::string* last = nullptr;
+		unsigned char last_idx = 0;
+		for (int z = 0; z < h; z++) {
+			const Tile* row = &tiles[(size_t)(d.z0 + z) * MAP_W + d.x0];
+			float* hd = &g.hup[(size_t)z * w];
+			unsigned char* md = &g.mup[(size_t)z * w];
+			for (int x = 0; x < w; x++) {
+				hd[x] = row[x].h;
+				if (!last || row[x].tid != *last) { last = &row[x].tid; last_idx = tex_pal_idx(row[x].tid); }
+				md[x] = last_idx;
+			}
+			size_t ai = (size_t)(d.z0 + z) * MAP_W + d.x0;
+			unsigned char* ad = &g.aup[(size_t)z * w * 2];
+			for (int x = 0; x < w; x++) {
+				ad[x * 2] = atile.mask[ai + x];
+				ad[x * 2 + 1] = atile.idx_of_rank[atile.over[ai + x]];
+			}
+		}
+		Rectangle rc = { (float)d.x0, (float)d.z0, (float)w, (float)h };
+		UpdateTextureRec(g.htex, rc, g.hup.data());
+		UpdateTextureRec(g.mtex, rc, g.mup.data());
+		UpdateTextureRec(g.attex, rc, g.aup.data());
+		g.last_upload += (size_t)w * h * (sizeof(float) + 3);
+	}
+	g.dirty.clear();
+	if (g.pal_n != (int)tex_pal.size()) {
+		UpdateTextureRec(g.ptex, { 0.0f, 0.0f, (float)tex_pal_col.size(), 1.0f }, tex_pal_col.data());
+		g.pal_n = (int)tex_pal.size();
+	}
+}
+void DrawMapGpu(Camera3D camera, const DirtyRect* area = nullptr) {
+	hf_gpu_init();
+	hf_gpu_upload();
+	int viewDist = (int)(camera.fovy * 1.5f);
+	int startX = std::max(0, area ? area->x0 : (int)camera.target.x - viewDist);
+	int endX = std::min(MAP_W - 1, area ? area->x1 : (int)camera.target.x + viewDist);
+	int startZ = std::max(0, area ? area->z0 : (int)camera.target.z - viewDist);
+	int endZ = std::min(MAP_H - 1, area ? area->z1 : (int)camera.target.z + viewDist);
+	// патчи выровнены по сетке HF_GRID, чтобы вершины всегда попадали в целые тайлы
+	for (int pz = (startZ / HF_GRID) * HF_GRID; pz < endZ; pz += HF_GRID) {
+		for (int px = (startX / HF_GRID) * HF_GRID; px < endX; px += HF_GRID) {
+			DrawMesh(hf_gpu.grid, hf_gpu.mat, MatrixTranslate((float)px, 0.0f, (float)pz));
+			prof.draws++;
+			prof.binds += 3;
+			prof.verts += hf_gpu.grid.vertexCount;
+		}
+	}
+}
+// ===== Пикинг: луч мыши против heightfield через пирамиду min/max =====
+// Уровень 0 - квады (x, z)..(x + 1, z + 1), каждый следующий уровень сворачивает 2x2
+struct HeightPyramid {
+	std::vector<std::vector<float>> mn, mx;
+	std::vector<int> w, h;
+	int dx0 = 0, dz0 = 0, dx1 = 0, dz1 = 0; // грязные квады уровня 0
+};
+HeightPyramid hpyr;
+struct PickHit {
+	bool hit = false;
+	Vector3 pos = { 0 };
+	int x = -1, z = -1; // квад/тайл под курсором
+	float t = 0.0f;
+};
+
+void pick_mark(int x0, int z0, int x1, int z1) {
+	HeightPyramid& p = hpyr;
+	if (p.dx0 >= p.dx1) { p.dx0 = x0; p.dz0 = z0; p.dx1 = x1; p.dz1 = z1; return; }
+	p.dx0 = std::min(p.dx0, x0); p.dz0 = std::min(p.dz0, z0);
+	p.dx1 = std::max(p.dx1, x1); p.dz1 = std::max(p.dz1, z1);
+}
+void pick_sync() {
+	HeightPyramid& p = hpyr;
+	int w = std::max(1, MAP_W - 1), h = std::max(1, MAP_H - 1);
+	if (p.w.empty() || p.w[0] != w || p.h[0] != h) {
+		p.mn.clear(); p.mx.clear(); p.w.clear(); p.h.clear();
+		while (true) {
+			p.w.push_back(w); p.h.push_back(h);
+			p.mn.emplace_back((size_t)w * h, 0.0f);
+			p.mx.emplace_back((size_t)w * h, 0.0f);
+			if (w == 1 && h == 1) break;
+			w = (w + 1) / 2; h = (h + 1) / 2;
+		}
+		p.dx0 = 0; p.dz0 = 0; p.dx1 = MAP_W; p.dz1 = MAP_H;
+	}
+	int x0 = std::max(0, p.dx0), z0 = std::max(0, p.dz0);
+	int x1 = std::min(p.w[0], p.dx1), z1 = std::min(p.h[0], p.dz1);
+	p.dx1 = p.dx0;
+	if (x0 >= x1 || z0 >= z1) return;
+	for (int z = z0; z < z1; z++) {
+		for (int x = x0; x < x1; x++) {
+			float a = GetVertexHeight(x, z), b = GetVertexHeight(x + 1, z);
+			float c = GetVertexHeight(x, z + 1), d = GetVertexHeight(x + 1, z + 1);
+			size_t i = (size_t)z * p.w[0] + x;
+			p.mn[0][i] = std::min(std::min(a, b), std::min(c, d));
+			p.mx[0][i] = std::max(std::max(a, b), std::max(c, d));
+		}
+	}
+	// поднимаемся вверх только по затронутой области
+	for (size_t l = 1; l < p.w.size(); l++) {
+		x0 /= 2; z0 /= 2; x1 = (x1 + 1) / 2; z1 = (z1 + 1) / 2;
+		int pw = p.w[l - 1], ph = p.h[l - 1];
+		for (int z = z0; z < z1; z++) {
+			for (int x = x0; x < x1; x++) {
+				float lo = FLT_MAX, hi = -FLT_MAX;
+				for (int k = 0; k < 4; k++) {
+					int cx = x * 2 + (k & 1), cz = z * 2 + (k >> 1);
+					if (cx >= pw || cz >= ph) continue;
+					lo = std::min(lo, p.mn[l - 1][(size_t)cz * pw + cx]);
+					hi = std::max(hi, p.mx[l - 1][(size_t)cz * pw + cx]);
+				}
+				p.mn[l][(size_t)z * p.w[l] + x] = lo;
+				p.mx[l][(size_t)z * p.w[l] + x] = hi;
+			}
+		}
+	}
+}
+// Пересечение луча с коробкой, [t0, t1] - отрезок внутри
+bool ray_box(const Ray& r, Vector3 mn, Vector3 mx, float& t0, float& t1) {
+	t0 = 0.0f; t1 = FLT_MAX;
+	const float o[3] = { r.position.x, r.position.y, r.position.z };
+	const float d[3] = { r.direction.x, r.direction.y, r.direction.z };
+	const float a[3] = { mn.x, mn.y, mn.z };
+	const float b[3] = { mx.x, mx.y, mx.z };
+	for (int i = 0; i < 3; i++) {
+		if (std::fabs(d[i]) < 1e-12f) {
+			if (o[i] < a[i] || o[i] > b[i]) return false;
+			continue;
+		}
+		float inv = 1.0f / d[i];
+		float ta = (a[i] - o[i]) * inv, tb = (b[i] - o[i]) * inv;
+		if (ta > tb) std::swap(ta, tb);
+		t0 = std::max(t0, ta); t1 = std::min(t1, tb);
+		if (t0 > t1) return false;
+	}
+	return true;
+}
+// Точное пересечение внутри одного квада по GetInterpolatedHeight
+bool pick_leaf(const Ray& r, float t0, float t1, float& out) {
+	auto f = [&](float t) {
+		return r.position.y + r.direction.y * t - GetInterpolatedHeight(r.position.x + r.direction.x * t, r.position.z + r.direction.z * t);
+	};
+	const int STEPS = 4;
+	float pt = t0, pf = f(t0);
+	if (pf <= 0.0f) { out = t0; return true; }
+	for (int i = 1; i <= STEPS; i++) {
+		float t = t0 + (t1 - t0) * i / STEPS;
+		float v = f(t);
+		if (v <= 0.0f) {
+			float lo = pt, hi = t;
+			for (int k = 0; k < 16; k++) {
+				float m = (lo + hi) * 0.5f;
+				if (f(m) > 0.0f) lo = m; else hi = m;
+			}
+			out = hi;
+			return true;
+		}
+		pt = t; pf = v;
+	}
+	return false;
+}
+PickHit pick_terrain(Ray r) {
+	pick_sync();
+	PickHit res;
+	HeightPyramid& p = hpyr;
+	struct Node { int l, x, z; };
+	Node stack[128];
+	int sp = 0;
+	stack[sp++] = { (int)p.w.size() - 1, 0, 0 };
+	while (sp > 0) {
+		Node n = stack[--sp];
+		int s = 1 << n.l;
+		size_t i = (size_t)n.z * p.w[n.l] + n.x;
+		float t0, t1;
+		Vector3 mn = { (float)(n.x * s), p.mn[n.l][i], (float)(n.z * s) };
+		Vector3 mx = { (float)std::min((n.x + 1) * s, p.w[0]), p.mx[n.l][i], (float)std::min((n.z + 1) * s, p.h[0]) };
+		if (!ray_box(r, mn, mx, t0, t1)) continue;
+		if (n.l == 0) {
+			float t;
+			if (pick_leaf(r, t0, t1, t)) {
+				res.hit = true;
+				res.t = t;
+				res.pos = Vector3Add(r.position, Vector3Scale(r.direction, t));
+				res.x = n.x; res.z = n.z;
+				return res;
+			}
+			continue;
+		}
+		// дети в порядке входа луча в их xz-проекцию: первое попадание - ближайшее
+		Node ch[4];
+		float ct[4];
+		int cn = 0;
+		for (int k = 0; k < 4; k++) {
+			int cx = n.x * 2 + (k & 1), cz = n.z * 2 + (k >> 1);
+			if (cx >= p.w[n.l - 1] || cz >= p.h[n.l - 1]) continue;
+			int cs = s / 2;
+			float a0, a1;
+			Vector3 bmn = { (float)(cx * cs), -FLT_MAX, (float)(cz * cs) };
+			Vector3 bmx = { (float)((cx + 1) * cs), FLT_MAX, (float)((cz + 1) * cs) };
+			if (!ray_box(r, bmn, bmx, a0, a1)) continue;
+			int j = cn++;
+			while (j > 0 && ct[j - 1] < a0) { ch[j] = ch[j - 1]; ct[j] = ct[j - 1]; j--; }
+			ch[j] = { n.l - 1, cx, cz };
+			ct[j] = a0;
+		}
+		// в стек кладем дальние первыми
+		for (int k = 0; k < cn && sp < 128; k++) stack[sp++] = ch[k];
+	}
+	return res;
+}
+bool mouse_over_gui(Vector2 ws) {
+	Vector2 m = GetMousePosition();
+	if (m.x < 20.0f + ws.x * 0.1f && m.y < (ct == OBJP ? 530.0f : 900.0f)) return true;
+	if (m.x > ws.x - ws.x * 0.1f && m.y < 90.0f + ws.y * 0.48f) return true;
+	return false;
+}
+void DrawPickHover(const PickHit& h) {
+	if (!h.hit) return;
+	float x = (float)h.x, z = (float)h.z;
+	Vector3 a = { x, GetVertexHeight(h.x, h.z) + 0.02f, z };
+	Vector3 b = { x + 1, GetVertexHeight(h.x + 1, h.z) + 0.02f, z };
+	Vector3 c = { x + 1, GetVertexHeight(h.x + 1, h.z + 1) + 0.02f, z + 1 };
+	Vector3 d = { x, GetVertexHeight(h.x, h.z + 1) + 0.02f, z + 1 };
+	DrawLine3D(a, b, YELLOW); DrawLine3D(b, c, YELLOW);
+	DrawLine3D(c, d, YELLOW); DrawLine3D(d, a, YELLOW);
+}
+// ===== Миникарта: текстура обновляется только в грязных пикселях =====
+const int MM_SIZE = 256; // по длинной стороне карты
+struct Minimap {
+	Texture2D tex = { 0 };
+	int w = 0, h = 0;
+	float scale = 1.0f; // тайлов на пиксель
+	int dx0 = 0, dz0 = 0, dx1 = 0, dz1 = 0; // грязные тайлы
+	std::vector<Color> buf;
+};
+Minimap minimap;
+
+void minimap_mark(int x0, int z0, int x1, int z1) {
+	Minimap& m = minimap;
+	if (m.dx0 >= m.dx1) { m.dx0 = x0; m.dz0 = z0; m.dx1 = x1; m.dz1 = z1; return; }
+	m.dx0 = std::min(m.dx0, x0); m.dz0 = std::min(m.dz0, z0);
+	m.dx1 = std::max(m.dx1, x1); m.dz1 = std::max(m.dz1, z1);
+}
+void minimap_sync() {
+	Minimap& m = minimap;
+	float sc = (float)std::max(MAP_W, MAP_H) / MM_SIZE;
+	int w = std::max(1, (int)(MAP_W / sc)), h = std::max(1, (int)(MAP_H / sc));
+	if (m.tex.id == 0 || m.w != w || m.h != h) {
+		if (m.tex.id) UnloadTexture(m.tex);
+		Image im = GenImageColor(w, h, BLACK);
+		m.tex = LoadTextureFromImage(im);
+		UnloadImage(im);
+		m.w = w; m.h = h; m.scale = sc;
+		m.dx0 = 0; m.dz0 = 0; m.dx1 = MAP_W; m.dz1 = MAP_H;
+	}
+	if (m.dx0 >= m.dx1 || m.dz0 >= m.dz1) return;
+	int px0 = std::clamp((int)(m.dx0 / sc), 0, w - 1), pz0 = std::clamp((int)(m.dz0 / sc), 0, h - 1);
+	int px1 = std::clamp((int)std::ceil(m.dx1 / sc), px0 + 1, w), pz1 = std::clamp((int)std::ceil(m.dz1 / sc), pz0 + 1, h);
+	m.dx1 = m.dx0;
+	int bw = px1 - px0, bh = pz1 - pz0;
+	m.buf.resize((size_t)bw * bh);
+	for (int pz = pz0; pz < pz1; pz++) {
+		for (int px = px0; px < px1; px++) {
+			int x = std::min(MAP_W - 1, (int)((px + 0.5f) * sc));
+			int z = std::min(MAP_H - 1, (int)((pz + 0.5f) * sc));
+			const Tile& t = tiles[(size_t)z * MAP_W + x];
+			Color c = tex_pal_col[tex_pal_idx(t.tid)];
+			// рельеф: свет с северо-запада
+			float d = (t.h - GetVertexHeight(x - 1, z - 1)) * 0.15f;
+			float l = std::clamp(1.0f + d, 0.5f, 1.4f);
+			m.buf[(size_t)(pz - pz0) * bw + (px - px0)] = { (unsigned char)std::min(255.0f, c.r * l), (unsigned char)std::min(255.0f, c.g * l), (unsigned char)std::min(255.0f, c.b * l), 255 };
+		}
+	}
+	UpdateTextureRec(m.tex, { (float)px0, (float)pz0, (float)bw, (float)bh }, m.buf.data());
+}
+// Рисует миникарту в правом нижнем углу; клик переносит камеру
+void DrawMinimap(Vector2 ws, Camera3D& camera) {
+	minimap_sync();
+	Minimap& m = minimap;
+	float sz = std::min(ws.x, ws.y) * 0.25f;
+	float k = sz / std::max(m.w, m.h);
+	Rectangle dst = { ws.x - m.w * k - 10.0f, ws.y - m.h * k - 10.0f, m.w * k, m.h * k };
+	DrawRectangle((int)dst.x - 2, (int)dst.y - 2, (int)dst.width + 4, (int)dst.height + 4, DARKGRAY);
+	DrawTexturePro(m.tex, { 0, 0, (float)m.w, (float)m.h }, dst, { 0, 0 }, 0.0f, WHITE);
+	// видимая область DrawMap
+	float view = camera.fovy * 1.5f;
+	float tk = dst.width / MAP_W;
+	DrawRectangleLines((int)(dst.x + (camera.target.x - view) * tk), (int)(dst.y + (camera.target.z - view) * tk), (int)(view * 2 * tk), (int)(view * 2 * tk), RED);
+	Vector2 mp = GetMousePosition();
+	if (IsMouseButtonDown(MOUSE_BUTTON_LEFT) && CheckCollisionPointRec(mp, dst)) {
+		Vector3 t = { (mp.x - dst.x) / tk, 0.0f, (mp.y - dst.y) / tk };
+		t.y = GetInterpolatedHeight(t.x, t.z);
+		Vector3 delta = Vector3Subtract(t, camera.target);
+		camera.target = t;
+		camera.position = Vector3Add(camera.position, delta);
+	}
+}
+bool mouse_over_minimap(Vector2 ws) {
+	float sz = std::min(ws.x, ws.y) * 0.25f;
+	Vector2 m = GetMousePosition();
+	return m.x > ws.x - sz - 12.0f && m.y > ws.y - sz - 12.0f;
+}
+size_t hf_gpu_last_upload() {
+	return hf_gpu.last_upload;
+}
+void undo_bump(int x0, int z0, int x1, int z1);
+// Все правки tiles сообщают сюда прямоугольник [x0, x1) x [z0, z1)
+void map_changed(int x0, int z0, int x1, int z1) {
+	undo_bump(x0, z0, x1, z1);
+	// вершина (x, z) влияет на соседние квады, поэтому расширяем на 1
+	hf_gpu_mark(x0 - 1, z0 - 1, x1 + 1, z1 + 1);
+	pick_mark(x0 - 1, z0 - 1, x1 + 1, z1 + 1);
+	minimap_mark(x0 - 1, z0 - 1, x1 + 1, z1 + 1);
+	autotile_mark(x0 - 1, z0 - 1, x1 + 1, z1 + 1);
+}
+// ===== Фрустум текущей 3D-камеры (внутри BeginMode3D) =====
+struct Frustum {
+	Vector4 p[6]; // плоскости ax + by + cz + d >= 0 внутри
+};
+Frustum frustum_current() {
+	Matrix m = MatrixMultiply(rlGetMatrixModelview(), rlGetMatrixProjection());
+	Frustum f;
+	f.p[0] = { m.m3 + m.m0, m.m7 + m.m4, m.m11 + m.m8, m.m15 + m.m12 };
+	f.p[1] = { m.m3 - m.m0, m.m7 - m.m4, m.m11 - m.m8, m.m15 - m.m12 };
+	f.p[2] = { m.m3 + m.m1, m.m7 + m.m5, m.m11 + m.m9, m.m15 + m.m13 };
+	f.p[3] = { m.m3 - m.m1, m.m7 - m.m5, m.m11 - m.m9, m.m15 - m.m13 };
+	f.p[4] = { m.m3 + m.m2, m.m7 + m.m6, m.m11 + m.m10, m.m15 + m.m14 };
+	f.p[5] = { m.m3 - m.m2, m.m7 - m.m6, m.m11 - m.m10, m.m15 - m.m14 };
+	return f;
+}
+bool frustum_box(const Frustum& f, Vector3 mn, Vector3 mx) {
+	for (int i = 0; i < 6; i++) {
+		const Vector4& p = f.p[i];
+		// самая "внутренняя" вершина коробки
+		float x = p.x >= 0 ? mx.x : mn.x;
+		float y = p.y >= 0 ? mx.y : mn.y;
+		float z = p.z >= 0 ? mx.z : mn.z;
+		if (p.x * x + p.y * y + p.z * z + p.w < 0) return false;
+	}
+	return true;
+}
+
+// ===== Инстансинг OBJS: группа на tid, внутри группы инстансы отсортированы по ячейкам =====
+const int OBJ_CELL = 64; // размер ячейки для куллинга, в тайлах
+const char* OBJ_VS = R"(#version 330
+in vec3 vertexPosition;
+in vec2 vertexTexCoord;
+in mat4 instanceTransform;
+uniform mat4 mvp;
+out vec2 fragTexCoord;
+void main() {
+	fragTexCoord = vertexTexCoord;
+	gl_Position = mvp * instanceTransform * vec4(vertexPosition, 1.0);
+})";
+const char* OBJ_FS = R"(#version 330
+in vec2 fragTexCoord;
+uniform sampler2D texture0;
+out vec4 finalColor;
+void main() {
+	vec4 c = texture(texture0, fragTexCoord);
+	if (c.a < 0.5) discard;
+	finalColor = c;
+})";
+
+struct ObjGroup {
+	unsigned int vbo = 0;
+	int cap = 0; // вместимость vbo в инстансах
+	std::vector<float16> xf; // по слотам, слоты идут по возрастанию ячейки
+	std::vector<int> cell_start; // cells + 1 элемент: первый слот ячейки
+};
+struct ObjRenderer {
+	bool ready = false;
+	bool all_dirty = true;
+	Shader sh = { 0 };
+	Mesh mesh = { 0 };
+	int loc_xf = -1;
+	int cw = 0, ch = 0;
+	std::map<std::string, ObjGroup> groups; // по tid
+	// по индексу в OBJS: где лежит инстанс
+	std::vector<int> o_slot, o_cell;
+	std::vector<std::string> o_tid;
+	std::vector<float> cell_y0, cell_y1;
+	std::vector<int> dirty;
+	size_t n_objs = 0;
+};
+ObjRenderer objr;
+
+// Крест из двух вертикальных квадов 1x1 с основанием в нуле: деревья и спрайтовые пропсы
+Mesh obj_gen_cross() {
+	Mesh m = { 0 };
+	m.vertexCount = 8;
+	m.triangleCount = 4;
+	m.vertices = (float*)MemAlloc(8 * 3 * sizeof(float));
+	m.texcoords = (float*)MemAlloc(8 * 2 * sizeof(float));
+	m.indices = (unsigned short*)MemAlloc(12 * sizeof(unsigned short));
+	float v[24] = { -0.5f, 0, 0, 0.5f, 0, 0, 0.5f, 1, 0, -0.5f, 1, 0,
+		0, 0, -0.5f, 0, 0, 0.5f, 0, 1, 0.5f, 0, 1, -0.5f };
+	float t[16] = { 0, 1, 1, 1, 1, 0, 0, 0, 0, 1, 1, 1, 1, 0, 0, 0 };
+	unsigned short id[12] = { 0, 1, 2, 0, 2, 3, 4, 5, 6, 4, 6, 7 };
+	memcpy(m.vertices, v, sizeof(v));
+	memcpy(m.texcoords, t, sizeof(t));
+	memcpy(m.indices, id, sizeof(id));
+	UploadMesh(&m, false);
+	return m;
+}
+Texture2D obj_texture(const std::string& tid) {
+	if (!tid.empty()) {
+		Texture2D t = tex_get(tid);
+		if (t.id > 0) return t;
+	}
+	return texs["default"].tex;
+}
+float16 obj_xf(const OBJ& o) {
+	Matrix m = MatrixMultiply(MatrixMultiply(MatrixScale(o.razm, o.razm, o.razm), MatrixRotateY(o.pov * DEG2RAD)),
+		MatrixTranslate(o.vec3.x, o.vec3.y, o.vec3.z));
+	return MatrixToFloatV(m);
+}
+int obj_cell(const OBJ& o) {
+	int cx = std::clamp((int)o.vec3.x / OBJ_CELL, 0, objr.cw - 1);
+	int cz = std::clamp((int)o.vec3.z / OBJ_CELL, 0, objr.ch - 1);
+	return cz * objr.cw + cx;
+}
+// Трансформ объекта поменялся (позиция/поворот/размер/tid)
+void objr_changed(int i) {
+	objr.dirty.push_back(i);
+}
+// Объекты добавлены или удалены: индексы в OBJS поехали, перестраиваем всё
+void objr_reset() {
+	objr.all_dirty = true;
+}
+void objr_upload(ObjGroup& g) {
+	int n = (int)g.xf.size();
+	if (n > g.cap) {
+		if (g.vbo) rlUnloadVertexBuffer(g.vbo);
+		g.cap = std::max(64, n + n / 2);
+		g.vbo = rlLoadVertexBuffer(nullptr, g.cap * (int)sizeof(float16), true);
+	}
+	if (n) rlUpdateVertexBuffer(g.vbo, g.xf.data(), n * (int)sizeof(float16), 0);
+}
+void objr_rebuild() {
+	ObjRenderer& r = objr;
+	r.cw = (MAP_W + OBJ_CELL - 1) / OBJ_CELL;
+	r.ch = (MAP_H + OBJ_CELL - 1) / OBJ_CELL;
+	int cells = r.cw * r.ch;
+	size_t n = OBJS.size();
+	r.o_slot.assign(n, 0);
+	r.o_cell.assign(n, 0);
+	r.o_tid.assign(n, std::string());
+	r.cell_y0.assign(cells, FLT_MAX);
+	r.cell_y1.assign(cells, -FLT_MAX);
+	for (auto& [tid, g] : r.groups) g.cell_start.assign(cells + 1, 0);
+	// сортировка подсчетом: сначала размеры ячеек в каждой группе
+	for (size_t i = 0; i < n; i++) {
+		const OBJ& o = OBJS[i];
+		int c = obj_cell(o);
+		r.o_cell[i] = c;
+		r.o_tid[i] = o.tid;
+		ObjGroup& g = r.groups[o.tid];
+		if ((int)g.cell_start.size() != cells + 1) g.cell_start.assign(cells + 1, 0);
+		g.cell_start[c + 1]++;
+		r.cell_y0[c] = std::min(r.cell_y0[c], o.vec3.y);
+		r.cell_y1[c] = std::max(r.cell_y1[c], o.vec3.y + o.razm);
+	}
+	for (auto it = r.groups.begin(); it != r.groups.end();) {
+		ObjGroup& g = it->second;
+		for (int c = 0; c < cells; c++) g.cell_start[c + 1] += g.cell_start[c];
+		if (g.cell_start[cells] == 0) {
+			if (g.vbo) rlUnloadVertexBuffer(g.vbo);
+			it = r.groups.erase(it);
+			continue;
+		}
+		g.xf.resize(g.cell_start[cells]);
+		++it;
+	}
+	std::map<std::string, std::vector<int>> fill;
+	for (auto& [tid, g] : r.groups) fill[tid].assign(g.cell_start.begin(), g.cell_start.end() - 1);
+	// объекты одного tid обычно идут подряд - группа ищется только при смене
+	const std::string* last = nullptr;
+	std::vector<int>* lf = nullptr;
+	ObjGroup* lg = nullptr;
+	for (size_t i = 0; i < n; i++) {
+		if (!last || r.o_tid[i] != *last) {
+			last = &r.o_tid[i];
+			lf = &fill[*last];
+			lg = &r.groups[*last];
+		}
+		int slot = (*lf)[r.o_cell[i]]++;
+		r.o_slot[i] = slot;
+		lg->xf[slot] = obj_xf(OBJS[i]);
+	}
+	for (auto& [tid, g] : r.groups) objr_upload(g);
+	r.n_objs = n;
+	r.all_dirty = false;
+	r.dirty.clear();
+}
+void objr_sync() {
+	ObjRenderer& r = objr;
+	if (!r.ready) {
+		r.sh = LoadShaderFromMemory(OBJ_VS, OBJ_FS);
+		r.loc_xf = GetShaderLocationAttrib(r.sh, "instanceTransform");
+		r.mesh = obj_gen_cross();
+		r.ready = true;
+	}
+	if (r.n_objs != OBJS.size() || r.cw != (MAP_W + OBJ_CELL - 1) / OBJ_CELL || r.ch != (MAP_H + OBJ_CELL - 1) / OBJ_CELL) r.all_dirty = true;
+	if (!r.all_dirty) {
+		// точечные обновления: инстанс остался в своей ячейке и группе - перезаливаем 64 байта
+		for (int i : r.dirty) {
+			if (i < 0 || i >= (int)OBJS.size()) continue;
+			const OBJ& o = OBJS[i];
+			int c = obj_cell(o);
+			if (c != r.o_cell[i] || o.tid != r.o_tid[i]) { r.all_dirty = true; break; }
+			ObjGroup& g = r.groups[o.tid];
+			g.xf[r.o_slot[i]] = obj_xf(o);
+			rlUpdateVertexBuffer(g.vbo, &g.xf[r.o_slot[i]], sizeof(float16), r.o_slot[i] * (int)sizeof(float16));
+			r.cell_y0[c] = std::min(r.cell_y0[c], o.vec3.y);
+			r.cell_y1[c] = std::max(r.cell_y1[c], o.vec3.y + o.razm);
+		}
+		r.dirty.clear();
+	}
+	if (r.all_dirty) objr_rebuild();
+}
+// Буфер матриц группы уже привязан вызывающим
+void objr_draw_range(int first, int count) {
+	for (int i = 0; i < 4; i++) {
+		unsigned int loc = (unsigned int)(objr.loc_xf + i);
+		rlEnableVertexAttribute(loc);
+		rlSetVertexAttribute(loc, 4, RL_FLOAT, false, sizeof(float16), first * (int)sizeof(float16) + i * 4 * (int)sizeof(float));
+		rlSetVertexAttributeDivisor(loc, 1);
+	}
+	rlDrawVertexArrayElementsInstanced(0, objr.mesh.triangleCount * 3, 0, count);
+	prof.draws++;
+	prof.verts += objr.mesh.vertexCount * count;
+}
+void DrawObjs() {
+	objr_sync();
+	ObjRenderer& r = objr;
+	if (r.groups.empty() || r.loc_xf < 0) return;
+	rlDrawRenderBatchActive();
+	Frustum f = frustum_current();
+	std::vector<char> vis(r.cw * r.ch);
+	for (int c = 0; c < r.cw * r.ch; c++) {
+		if (r.cell_y0[c] > r.cell_y1[c]) continue;
+		Vector3 mn = { (float)((c % r.cw) * OBJ_CELL) - 1.0f, r.cell_y0[c], (float)((c / r.cw) * OBJ_CELL) - 1.0f };
+		Vector3 mx = { mn.x + OBJ_CELL + 2.0f, r.cell_y1[c], mn.z + OBJ_CELL + 2.0f };
+		vis[c] = frustum_box(f, mn, mx);
+	}
+	Matrix mvp = MatrixMultiply(rlGetMatrixModelview(), rlGetMatrixProjection());
+	int zero = 0;
+	rlDisableBackfaceCulling();
+	rlEnableShader(r.sh.id);
+	rlSetUniformMatrix(r.sh.locs[SHADER_LOC_MATRIX_MVP], mvp);
+	rlSetUniform(r.sh.locs[SHADER_LOC_MAP_DIFFUSE], &zero, RL_SHADER_UNIFORM_INT, 1);
+	rlEnableVertexArray(r.mesh.vaoId);
+	for (auto& [tid, g] : r.groups) {
+		rlActiveTextureSlot(0);
+		rlEnableTexture(obj_texture(tid).id);
+		prof.binds++;
+		rlEnableVertexBuffer(g.vbo);
+		// видимые ячейки одной строки идут подряд в буфере - один инстансный вызов на отрезок
+		for (int cz = 0; cz < r.ch; cz++) {
+			int cx = 0;
+			while (cx < r.cw) {
+				if (!vis[cz * r.cw + cx]) { cx++; continue; }
+				int a = cx;
+				while (cx < r.cw && vis[cz * r.cw + cx]) cx++;
+				int first = g.cell_start[cz * r.cw + a];
+				int last = g.cell_start[cz * r.cw + cx];
+				if (last > first) objr_draw_range(first, last - first);
+			}
+		}
+	}
+	for (int i = 0; i < 4; i++) {
+		rlSetVertexAttributeDivisor((unsigned int)(r.loc_xf + i), 0);
+		rlDisableVertexAttribute((unsigned int)(r.loc_xf + i));
+	}
+	rlDisableVertexBuffer();
+	rlDisableVertexArray();
+	rlDisableShader();
+	rlEnableBackfaceCulling();
+}
+// ===== События объектов: подписки по типу и id, очередь разбирается раз в кадр =====
+enum EVENT_TYPE { EV_CLICK, EV_ENTER, EV_DESTROY, EV_TIMER, EV_COUNT };
+struct Event {
+	int type;
+	int obj_id; // OBJ::id адресата
+	int data = 0; // EV_TIMER - id таймера, EV_ENTER - id объекта, вошедшего в радиус razm адресата
+	Vector3 pos = { 0 };
+};
+typedef std::function<void(const Event&)> EventHandler;
+struct EventTimer {
+	double at;
+	double period; // 0 - одноразовый
+	int obj_id;
+	int id;
+	bool operator>(const EventTimer& o) const { return at > o.at; }
+};
+// handler id = слот | поколение << EV_SLOT_BITS: id снятого обработчика не совпадет с id нового в том же слоте
+const int EV_SLOT_BITS = 20;
+const int EV_GEN_MASK = (1 << (31 - EV_SLOT_BITS)) - 1;
+struct EventBus {
+	std::vector<EventHandler> handlers; // по слотам
+	std::vector<int> gen; // поколение слота
+	std::vector<int> free_handlers;
+	// на каждый тип: obj_id -> id обработчиков
+	std::unordered_map<int, std::vector<int>> subs[EV_COUNT];
+	std::vector<Event> queue, work;
+	std::priority_queue<EventTimer, std::vector<EventTimer>, std::greater<EventTimer>> timers;
+	std::unordered_set<int> live_timers; // взведенные и не отмененные; одноразовый уходит отсюда после срабатывания
+	int next_timer = 1;
+	size_t dispatched = 0; // вызовов обработчиков за последний кадр
+};
+EventBus evb;
+int obj_find(int id);
+
+// Слот живого обработчика или -1 (снят, слот занят другим)
+int ev_slot(int handler) {
+	if (handler < 0) return -1;
+	int slot = handler & ((1 << EV_SLOT_BITS) - 1);
+	if (slot >= (int)evb.handlers.size() || evb.gen[slot] != handler >> EV_SLOT_BITS || !evb.handlers[slot]) return -1;
+	return slot;
+}
+int ev_register(EventHandler h) {
+	int slot;
+	if (!evb.free_handlers.empty()) {
+		slot = evb.free_handlers.back();
+		evb.free_handlers.pop_back();
+		evb.handlers[slot] = std::move(h);
+	}
+	else {
+		slot = (int)evb.handlers.size();
+		evb.handlers.push_back(std::move(h));
+		evb.gen.push_back(0);
+	}
+	return slot | evb.gen[slot] << EV_SLOT_BITS;
+}
+// Подписки на снятый обработчик больше не срабатывают и вычищаются в ev_dispatch при первой встрече
+void ev_unregister(int handler) {
+	int slot = ev_slot(handler);
+	if (slot < 0) return;
+	evb.handlers[slot] = nullptr;
+	evb.gen[slot] = (evb.gen[slot] + 1) & EV_GEN_MASK;
+	evb.free_handlers.push_back(slot);
+}
+void ev_subscribe(int obj_id, int type, int handler) {
+	evb.subs[type][obj_id].push_back(handler);
+}
+void ev_unsubscribe(int obj_id, int type, int handler) {
+	auto it = evb.subs[type].find(obj_id);
+	if (it == evb.subs[type].end()) return;
+	auto& v = it->second;
+	v.erase(std::remove(v.begin(), v.end(), handler), v.end());
+	if (v.empty()) evb.subs[type].erase(it);
+}
+// Убрать подписки на снятые обработчики
+void ev_purge(int obj_id, int type) {
+	auto it = evb.subs[type].find(obj_id);
+	if (it == evb.subs[type].end()) return;
+	auto& v = it->second;
+	v.erase(std::remove_if(v.begin(), v.end(), [](int h) { return ev_slot(h) < 0; }), v.end());
+	if (v.empty()) evb.subs[type].erase(it);
+}
+// Событие в очередь; обработчики вызовутся в ev_dispatch
+void ev_emit(const Event& e) {
+	if (evb.subs[e.type].count(e.obj_id) || e.type == EV_CLICK || e.type == EV_DESTROY) evb.queue.push_back(e);
+}
+int ev_timer(int obj_id, double delay, double period = 0.0) {
+	int id = evb.next_timer++;
+	evb.timers.push({ GetTime() + delay, period, obj_id, id });
+	evb.live_timers.insert(id);
+	return id;
+}
+void ev_timer_cancel(int id) {
+	evb.live_timers.erase(id);
+}
+void ev_dispatch(double now) {
+	evb.dispatched = 0;
+	while (!evb.timers.empty() && evb.timers.top().at <= now) {
+		EventTimer t = evb.timers.top();
+		evb.timers.pop();
+		if (!evb.live_timers.count(t.id)) continue;
+		if (obj_find(t.obj_id) < 0) {
+			evb.live_timers.erase(t.id);
+			continue;
+		}
+		ev_emit({ EV_TIMER, t.obj_id, t.id });
+		if (t.period > 0.0) {
+			t.at += t.period;
+			evb.timers.push(t);
+		}
+		else evb.live_timers.erase(t.id);
+	}
+	// обработчики могут порождать события - они уйдут в следующий кадр
+	std::swap(evb.queue, evb.work);
+	for (const Event& e : evb.work) {
+		if (e.type == EV_CLICK) {
+			// старый колбек объекта
+			int i = obj_find(e.obj_id);
+			if (i >= 0 && OBJS[i].onclck) OBJS[i].onclck(OBJS[i]);
+		}
+		auto it = evb.subs[e.type].find(e.obj_id);
+		if (it != evb.subs[e.type].end()) {
+			std::vector<int> hs = it->second;
+			bool stale = false;
+			for (int h : hs) {
+				int slot = ev_slot(h);
+				if (slot < 0) { stale = true; continue; }
+				evb.handlers[slot](e);
+				evb.dispatched++;
+			}
+			// обработчики могли менять подписки - ищем заново
+			if (stale) ev_purge(e.obj_id, e.type);
+		}
+		if (e.type == EV_DESTROY) {
+			for (int t = 0; t < EV_COUNT; t++) evb.subs[t].erase(e.obj_id);
+		}
+	}
+	evb.work.clear();
+}
+// ===== Пространственный индекс OBJS: хеш-сетка по vec3.x / vec3.z =====
+// Объекты адресуются индексом в OBJS; удаление - swap с последним, индекс переносится
+const float OIX_CELL = 8.0f;
+struct ObjIndex {
+	std::unordered_map<long long, std::vector<int>> cells;
+	std::vector<long long> o_key; // ячейка объекта
+	std::vector<int> o_pos; // позиция в векторе ячейки
+	std::unordered_map<int, int> by_id; // OBJ::id -> индекс
+	// занятые ячейки лежат внутри [ex0, ex1] x [ez0, ez1]; только растет, сбрасывается в oix_rebuild
+	int ex0 = INT_MAX, ez0 = INT_MAX, ex1 = INT_MIN, ez1 = INT_MIN;
+};
+ObjIndex oix;
+int next_obj_id = 1;
+int so_idx = -1; // выбранный объект (индекс в OBJS)
+
+long long oix_key(int cx, int cz) {
+	return ((long long)cz << 32) ^ (unsigned int)cx;
+}
+long long oix_key_of(const Vector3& v) {
+	return oix_key((int)std::floor(v.x / OIX_CELL), (int)std::floor(v.z / OIX_CELL));
+}
+void oix_link(int i) {
+	long long k = oix_key_of(OBJS[i].vec3);
+	std::vector<int>& c = oix.cells[k];
+	int cx = (int)std::floor(OBJS[i].vec3.x / OIX_CELL), cz = (int)std::floor(OBJS[i].vec3.z / OIX_CELL);
+	oix.ex0 = std::min(oix.ex0, cx); oix.ex1 = std::max(oix.ex1, cx);
+	oix.ez0 = std::min(oix.ez0, cz); oix.ez1 = std::max(oix.ez1, cz);
+	oix.o_key[i] = k;
+	oix.o_pos[i] = (int)c.size();
+	c.push_back(i);
+}
+void oix_unlink(int i) {
+	auto it = oix.cells.find(oix.o_key[i]);
+	std::vector<int>& c = it->second;
+	int p = oix.o_pos[i];
+	c[p] = c.back();
+	oix.o_pos[c[p]] = p;
+	c.pop_back();
+	if (c.empty()) oix.cells.erase(it);
+}
+void oix_rebuild() {
+	oix.cells.clear();
+	oix.by_id.clear();
+	oix.ex0 = oix.ez0 = INT_MAX;
+	oix.ex1 = oix.ez1 = INT_MIN;
+	oix.o_key.assign(OBJS.size(), 0);
+	oix.o_pos.assign(OBJS.size(), 0);
+	for (int i = 0; i < (int)OBJS.size(); i++) {
+		oix_link(i);
+		oix.by_id[OBJS[i].id] = i;
+	}
+}
+int obj_find(int id) {
+	if (oix.o_key.size() != OBJS.size()) oix_rebuild();
+	auto it = oix.by_id.find(id);
+	return it == oix.by_id.end() ? -1 : it->second;
+}
+// Единственные точки изменения OBJS: индекс и рендер обновляются здесь
+int obj_add(OBJ o) {
+	if (oix.o_key.size() != OBJS.size()) oix_rebuild();
+	if (o.id == 0) o.id = next_obj_id++;
+	else next_obj_id = std::max(next_obj_id, o.id + 1);
+	OBJS.push_back(std::move(o));
+	int i = (int)OBJS.size() - 1;
+	oix.o_key.push_back(0);
+	oix.o_pos.push_back(0);
+	oix_link(i);
+	oix.by_id[OBJS[i].id] = i;
+	objr_reset();
+	return i;
+}
+void obj_move(int i, Vector3 pos) {
+	if (oix.o_key.size() != OBJS.size()) oix_rebuild();
+	Vector3 was = OBJS[i].vec3;
+	OBJS[i].vec3 = pos;
+	// EV_ENTER подписчику, в чей радиус razm объект вошел этим перемещением; подписчиков мало, перебор
+	for (const auto& kv : evb.subs[EV_ENTER]) {
+		int j = obj_find(kv.first);
+		if (j < 0 || j == i) continue;
+		const OBJ& o = OBJS[j];
+		float r2 = o.razm * o.razm;
+		float nx = pos.x - o.vec3.x, nz = pos.z - o.vec3.z;
+		float wx = was.x - o.vec3.x, wz = was.z - o.vec3.z;
+		if (nx * nx + nz * nz <= r2 && wx * wx + wz * wz > r2) ev_emit({ EV_ENTER, o.id, OBJS[i].id, pos });
+	}
+	long long k = oix_key_of(pos);
+	if (k != oix.o_key[i]) {
+		oix_unlink(i);
+		oix_link(i);
+	}
+	objr_changed(i);
+}
+void obj_remove(int i) {
+	if (oix.o_key.size() != OBJS.size()) oix_rebuild();
+	int last = (int)OBJS.size() - 1;
+	ev_emit({ EV_DESTROY, OBJS[i].id, 0, OBJS[i].vec3 });
+	oix_unlink(i);
+	oix.by_id.erase(OBJS[i].id);
+	if (i != last) {
+		oix_unlink(last);
+		OBJS[i] = std::move(OBJS[last]);
+		oix_link(i);
+		oix.by_id[OBJS[i].id] = i;
+	}
+	OBJS.pop_back();
+	oix.o_key.pop_back();
+	oix.o_pos.pop_back();
+	if (so_idx == i) so_idx = -1;
+	else if (so_idx == last) so_idx = i;
+	objr_reset();
+}
+// Все объекты в прямоугольнике [x0, x1] x [z0, z1]
+template <class F> void oix_rect(float x0, float z0, float x1, float z1, F&& fn) {
+	if (oix.o_key.size() != OBJS.size()) oix_rebuild();
+	int cx0 = (int)std::floor(x0 / OIX_CELL), cx1 = (int)std::floor(x1 / OIX_CELL);
+	int cz0 = (int)std::floor(z0 / OIX_CELL), cz1 = (int)std::floor(z1 / OIX_CELL);
+	// прямоугольник больше числа занятых ячеек - дешевле пройти по хешу
+	if ((long long)(cx1 - cx0 + 1) * (cz1 - cz0 + 1) > (long long)oix.cells.size()) {
+		for (auto& [k, c] : oix.cells)
+			for (int i : c) {
+				const Vector3& v = OBJS[i].vec3;
+				if (v.x >= x0 && v.x <= x1 && v.z >= z0 && v.z <= z1) fn(i);
+			}
+		return;
+	}
+	for (int cz = cz0; cz <= cz1; cz++) {
+		for (int cx = cx0; cx <= cx1; cx++) {
+			auto it = oix.cells.find(oix_key(cx, cz));
+			if (it == oix.cells.end()) continue;
+			for (int i : it->second) {
+				const Vector3& v = OBJS[i].vec3;
+				if (v.x >= x0 && v.x <= x1 && v.z >= z0 && v.z <= z1) fn(i);
+			}
+		}
+	}
+}
+std::vector<int> oix_query_rect(float x0, float z0, float x1, float z1) {
+	std::vector<int> out;
+	oix_rect(x0, z0, x1, z1, [&](int i) { out.push_back(i); });
+	return out;
+}
+std::vector<int> oix_query_radius(float x, float z, float r) {
+	std::vector<int> out;
+	oix_rect(x - r, z - r, x + r, z + r, [&](int i) {
+		float dx = OBJS[i].vec3.x - x, dz = OBJS[i].vec3.z - z;
+		if (dx * dx + dz * dz <= r * r) out.push_back(i);
+	});
+	return out;
+}
+// Объекты в той же точке (с допуском eps)
+std::vector<int> oix_query_point(float x, float z, float eps = 0.01f) {
+	return oix_query_radius(x, z, eps);
+}
+// k ближайших, от ближнего к дальнему; кольца ячеек расширяются, пока k-й не ближе кольца.
+// Обходится только периметр кольца, обрезанный по занятой области: пустые кольца вокруг далекой точки пропускаются
+std::vector<int> oix_query_knn(float x, float z, int k, float max_r = FLT_MAX) {
+	if (oix.o_key.size() != OBJS.size()) oix_rebuild();
+	std::vector<std::pair<float, int>> best; // max-куча по расстоянию
+	if (k <= 0 || OBJS.empty() || oix.ex0 > oix.ex1) return {};
+	int ccx = (int)std::floor(x / OIX_CELL), ccz = (int)std::floor(z / OIX_CELL);
+	size_t seen_cells = 0;
+	auto visit = [&](int cx, int cz) {
+		auto it = oix.cells.find(oix_key(cx, cz));
+		if (it == oix.cells.end()) return;
+		seen_cells++;
+		for (int i : it->second) {
+			float dx = OBJS[i].vec3.x - x, dz = OBJS[i].vec3.z - z;
+			float d = dx * dx + dz * dz;
+			if (d > max_r * max_r) continue;
+			if ((int)best.size() < k) {
+				best.push_back({ d, i });
+				std::push_heap(best.begin(), best.end());
+			}
+			else if (d < best.front().first) {
+				std::pop_heap(best.begin(), best.end());
+				best.back() = { d, i };
+				std::push_heap(best.begin(), best.end());
+			}
+		}
+	};
+	// кольца ближе r0 не задевают занятую область, дальше r1 - уже ничего нет
+	int r0 = std::max({ 0, oix.ex0 - ccx, ccx - oix.ex1, oix.ez0 - ccz, ccz - oix.ez1 });
+	int r1 = std::max({ ccx - oix.ex0, oix.ex1 - ccx, ccz - oix.ez0, oix.ez1 - ccz });
+	for (int ring = r0; ring <= r1; ring++) {
+		float ring_d = (ring - 1) * OIX_CELL; // минимальная дистанция до ячеек этого кольца
+		if ((int)best.size() == k && ring_d > 0 && ring_d * ring_d > best.front().first) break;
+		if (ring_d > max_r || seen_cells >= oix.cells.size()) break;
+		if (ring == 0) {
+			visit(ccx, ccz);
+			continue;
+		}
+		int xa = std::max(ccx - ring, oix.ex0), xb = std::min(ccx + ring, oix.ex1);
+		int za = std::max(ccz - ring + 1, oix.ez0), zb = std::min(ccz + ring - 1, oix.ez1);
+		for (int cz : { ccz - ring, ccz + ring })
+			if (cz >= oix.ez0 && cz <= oix.ez1)
+				for (int cx = xa; cx <= xb; cx++) visit(cx, cz);
+		for (int cx : { ccx - ring, ccx + ring })
+			if (cx >= oix.ex0 && cx <= oix.ex1)
+				for (int cz = za; cz <= zb; cz++) visit(cx, cz);
+	}
+	std::sort_heap(best.begin(), best.end());
+	std::vector<int> out;
+	for (auto& b : best) out.push_back(b.second);
+	return out;
+}
+// ===== Экспорт карты в большое изображение: по тайлам через RenderTexture, полосами на диск =====
+// Память ограничена одной полосой (ширина картинки x EXP_TILE пикселей)
+const int EXP_TILE = 2048;
+struct MapExport {
+	bool active = false;
+	std::string base; // base_row000.png, base_row001.png ... + base.json
+	float ppu = 8.0f; // пикселей на тайл карты
+	int img_w = 0, img_h = 0;
+	int cols = 0, rows = 0;
+	int tx = 0, ty = 0; // следующий тайл
+	RenderTexture2D rt = { 0 };
+	std::vector<unsigned char> strip;
+	std::function<bool(float)> progress; // false = отмена
+};
+MapExport mexp;
+
+void export_finish() {
+	if (mexp.rt.id) UnloadRenderTexture(mexp.rt);
+	mexp.rt = { 0 };
+	mexp.strip.clear();
+	mexp.strip.shrink_to_fit();
+	mexp.active = false;
+}
+bool export_begin(const std::string& base, float ppu, std::function<bool(float)> progress) {
+	if (mexp.active) return false;
+	mexp.base = base;
+	mexp.ppu = ppu;
+	mexp.img_w = (int)(MAP_W * ppu);
+	mexp.img_h = (int)(MAP_H * ppu);
+	mexp.cols = (mexp.img_w + EXP_TILE - 1) / EXP_TILE;
+	mexp.rows = (mexp.img_h + EXP_TILE - 1) / EXP_TILE;
+	mexp.tx = mexp.ty = 0;
+	mexp.progress = progress;
+	mexp.rt = LoadRenderTexture(EXP_TILE, EXP_TILE);
+	if (mexp.rt.id == 0) return false;
+	mexp.strip.assign((size_t)mexp.img_w * EXP_TILE * 4, 0);
+	mexp.active = true;
+	json meta = { {"width", mexp.img_w}, {"height", mexp.img_h}, {"strip_height", EXP_TILE}, {"rows", mexp.rows}, {"ppu", ppu} };
+	std::ofstream(base + ".json") << meta.dump(2);
+	return true;
+}
+void export_cancel() {
+	if (mexp.active) TraceLog(LOG_WARNING, "EXPORT: cancelled at row %d/%d", mexp.ty, mexp.rows);
+	export_finish();
+}
+// Рендерит один тайл; вызывать вне BeginDrawing. false - экспорт закончен или отменен
+bool export_step() {
+	if (!mexp.active) return false;
+	pick_sync();
+	float world = EXP_TILE / mexp.ppu;
+	float top = hpyr.mx.back()[0] + 10.0f;
+	Camera3D cam = { 0 };
+	cam.target = { mexp.tx * world + world * 0.5f, 0.0f, mexp.ty * world + world * 0.5f };
+	cam.position = { cam.target.x, top, cam.target.z };
+	cam.up = { 0.0f, 0.0f, -1.0f };
+	cam.fovy = world;
+	cam.projection = CAMERA_ORTHOGRAPHIC;
+	BeginTextureMode(mexp.rt);
+	ClearBackground(SKYBLUE);
+	// ортографический тайл видит ровно world x world тайлов, +1 на края
+	DirtyRect area = { (int)std::floor(mexp.tx * world) - 1, (int)std::floor(mexp.ty * world) - 1,
+		(int)std::ceil((mexp.tx + 1) * world) + 1, (int)std::ceil((mexp.ty + 1) * world) + 1 };
+	BeginMode3D(cam);
+	if (gpu_terrain) DrawMapGpu(cam, &area);
+	else DrawMap(cam, &area);
+	DrawObjs();
+	EndMode3D();
+	EndTextureMode();
+	// копируем тайл в полосу (render texture перевернута по y)
+	Image im = LoadImageFromTexture(mexp.rt.texture);
+	ImageFlipVertical(&im);
+	int x0 = mexp.tx * EXP_TILE;
+	int cw = std::min(EXP_TILE, mexp.img_w - x0);
+	for (int y = 0; y < EXP_TILE; y++) {
+		memcpy(&mexp.strip[((size_t)y * mexp.img_w + x0) * 4], (unsigned char*)im.data + (size_t)y * EXP_TILE * 4, (size_t)cw * 4);
+	}
+	UnloadImage(im);
+	if (++mexp.tx >= mexp.cols) {
+		int sh = std::min(EXP_TILE, mexp.img_h - mexp.ty * EXP_TILE);
+		std::string path = mexp.base + TextFormat("_row%03d.png", mexp.ty);
+		if (!stbi_write_png(path.c_str(), mexp.img_w, sh, 4, mexp.strip.data(), mexp.img_w * 4)) {
+			TraceLog(LOG_WARNING, "EXPORT: failed to write %s", path.c_str());
+			export_finish();
+			return false;
+		}
+		mexp.tx = 0;
+		mexp.ty++;
+	}
+	float done = (float)(mexp.ty * mexp.cols + mexp.tx) / (mexp.rows * mexp.cols);
+	if (mexp.progress && !mexp.progress(done)) {
+		export_cancel();
+		return false;
+	}
+	if (mexp.ty >= mexp.rows) {
+		TraceLog(LOG_INFO, "EXPORT: %dx%d -> %s_row*.png", mexp.img_w, mexp.img_h, mexp.base.c_str());
+		export_finish();
+		return false;
+	}
+	return true;
+}
+// Блокирующий вариант для скриптов/хоткеев
+bool export_map(const std::string& base, float ppu, std::function<bool(float)> progress) {
+	if (!export_begin(base, ppu, progress)) return false;
+	while (export_step()) {}
+	return mexp.ty >= mexp.rows;
+}
+#endif
+// ===== Чанки тайлов: упаковка в байты (undo, файлы) =====
+const int CHUNK = 64;
+int chunks_w() { return (MAP_W + CHUNK - 1) / CHUNK; }
+int chunks_h() { return (MAP_H + CHUNK - 1) / CHUNK; }
+// Чанк c карты mw x mh
+DirtyRect chunk_rect(int c, int mw, int mh) {
+	int cw = (mw + CHUNK - 1) / CHUNK;
+	DirtyRect r;
+	r.x0 = (c % cw) * CHUNK; r.z0 = (c / cw) * CHUNK;
+	r.x1 = std::min(mw, r.x0 + CHUNK); r.z1 = std::min(mh, r.z0 + CHUNK);
+	return r;
+}
+DirtyRect chunk_rect(int c) {
+	return chunk_rect(c, MAP_W, MAP_H);
+}
+template <class T> void put_raw(std::vector<unsigned char>& o, const T& v) {
+	size_t n = o.size();
+	o.resize(n + sizeof(T));
+	memcpy(&o[n], &v, sizeof(T));
+}
+template <class T> T get_raw(const unsigned char*& p) {
+	T v;
+	memcpy(&v, p, sizeof(T));
+	p += sizeof(T);
+	return v;
+}
+// Массив 4-байтных значений раскладываем по байтовым плоскостям - deflate так жмет float в разы лучше
+void put_planes(std::vector<unsigned char>& o, const unsigned char* src, size_t n) {
+	size_t base = o.size();
+	o.resize(base + n * 4);
+	for (int b = 0; b < 4; b++)
+		for (size_t i = 0; i < n; i++) o[base + b * n + i] = src[i * 4 + b];
+}
+void get_planes(const unsigned char*& p, unsigned char* dst, size_t n) {
+	for (int b = 0; b < 4; b++)
+		for (size_t i = 0; i < n; i++) dst[i * 4 + b] = p[b * n + i];
+	p += n * 4;
+}
+// Формат: w, h | id[] | h[] | bid[] | таблица tid + индексы | разреженные j
+std::vector<unsigned char> chunk_pack(int c) {
+	DirtyRect r = chunk_rect(c);
+	int w = r.x1 - r.x0, h = r.z1 - r.z0;
+	size_t n = (size_t)w * h;
+	std::vector<int> ids(n), bids(n);
+	std::vector<float> hs(n);
+	std::vector<unsigned short> ti(n);
+	std::vector<std::string> tab;
+	std::vector<std::pair<unsigned short, std::string>> js;
+	for (int z = 0; z < h; z++) {
+		for (int x = 0; x < w; x++) {
+			const Tile& t = tiles[(size_t)(r.z0 + z) * MAP_W + r.x0 + x];
+			size_t i = (size_t)z * w + x;
+			ids[i] = t.id; bids[i] = t.bid; hs[i] = t.h;
+			size_t k = 0;
+			while (k < tab.size() && tab[k] != t.tid) k++;
+			if (k == tab.size()) tab.push_back(t.tid);
+			ti[i] = (unsigned short)k;
+			if (!t.j.is_null()) js.push_back({ (unsigned short)i, t.j.dump() });
+		}
+	}
+	std::vector<unsigned char> o;
+	o.reserve(n * 14);
+	put_raw<unsigned short>(o, (unsigned short)w);
+	put_raw<unsigned short>(o, (unsigned short)h);
+	put_planes(o, (const unsigned char*)ids.data(), n);
+	put_planes(o, (const unsigned char*)hs.data(), n);
+	put_planes(o, (const unsigned char*)bids.data(), n);
+	put_raw<unsigned short>(o, (unsigned short)tab.size());
+	for (const std::string& t : tab) {
+		put_raw<unsigned short>(o, (unsigned short)t.size());
+		o.insert(o.end(), t.begin(), t.end());
+	}
+	size_t tb = o.size();
+	o.resize(tb + n * 2);
+	memcpy(&o[tb], ti.data(), n * 2);
+	put_raw<unsigned int>(o, (unsigned int)js.size());
+	for (auto& [i, d] : js) {
+		put_raw<unsigned short>(o, i);
+		put_raw<unsigned int>(o, (unsigned int)d.size());
+		o.insert(o.end(), d.begin(), d.end());
+	}
+	return o;
+}
+void chunk_unpack(int c, const unsigned char* p) {
+	DirtyRect r = chunk_rect(c);
+	int w = get_raw<unsigned short>(p), h = get_raw<unsigned short>(p);
+	if (w != r.x1 - r.x0 || h != r.z1 - r.z0) return;
+	size_t n = (size_t)w * h;
+	std::vector<int> ids(n), bids(n);
+	std::vector<float> hs(n);
+	get_planes(p, (unsigned char*)ids.data(), n);
+	get_planes(p, (unsigned char*)hs.data(), n);
+	get_planes(p, (unsigned char*)bids.data(), n);
+	std::vector<std::string> tab(get_raw<unsigned short>(p));
+	for (std::string& t : tab) {
+		unsigned short l = get_raw<unsigned short>(p);
+		t.assign((const char*)p, l);
+		p += l;
+	}
+	const unsigned char* ti = p;
+	p += n * 2;
+	for (int z = 0; z < h; z++) {
+		for (int x = 0; x < w; x++) {
+			Tile& t = tiles[(size_t)(r.z0 + z) * MAP_W + r.x0 + x];
+			size_t i = (size_t)z * w + x;
+			unsigned short k;
+			memcpy(&k, ti + i * 2, 2);
+			t.id = ids[i]; t.bid = bids[i]; t.h = hs[i];
+			t.tid = k < tab.size() ? tab[k] : "";
+			t.j = json();
+		}
+	}
+	unsigned int nj = get_raw<unsigned int>(p);
+	for (unsigned int k = 0; k < nj; k++) {
+		unsigned short i = get_raw<unsigned short>(p);
+		unsigned int l = get_raw<unsigned int>(p);
+		tiles[(size_t)(r.z0 + i / w) * MAP_W + r.x0 + i % w].j = json::parse(p, p + l, nullptr, false);
+		p += l;
+	}
+}
+#ifndef SMAP_TOOL
+bool bytes_deflate(const unsigned char* src, size_t n, std::vector<unsigned char>& out);
+bool bytes_inflate(const unsigned char* src, size_t n, unsigned char* dst, size_t raw);
+// Блоб: uint32 размер исходных данных + deflate. Размер известен заранее - буфер ровно под него,
+// а не 64 МБ на каждый вызов, как в DecompressData
+typedef std::shared_ptr<const std::vector<unsigned char>> Blob;
+Blob blob_deflate(const std::vector<unsigned char>& raw) {
+	std::vector<unsigned char> z;
+	auto b = std::make_shared<std::vector<unsigned char>>();
+	if (!bytes_deflate(raw.data(), raw.size(), z)) return b;
+	put_raw<uint32_t>(*b, (uint32_t)raw.size());
+	b->insert(b->end(), z.begin(), z.end());
+	return b;
+}
+std::vector<unsigned char> blob_inflate(const Blob& b) {
+	if (b->size() < 4) return {};
+	const unsigned char* p = b->data();
+	size_t raw = get_raw<uint32_t>(p), n = b->size() - 4;
+	// deflate не сжимает больше чем в ~1032 раза - больший размер в заголовке значит битые данные
+	if (raw > n * 1032 + 64) return {};
+	std::vector<unsigned char> out(raw);
+	if (!bytes_inflate(p, n, out.data(), raw)) return {};
+	return out;
+}
+
+// ===== Undo/redo: дельты по чанкам, сжатые и общие между шагами =====
+struct UndoChunk {
+	int c;
+	Blob before, after;
+};
+// Объект по id до и после шага; nullopt - объекта не было (добавлен) или не стало (удален)
+struct UndoObj {
+	int id;
+	std::optional<OBJ> before, after;
+};
+struct UndoStep {
+	std::vector<UndoChunk> ch;
+	std::vector<UndoObj> obj;
+	size_t bytes = 0;
+};
+struct UndoHistory {
+	std::deque<UndoStep> steps;
+	size_t pos = 0; // сколько шагов сейчас применено
+	size_t bytes = 0;
+	size_t cap = (size_t)256 << 20; // лимит памяти истории
+	bool open = false;
+	UndoStep cur;
+	std::vector<char> in_cur;
+	std::unordered_set<int> obj_in_cur;
+	// версия чанка растет при каждой правке; cache хранит blob последнего известного состояния
+	std::vector<unsigned int> ver;
+	std::vector<std::pair<unsigned int, Blob>> cache;
+};
+UndoHistory undo;
+
+void undo_fit() {
+	size_t n = (size_t)chunks_w() * chunks_h();
+	if (undo.ver.size() == n) return;
+	undo.steps.clear();
+	undo.pos = 0;
+	undo.bytes = 0;
+	undo.ver.assign(n, 1);
+	undo.cache.assign(n, { 0, nullptr });
+	undo.in_cur.assign(n, 0);
+}
+// Текущее состояние чанка; сжимаем только если он менялся с прошлого раза
+Blob undo_snapshot(int c) {
+	if (undo.cache[c].first == undo.ver[c] && undo.cache[c].second) return undo.cache[c].second;
+	Blob b = blob_deflate(chunk_pack(c));
+	undo.cache[c] = { undo.ver[c], b };
+	return b;
+}
+// Вызывается из map_changed
+void undo_bump(int x0, int z0, int x1, int z1) {
+	if (undo.ver.empty()) return;
+	x0 = std::max(0, x0); z0 = std::max(0, z0);
+	x1 = std::min(MAP_W, x1); z1 = std::min(MAP_H, z1);
+	for (int cz = z0 / CHUNK; cz * CHUNK < z1; cz++)
+		for (int cx = x0 / CHUNK; cx * CHUNK < x1; cx++) undo.ver[(size_t)cz * chunks_w() + cx]++;
+}
+void undo_begin() {
+	undo_fit();
+	if (undo.open) return;
+	undo.open = true;
+	undo.cur = UndoStep();
+}
+// До правки: запоминаем "до" для еще не тронутых в этой операции чанков
+void undo_touch(const DirtyRect& r) {
+	if (!undo.open || r.empty()) return;
+	for (int cz = r.z0 / CHUNK; cz * CHUNK < r.z1; cz++) {
+		for (int cx = r.x0 / CHUNK; cx * CHUNK < r.x1; cx++) {
+			int c = cz * chunks_w() + cx;
+			if (undo.in_cur[c]) continue;
+			undo.in_cur[c] = 1;
+			undo.cur.ch.push_back({ c, undo_snapshot(c), nullptr });
+		}
+	}
+}
+// До правки объекта: запоминаем его "до"; added - объект с этим id сейчас будет создан
+void undo_obj_touch(int id, bool added = false) {
+	if (!undo.open || !undo.obj_in_cur.insert(id).second) return;
+	UndoObj u{ id };
+	int i = added ? -1 : obj_find(id);
+	if (i >= 0) u.before = OBJS[i];
+	undo.cur.obj.push_back(std::move(u));
+}
+void undo_end() {
+	if (!undo.open) return;
+	undo.open = false;
+	UndoStep st = std::move(undo.cur);
+	for (UndoChunk& u : st.ch) {
+		undo.in_cur[u.c] = 0;
+		u.after = undo_snapshot(u.c);
+		st.bytes += u.before->size() + u.after->size();
+	}
+	undo.obj_in_cur.clear();
+	for (UndoObj& u : st.obj) {
+		int i = obj_find(u.id);
+		if (i >= 0) u.after = OBJS[i];
+		st.bytes += sizeof(UndoObj);
+	}
+	if (st.ch.empty() && st.obj.empty()) return;
+	// новая операция отрезает redo-хвост
+	while (undo.steps.size() > undo.pos) {
+		undo.bytes -= undo.steps.back().bytes;
+		undo.steps.pop_back();
+	}
+	undo.bytes += st.bytes;
+	undo.steps.push_back(std::move(st));
+	undo.pos++;
+	while (undo.bytes > undo.cap && undo.steps.size() > 1) {
+		undo.bytes -= undo.steps.front().bytes;
+		undo.steps.pop_front();
+		undo.pos--;
+	}
+}
+void undo_apply(const UndoStep& st, bool redo) {
+	for (const UndoChunk& u : st.ch) {
+		const Blob& b = redo ? u.after : u.before;
+		std::vector<unsigned char> raw = blob_inflate(b);
+		if (raw.empty()) continue;
+		chunk_unpack(u.c, raw.data());
+		DirtyRect r = chunk_rect(u.c);
+		map_changed(r.x0, r.z0, r.x1, r.z1);
+		undo.cache[u.c] = { undo.ver[u.c], b };
+	}
+	for (const UndoObj& u : st.obj) {
+		const std::optional<OBJ>& o = redo ? u.after : u.before;
+		int i = obj_find(u.id);
+		if (!o) {
+			if (i >= 0) obj_remove(i);
+		}
+		else if (i < 0) obj_add(*o);
+		else {
+			// без obj_move: откат - не перемещение, EV_ENTER не шлем
+			oix_unlink(i);
+			OBJS[i] = *o;
+			oix_link(i);
+			objr_changed(i);
+		}
+	}
+}
+bool undo_undo() {
+	if (undo.open || undo.pos == 0) return false;
+	undo.pos--;
+	undo_apply(undo.steps[undo.pos], false);
+	return true;
+}
+bool undo_redo() {
+	if (undo.open || undo.pos >= undo.steps.size()) return false;
+	undo_apply(undo.steps[undo.pos], true);
+	undo.pos++;
+	return true;
+}
+
+void sel_clear();
+
+void undo_reset() {
+	undo.steps.clear();
+	undo.pos = 0;
+	undo.bytes = 0;
+	undo.open = false;
+	undo.obj_in_cur.clear();
+	undo.ver.clear();
+	undo.cache.clear();
+}
+// Окно подкачки сдвинулось на (dcx, dcz) чанков: чанк c переезжает в c - dcx - dcz * cw. Шаги с ушедшими
+// чанками отменить уже нельзя - отрезаются вместе со всеми более старыми (и более новыми в redo-хвосте)
+void undo_shift(int dcx, int dcz) {
+	if (undo.ver.empty()) return;
+	int cw = chunks_w(), chh = chunks_h();
+	auto moved = [&](int c) {
+		int cx = c % cw - dcx, cz = c / cw - dcz;
+		return cx >= 0 && cx < cw && cz >= 0 && cz < chh ? cz * cw + cx : -1;
+	};
+	// объекты хранятся в координатах окна; ушедший за окно объект - как ушедший чанк
+	auto obj_gone = [&](const std::optional<OBJ>& o) {
+		if (!o) return false;
+		int cx = (int)std::floor(o->vec3.x / CHUNK) - dcx, cz = (int)std::floor(o->vec3.z / CHUNK) - dcz;
+		return cx < 0 || cx >= cw || cz < 0 || cz >= chh;
+	};
+	size_t keep0 = 0, keep1 = undo.steps.size();
+	for (size_t i = 0; i < undo.steps.size(); i++) {
+		bool gone = false;
+		for (UndoChunk& u : undo.steps[i].ch) gone = gone || moved(u.c) < 0;
+		for (UndoObj& u : undo.steps[i].obj) gone = gone || obj_gone(u.before) || obj_gone(u.after);
+		if (!gone) continue;
+		if (i < undo.pos) keep0 = i + 1;
+		else { keep1 = i; break; }
+	}
+	while (undo.steps.size() > keep1) {
+		undo.bytes -= undo.steps.back().bytes;
+		undo.steps.pop_back();
+	}
+	for (size_t i = 0; i < keep0; i++) {
+		undo.bytes -= undo.steps.front().bytes;
+		undo.steps.pop_front();
+	}
+	undo.pos -= keep0;
+	for (UndoStep& st : undo.steps) {
+		for (UndoChunk& u : st.ch) u.c = moved(u.c);
+		for (UndoObj& u : st.obj)
+			for (std::optional<OBJ>* o : { &u.before, &u.after })
+				if (*o) {
+					(*o)->vec3.x -= dcx * CHUNK;
+					(*o)->vec3.z -= dcz * CHUNK;
+				}
+	}
+	// версии и кеш переезжают; пришедшие чанки получают новую версию от вызывающего
+	std::vector<unsigned int> ver(undo.ver.size(), 1);
+	std::vector<std::pair<unsigned int, Blob>> cache(undo.cache.size(), { 0, nullptr });
+	for (int c = 0; c < cw * chh; c++) {
+		int m = moved(c);
+		if (m < 0) continue;
+		ver[m] = undo.ver[c];
+		cache[m] = std::move(undo.cache[c]);
+	}
+	undo.ver.swap(ver);
+	undo.cache.swap(cache);
+}
+#endif
+
+// ===== Файл только для чтения, отображенный в память =====
+struct MappedFile {
+	const unsigned char* data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	void* file = nullptr;
+	void* map = nullptr;
+#else
+	int fd = -1;
+#endif
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile() { close(); }
+	bool open(const std::string& path) {
+		close();
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), 0x80000000UL /*GENERIC_READ*/, 1 /*FILE_SHARE_READ*/, nullptr, 3 /*OPEN_EXISTING*/, 0x80 /*NORMAL*/, nullptr);
+		if (file == (void*)(intptr_t)-1) { file = nullptr; return false; }
+		long long sz = 0;
+		if (!GetFileSizeEx(file, &sz) || sz <= 0) { close(); return false; }
+		map = CreateFileMappingA(file, nullptr, 2 /*PAGE_READONLY*/, 0, 0, nullptr);
+		if (!map) { close(); return false; }
+		data = (const unsigned char*)MapViewOfFile(map, 4 /*FILE_MAP_READ*/, 0, 0, 0);
+		size = (size_t)sz;
+#else
+		fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size <= 0) { close(); return false; }
+		void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED) { close(); return false; }
+		data = (const unsigned char*)p;
+		size = (size_t)st.st_size;
+#endif
+		if (!data) { close(); return false; }
+		return true;
+	}
+	void close() {
+#ifdef _WIN32
+		if (data) UnmapViewOfFile(data);
+		if (map) CloseHandle(map);
+		if (file) CloseHandle(file);
+		map = file = nullptr;
+#else
+		if (data) munmap((void*)data, size);
+		if (fd >= 0) ::close(fd);
+		fd = -1;
+#endif
+		data = nullptr;
+		size = 0;
+	}
+};
+// Записанное в файл - на диск (fstream сбрасывает только в кеш ОС); файл может быть открыт на запись и у нас
+bool file_sync(const std::string& path) {
+#ifdef _WIN32
+	void* h = CreateFileA(path.c_str(), 0x40000000UL /*GENERIC_WRITE*/, 3 /*FILE_SHARE_READ | WRITE*/, nullptr, 3 /*OPEN_EXISTING*/, 0x80 /*NORMAL*/, nullptr);
+	if (h == (void*)(intptr_t)-1) return false;
+	bool ok = FlushFileBuffers(h) != 0;
+	CloseHandle(h);
+#else
+	int fd = ::open(path.c_str(), O_RDWR);
+	if (fd < 0) return false;
+	bool ok = fsync(fd) == 0;
+	::close(fd);
+#endif
+	return ok;
+}
+
+// ===== Сжатие/хеш для файловых форматов =====
+// sdefl/sinfl уже собраны внутри raylib (его CompressData), берем их напрямую:
+// размер распакованного известен из каталога, и не нужен буфер на 64 МБ как в DecompressData
+bool bytes_deflate(const unsigned char* src, size_t n, std::vector<unsigned char>& out) {
+	thread_local std::unique_ptr<sdefl> sd;
+	if (!sd) sd = std::make_unique<sdefl>();
+	out.resize(sdefl_bound((int)n));
+	int k = sdeflate(sd.get(), out.data(), src, (int)n, 5);
+	if (k <= 0) return false;
+	out.resize(k);
+	return true;
+}
+bool bytes_inflate(const unsigned char* src, size_t n, unsigned char* dst, size_t raw) {
+	return sinflate(dst, (int)raw, src, (int)n) == (int)raw;
+}
+uint64_t hash64(const void* data, size_t n) {
+	const unsigned char* p = (const unsigned char*)data;
+	uint64_t h = 0x9E3779B97F4A7C15ull ^ (n * 0xC2B2AE3D27D4EB4Full);
+	for (; n >= 8; n -= 8, p += 8) {
+		uint64_t k;
+		memcpy(&k, p, 8);
+		k *= 0xFF51AFD7ED558CCDull;
+		k ^= k >> 32;
+		h = (h ^ k) * 0x9E3779B97F4A7C15ull;
+		h ^= h >> 29;
+	}
+	uint64_t t = 0;
+	memcpy(&t, p, n);
+	h = (h ^ t) * 0xFF51AFD7ED558CCDull;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ull;
+	return h ^ (h >> 33);
+}
+
+// ===== Кодек высот: предсказание по соседям + упаковка остатков по битам =====
+// Без потерь: float как упорядоченный uint32 (монотонно по значению, соседние высоты дают малые разности).
+// С квантованием: round(h / step), ошибка около step / 2. Остатки zigzag, блоками по 32 с шириной блока
+// Обычные сохранения, автосохранение и подкачка всегда без потерь; step - только для явного экспорта с квантованием и замера
+struct HeightCodec {
+	float step = 0.0f; // 0 - без потерь
+};
+HeightCodec hcodec;
+enum HF_PRED { HP_LEFT, HP_PAETH, HP_LINEAR, HP_COUNT };
+const int HF_BLOCK = 32;
+
+uint32_t hf_f2ord(float f) {
+	uint32_t u;
+	memcpy(&u, &f, 4);
+	return (u & 0x80000000u) ? ~u : u | 0x80000000u;
+}
+float hf_ord2f(uint32_t o) {
+	uint32_t u = (o & 0x80000000u) ? o & 0x7FFFFFFFu : ~o;
+	float f;
+	memcpy(&f, &u, 4);
+	return f;
+}
+// Предсказание v[z][x] по уже известным соседям (a - слева, b - сверху, c - по диагонали)
+uint32_t hf_predict(const uint32_t* v, int w, int x, int z, int pred) {
+	if (x == 0 && z == 0) return 0x80000000u;
+	if (z == 0) return v[x - 1];
+	if (x == 0) return v[(size_t)(z - 1) * w];
+	int64_t a = v[(size_t)z * w + x - 1], b = v[(size_t)(z - 1) * w + x], c = v[(size_t)(z - 1) * w + x - 1];
+	if (pred == HP_LEFT) return (uint32_t)a;
+	if (pred == HP_LINEAR) return (uint32_t)(a + b - c);
+	int64_t p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+	return (uint32_t)(pa <= pb && pa <= pc ? a : pb <= pc ? b : c);
+}
+uint32_t hf_zig(uint32_t d) { return (d << 1) ^ (uint32_t)((int32_t)d >> 31); }
+uint32_t hf_unzig(uint32_t z) { return (z >> 1) ^ (0u - (z & 1)); }
+int hf_bits(uint32_t m) { int b = 0; while (m) { b++; m >>= 1; } return b; }
+
+// Формат: mode, pred, w(u16), h(u16), step(f32) | ширины блоков (по байту) | биты остатков
+#pragma pack(push, 1)
+struct HfHead {
+	uint8_t mode; // 0 - float без потерь, 1 - квантование
+	uint8_t pred;
+	uint16_t w, h;
+	float step;
+};
+#pragma pack(pop)
+// raw - плоскости float чанка (как в ML_HEIGHT); false - кодек тут не подходит
+bool hf_encode(const unsigned char* raw, size_t n_bytes, int w, int h, float step, std::vector<unsigned char>& out) {
+	size_t n = (size_t)w * h;
+	if (n == 0 || n * 4 != n_bytes) return false;
+	std::vector<float> f(n);
+	const unsigned char* p = raw;
+	get_planes(p, (unsigned char*)f.data(), n);
+	std::vector<uint32_t> v(n);
+	HfHead hd = { 0, HP_LEFT, (uint16_t)w, (uint16_t)h, step };
+	if (step > 0.0f) {
+		hd.mode = 1;
+		for (size_t i = 0; i < n; i++) {
+			float q = std::round(f[i] / step);
+			if (!std::isfinite(q) || std::fabs(q) > 1e9f) { hd.mode = 0; break; }
+			v[i] = (uint32_t)(int32_t)q + 0x80000000u;
+		}
+	}
+	if (hd.mode == 0) for (size_t i = 0; i < n; i++) v[i] = hf_f2ord(f[i]);
+	// остатки под каждый предсказатель, берем тот, что меньше после упаковки
+	size_t nb = (n + HF_BLOCK - 1) / HF_BLOCK;
+	std::vector<uint32_t> res(n), best;
+	size_t best_bits = SIZE_MAX;
+	for (int pr = 0; pr < HP_COUNT; pr++) {
+		for (int z = 0; z < h; z++)
+			for (int x = 0; x < w; x++) {
+				size_t i = (size_t)z * w + x;
+				res[i] = hf_zig(v[i] - hf_predict(v.data(), w, x, z, pr));
+			}
+		size_t bits = 0;
+		for (size_t b = 0; b < nb; b++) {
+			uint32_t m = 0;
+			for (size_t i = b * HF_BLOCK; i < std::min(n, (b + 1) * HF_BLOCK); i++) m |= res[i];
+			bits += (size_t)hf_bits(m) * HF_BLOCK;
+		}
+		if (bits < best_bits) {
+			best_bits = bits;
+			best = res;
+			hd.pred = (uint8_t)pr;
+		}
+	}
+	out.resize(sizeof(hd) + nb);
+	memcpy(out.data(), &hd, sizeof(hd));
+	uint64_t acc = 0;
+	int fill = 0;
+	for (size_t b = 0; b < nb; b++) {
+		size_t i0 = b * HF_BLOCK, i1 = std::min(n, i0 + HF_BLOCK);
+		uint32_t m = 0;
+		for (size_t i = i0; i < i1; i++) m |= best[i];
+		int bw = hf_bits(m);
+		out[sizeof(hd) + b] = (unsigned char)bw;
+		if (!bw) continue;
+		for (size_t i = i0; i < i1; i++) {
+			acc |= (uint64_t)best[i] << fill;
+			fill += bw;
+			while (fill >= 8) {
+				out.push_back((unsigned char)acc);
+				acc >>= 8;
+				fill -= 8;
+			}
+		}
+	}
+	if (fill > 0) out.push_back((unsigned char)acc);
+	return true;
+}
+// В dst - плоскости float, raw байт
+bool hf_decode(const unsigned char* src, size_t len, unsigned char* dst, size_t raw) {
+	HfHead hd;
+	if (len < sizeof(hd)) return false;
+	memcpy(&hd, src, sizeof(hd));
+	int w = hd.w, h = hd.h;
+	size_t n = (size_t)w * h, nb = (n + HF_BLOCK - 1) / HF_BLOCK;
+	if (n * 4 != raw || len < sizeof(hd) + nb || hd.pred >= HP_COUNT) return false;
+	const unsigned char* wd = src + sizeof(hd);
+	const unsigned char* bp = wd + nb;
+	const unsigned char* end = src + len;
+	std::vector<uint32_t> v(n);
+	uint64_t acc = 0;
+	int fill = 0;
+	for (size_t b = 0; b < nb; b++) {
+		int bw = wd[b];
+		if (bw > 32) return false;
+		uint64_t mask = bw == 32 ? 0xFFFFFFFFull : ((1ull << bw) - 1);
+		for (size_t i = b * HF_BLOCK; i < std::min(n, (b + 1) * HF_BLOCK); i++) {
+			while (fill < bw) {
+				if (bp >= end) return false;
+				acc |= (uint64_t)*bp++ << fill;
+				fill += 8;
+			}
+			uint32_t zr = (uint32_t)(acc & mask);
+			acc >>= bw;
+			fill -= bw;
+			int x = (int)(i % w), z = (int)(i / w);
+			v[i] = hf_unzig(zr) + hf_predict(v.data(), w, x, z, hd.pred);
+		}
+	}
+	std::vector<float> f(n);
+	if (hd.mode == 1) for (size_t i = 0; i < n; i++) f[i] = (float)(int32_t)(v[i] - 0x80000000u) * hd.step;
+	else for (size_t i = 0; i < n; i++) f[i] = hf_ord2f(v[i]);
+	for (int b = 0; b < 4; b++)
+		for (size_t i = 0; i < n; i++) dst[b * n + i] = ((const unsigned char*)f.data())[i * 4 + b];
+	return true;
+}
+
+// ===== Пак ассетов .sapk: исходные байты файлов текстур, дедупликация по хешу =====
+// [заголовок][байты ассетов...][каталог]. Декодируются лениво, при первом tex_get
+#pragma pack(push, 1)
+struct SapkHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t count;
+	uint32_t reserved;
+	uint64_t dir_off;
+};
+struct SapkEntry {
+	uint64_t hash;
+	uint64_t off;
+	uint32_t size;
+	char ext[12]; // ".png" для LoadImageFromMemory
+};
+#pragma pack(pop)
+struct Asset {
+	uint64_t off = 0; // в отображенном паке
+	uint32_t size = 0;
+	char ext[12] = {};
+	std::vector<unsigned char> mem; // добавлен после открытия пака, еще не записан
+};
+struct AssetPack {
+	MappedFile mf;
+	std::string path;
+	std::unordered_map<uint64_t, Asset> items;
+};
+AssetPack apk;
+
+const unsigned char* asset_data(const Asset& a) {
+	return a.mem.empty() ? apk.mf.data + a.off : a.mem.data();
+}
+uint64_t asset_add(const unsigned char* p, size_t n, const std::string& ext) {
+	uint64_t id = hash64(p, n);
+	if (id == 0) id = 1;
+	auto it = apk.items.find(id);
+	if (it != apk.items.end()) {
+		if (it->second.size != n || memcmp(asset_data(it->second), p, n) != 0) TraceLog(LOG_WARNING, "SAPK: hash collision %016llx", (unsigned long long)id);
+		return id;
+	}
+	Asset& a = apk.items[id];
+	a.size = (uint32_t)n;
+	a.mem.assign(p, p + n);
+	strncpy(a.ext, ext.c_str(), sizeof(a.ext) - 1);
+	return id;
+}
+bool pack_open(const std::string& path) {
+	apk.items.clear();
+	apk.path.clear();
+	if (!apk.mf.open(path)) return false;
+	SapkHeader hd;
+	if (apk.mf.size < sizeof(hd)) { apk.mf.close(); return false; }
+	memcpy(&hd, apk.mf.data, sizeof(hd));
+	if (memcmp(hd.magic, "SAPK", 4) != 0 || hd.dir_off + (uint64_t)hd.count * sizeof(SapkEntry) > apk.mf.size) {
+		apk.mf.close();
+		return false;
+	}
+	for (uint32_t i = 0; i < hd.count; i++) {
+		SapkEntry e;
+		memcpy(&e, apk.mf.data + hd.dir_off + (size_t)i * sizeof(e), sizeof(e));
+		if (e.off + e.size > apk.mf.size) continue;
+		Asset& a = apk.items[e.hash];
+		a.off = e.off;
+		a.size = e.size;
+		memcpy(a.ext, e.ext, sizeof(a.ext));
+		a.ext[sizeof(a.ext) - 1] = 0;
+	}
+	apk.path = path;
+	return true;
+}
+// Пишутся только ассеты, на которые ссылается texs; после записи пак переоткрывается с диска
+bool pack_save(const std::string& path) {
+	std::string tmp_path = path + ".tmp";
+	std::ofstream f(tmp_path, std::ios::binary | std::ios::trunc);
+	if (!f) return false;
+	std::unordered_set<uint64_t> used;
+	for (auto& [k, t] : texs) if (t.asset) used.insert(t.asset);
+	SapkHeader hd = {};
+	memcpy(hd.magic, "SAPK", 4);
+	hd.version = 1;
+	f.write((const char*)&hd, sizeof(hd));
+	std::vector<SapkEntry> dir;
+	uint64_t off = sizeof(hd);
+	for (uint64_t id : used) {
+		auto it = apk.items.find(id);
+		if (it == apk.items.end()) continue;
+		SapkEntry e = {};
+		e.hash = id;
+		e.off = off;
+		e.size = it->second.size;
+		memcpy(e.ext, it->second.ext, sizeof(e.ext));
+		f.write((const char*)asset_data(it->second), e.size);
+		off += e.size;
+		dir.push_back(e);
+	}
+	hd.count = (uint32_t)dir.size();
+	hd.dir_off = off;
+	f.write((const char*)dir.data(), dir.size() * sizeof(SapkEntry));
+	f.seekp(0);
+	f.write((const char*)&hd, sizeof(hd));
+	f.close();
+	if (!f) return false;
+	// на Windows отображенный файл нельзя заменить
+	apk.mf.close();
+	std::error_code ec;
+	std::filesystem::rename(tmp_path, path, ec);
+	return pack_open(ec ? tmp_path : path) && !ec;
+}
+std::string pack_path(const std::string& map_path) {
+	return std::filesystem::path(map_path).replace_extension(".sapk").string();
+}
+#ifndef SMAP_TOOL
+Texture2D tex_get(const std::string& tid) {
+	auto it = texs.find(tid);
+	if (it == texs.end()) return { 0 };
+	TexRef& t = it->second;
+	if (t.tex.id == 0 && t.asset && !t.failed) {
+		auto a = apk.items.find(t.asset);
+		if (a != apk.items.end()) {
+			Image im = LoadImageFromMemory(a->second.ext, asset_data(a->second), (int)a->second.size);
+			if (im.data) {
+				t.tex = LoadTextureFromImage(im);
+				UnloadImage(im);
+			}
+		}
+		t.failed = t.tex.id == 0;
+	}
+	return t.tex;
+}
+void tex_list_rebuild() {
+	texs_for_list.clear();
+	for (auto& [k, t] : texs) if (t.asset) texs_for_list.push_back(k.c_str());
+}
+bool tex_add_file(const std::string& file) {
+	int n = 0;
+	unsigned char* d = LoadFileData(file.c_str(), &n);
+	if (!d) return false;
+	uint64_t id = asset_add(d, n, GetFileExtension(file.c_str()));
+	UnloadFileData(d);
+	TexRef& t = texs[GetFileNameWithoutExt(file.c_str())];
+	if (t.tex.id > 0) UnloadTexture(t.tex);
+	t = TexRef();
+	t.asset = id;
+	tex_list_rebuild();
+	return true;
+}
+// В карте: tid -> хеш ассета (hex, чтобы не терять биты в чужих JSON-парсерах)
+json texs_to_json() {
+	json j = json::object();
+	for (auto& [k, t] : texs) if (t.asset) j[k] = TextFormat("%016llx", (unsigned long long)t.asset);
+	return j;
+}
+void texs_from_json(const json& j) {
+	for (auto it = texs.begin(); it != texs.end();) {
+		if (!it->second.asset) { ++it; continue; }
+		if (it->second.tex.id > 0) UnloadTexture(it->second.tex);
+		it = texs.erase(it);
+	}
+	if (j.is_object())
+		for (auto it = j.begin(); it != j.end(); ++it) {
+			if (!it.value().is_string()) continue;
+			TexRef& t = texs[it.key()];
+			t = TexRef();
+			t.asset = std::strtoull(it.value().get<std::string>().c_str(), nullptr, 16);
+		}
+	tex_list_rebuild();
+}
+#endif
+
+// ===== Бинарный формат карты .smap =====
+// [заголовок][meta json][полезные данные чанков...][каталог: cw * ch * ML_COUNT записей]
+enum MAP_LAYER { ML_HEIGHT, ML_TEX, ML_BIOME, ML_PROPS, ML_OBJS, ML_ID, ML_COUNT };
+enum MAP_CODEC { MC_RAW, MC_DEFLATE, MC_HEIGHT };
+const uint32_t SMAP_VERSION = 4;
+#pragma pack(push, 1)
+struct SmapHeader {
+	char magic[4];
+	uint32_t version;
+	int32_t map_w, map_h;
+	int32_t chunk;
+	uint32_t layers;
+	uint64_t meta_off, meta_size;
+	uint64_t dir_off; // каталог: chunks_w * chunks_h * layers записей SmapEntry
+	// v2: каталог дописывается в журнал, заголовок указывает на последний целый
+	uint64_t dir_hash;
+	uint64_t live; // байт, на которые ссылается каталог (с заголовком, meta и самим каталогом)
+	// v3: журнал дописывает не весь каталог, а дельту - измененные записи. delta_off - последняя дельта,
+	// через prev цепочка ведет к первой, она накладывается на полный каталог dir_off
+	uint64_t delta_off;
+	uint64_t delta_bytes; // все дельты цепочки
+	uint32_t delta_count;
+	uint32_t pad;
+};
+struct SmapEntry {
+	uint64_t off;
+	uint32_t size; // в файле
+	uint32_t raw; // после распаковки
+	uint32_t codec;
+	uint32_t reserved;
+	uint64_t hash; // хеш распакованных данных
+};
+struct SmapDeltaHead {
+	uint64_t prev; // предыдущая дельта, 0 - эта первая
+	uint32_t count;
+	uint32_t reserved;
+	uint64_t hash; // хеш записей
+};
+struct SmapDeltaEntry {
+	uint32_t idx; // c * ML_COUNT + layer
+	SmapEntry e;
+};
+#pragma pack(pop)
+const uint32_t SMAP_DELTA_MAX = 64; // дельт в цепочке, дальше - снова полный каталог
+
+// Палитра tid на весь файл
+struct TidPalette {
+	std::vector<std::string> names;
+	std::unordered_map<std::string, uint16_t> idx;
+	uint16_t get(const std::string& t) {
+		auto it = idx.find(t);
+		if (it != idx.end()) return it->second;
+		uint16_t k = (uint16_t)names.size();
+		names.push_back(t);
+		idx.emplace(t, k);
+		return k;
+	}
+};
+// Последний открытый/сохраненный .smap: относительно него считаются измененные чанки
+struct SmapJournal {
+	std::string path;
+	SmapHeader hd = {};
+	std::vector<SmapEntry> dir;
+	TidPalette pal; // индексы tid в файле, только растет
+	std::vector<unsigned int> ver; // undo.ver на момент записи/чтения
+	int epoch = -1;
+};
+SmapJournal sj;
+int map_epoch = 0; // растет при замене карты целиком
+const double SMAP_COMPACT_RATIO = 2.0; // файл больше живых данных во столько раз - переписываем
+
+TidPalette tid_palette_build() {
+	TidPalette p;
+	const std::string* last = nullptr;
+	for (const Tile& t : tiles) {
+		if (last && t.tid == *last) continue;
+		p.get(t.tid);
+		last = &t.tid;
+	}
+	return p;
+}
+// Объекты по чанкам (по позиции)
+std::vector<std::vector<int>> objs_by_chunk(const std::vector<OBJ>& objs, int w, int h) {
+	int cw = (w + CHUNK - 1) / CHUNK, ch = (h + CHUNK - 1) / CHUNK;
+	std::vector<std::vector<int>> b((size_t)cw * ch);
+	for (int i = 0; i < (int)objs.size(); i++) {
+		int cx = std::clamp((int)objs[i].vec3.x / CHUNK, 0, cw - 1);
+		int cz = std::clamp((int)objs[i].vec3.z / CHUNK, 0, ch - 1);
+		b[(size_t)cz * cw + cx].push_back(i);
+	}
+	return b;
+}
+// Слой объектов: счетчик, затем объекты, tid строкой
+void obj_write(std::vector<unsigned char>& o, const OBJ& ob) {
+	put_raw<int32_t>(o, ob.id);
+	put_raw<uint16_t>(o, (uint16_t)ob.tid.size());
+	o.insert(o.end(), ob.tid.begin(), ob.tid.end());
+	put_raw<int32_t>(o, ob.proch);
+	put_raw<float>(o, ob.vec3.x); put_raw<float>(o, ob.vec3.y); put_raw<float>(o, ob.vec3.z);
+	put_raw<float>(o, ob.pov); put_raw<float>(o, ob.razm);
+	put_raw<uint16_t>(o, (uint16_t)ob.anim.size());
+	o.insert(o.end(), ob.anim.begin(), ob.anim.end());
+	std::string j = ob.j.is_null() ? std::string() : ob.j.dump();
+	put_raw<uint32_t>(o, (uint32_t)j.size());
+	o.insert(o.end(), j.begin(), j.end());
+}
+bool obj_read(const unsigned char*& p, const unsigned char* end, OBJ& ob) {
+	if (end - p < 32) return false;
+	ob = OBJ{};
+	ob.id = get_raw<int32_t>(p);
+	uint16_t tl = get_raw<uint16_t>(p);
+	if (end - p < tl + 26) return false;
+	ob.tid.assign((const char*)p, tl);
+	p += tl;
+	ob.proch = get_raw<int32_t>(p);
+	ob.vec3.x = get_raw<float>(p); ob.vec3.y = get_raw<float>(p); ob.vec3.z = get_raw<float>(p);
+	ob.pov = get_raw<float>(p); ob.razm = get_raw<float>(p);
+	uint16_t al = get_raw<uint16_t>(p);
+	if (end - p < al + 4) return false;
+	ob.anim.assign((const char*)p, al);
+	p += al;
+	uint32_t jl = get_raw<uint32_t>(p);
+	if ((size_t)(end - p) < jl) return false;
+	if (jl) ob.j = json::parse(p, p + jl, nullptr, false);
+	if (ob.j.is_discarded()) ob.j = json();
+	p += jl;
+	return true;
+}
+void objs_encode(const std::vector<OBJ>& src, const std::vector<int>& idx, std::vector<unsigned char>& o) {
+	o.clear();
+	put_raw<uint32_t>(o, (uint32_t)idx.size());
+	for (int i : idx) obj_write(o, src[i]);
+}
+// ver - версия файла. До v4 у слоя с tid строкой в счетчике стоял старший бит, без него tid был индексом
+// в списке текстур на момент записи - такие слои не читаются
+bool objs_decode(const unsigned char* p, size_t len, std::vector<OBJ>& out, uint32_t ver = SMAP_VERSION) {
+	if (len == 0) return true;
+	if (len < 4) return false;
+	const unsigned char* end = p + len;
+	uint32_t k = get_raw<uint32_t>(p);
+	if (ver < 4) {
+		if (!(k & 0x80000000u)) return false;
+		k &= ~0x80000000u;
+	}
+	for (uint32_t i = 0; i < k; i++) {
+		OBJ ob;
+		if (!obj_read(p, end, ob)) return false;
+		out.push_back(std::move(ob));
+	}
+	return true;
+}
+// Один слой тайлов одного чанка в байты (без сжатия). Если все tid уже в pal, можно звать из нескольких потоков
+void layer_encode(int c, int layer, TidPalette& pal, std::vector<unsigned char>& o) {
+	DirtyRect r = chunk_rect(c);
+	int w = r.x1 - r.x0, h = r.z1 - r.z0;
+	size_t n = (size_t)w * h;
+	o.clear();
+	if (layer == ML_PROPS) {
+		size_t cnt = o.size();
+		put_raw<uint32_t>(o, 0);
+		uint32_t k = 0;
+		for (int z = 0; z < h; z++)
+			for (int x = 0; x < w; x++) {
+				const Tile& t = tiles[(size_t)(r.z0 + z) * MAP_W + r.x0 + x];
+				if (t.j.is_null()) continue;
+				std::string d = t.j.dump();
+				put_raw<uint16_t>(o, (uint16_t)(z * w + x));
+				put_raw<uint32_t>(o, (uint32_t)d.size());
+				o.insert(o.end(), d.begin(), d.end());
+				k++;
+			}
+		memcpy(&o[cnt], &k, 4);
+		return;
+	}
+	std::vector<uint32_t> v(n);
+	std::vector<uint16_t> ti;
+	if (layer == ML_TEX) ti.resize(n);
+	for (int z = 0; z < h; z++) {
+		const Tile* row = &tiles[(size_t)(r.z0 + z) * MAP_W + r.x0];
+		for (int x = 0; x < w; x++) {
+			size_t i = (size_t)z * w + x;
+			switch (layer) {
+			case ML_HEIGHT: memcpy(&v[i], &row[x].h, 4); break;
+			case ML_BIOME: v[i] = (uint32_t)row[x].bid; break;
+			case ML_ID: v[i] = (uint32_t)row[x].id; break;
+			default: ti[i] = pal.get(row[x].tid); break;
+			}
+		}
+	}
+	if (layer == ML_TEX) {
+		o.resize(n * 2);
+		memcpy(o.data(), ti.data(), n * 2);
+	}
+	else put_planes(o, (const unsigned char*)v.data(), n);
+}
+// Раскладка слоя чанка в tv (карта mw x mh); по умолчанию - в открытую карту. ver - версия файла
+bool layer_decode(int c, int layer, const unsigned char* p, size_t len, const std::vector<std::string>& pal, std::vector<OBJ>& objs,
+	std::vector<Tile>& tv = tiles, int mw = MAP_W, int mh = MAP_H, uint32_t ver = SMAP_VERSION) {
+	DirtyRect r = chunk_rect(c, mw, mh);
+	int w = r.x1 - r.x0, h = r.z1 - r.z0;
+	size_t n = (size_t)w * h;
+	const unsigned char* end = p + len;
+	if (len == 0) return true;
+	if (layer == ML_OBJS) return objs_decode(p, len, objs, ver);
+	if (layer == ML_PROPS) {
+		if (len < 4) return false;
+		uint32_t k = get_raw<uint32_t>(p);
+		for (uint32_t i = 0; i < k; i++) {
+			if (end - p < 6) return false;
+			uint16_t ix = get_raw<uint16_t>(p);
+			uint32_t l = get_raw<uint32_t>(p);
+			if ((size_t)(end - p) < l || ix >= n) return false;
+			json j = json::parse(p, p + l, nullptr, false);
+			if (!j.is_discarded()) tv[(size_t)(r.z0 + ix / w) * mw + r.x0 + ix % w].j = std::move(j);
+			p += l;
+		}
+		return true;
+	}
+	if (layer == ML_TEX) {
+		if (len != n * 2) return false;
+		for (int z = 0; z < h; z++)
+			for (int x = 0; x < w; x++) {
+				uint16_t k;
+				memcpy(&k, p + ((size_t)z * w + x) * 2, 2);
+				tv[(size_t)(r.z0 + z) * mw + r.x0 + x].tid = k < pal.size() ? pal[k] : std::string();
+			}
+		return true;
+	}
+	if (len != n * 4) return false;
+	std::vector<uint32_t> v(n);
+	get_planes(p, (unsigned char*)v.data(), n);
+	for (int z = 0; z < h; z++)
+		for (int x = 0; x < w; x++) {
+			Tile& t = tv[(size_t)(r.z0 + z) * mw + r.x0 + x];
+			uint32_t u = v[(size_t)z * w + x];
+			if (layer == ML_HEIGHT) memcpy(&t.h, &u, 4);
+			else if (layer == ML_BIOME) t.bid = (int)u;
+			else t.id = (int)u;
+		}
+	return true;
+}
+// Сжимаем, если это выгодно; e заполняется кроме off. Высоты - своим кодеком, ему нужен размер чанка cw x ch.
+// hstep > 0 - высоты с квантованием (только явный экспорт); хеш тогда от того, что прочитается из файла
+void payload_pack(const std::vector<unsigned char>& raw, bool compress, SmapEntry& e, std::vector<unsigned char>& out, int layer = -1, int cw = 0, int ch = 0,
+	float hstep = 0.0f) {
+	e = SmapEntry{};
+	e.raw = (uint32_t)raw.size();
+	e.hash = hash64(raw.data(), raw.size());
+	if (compress && layer == ML_HEIGHT && hf_encode(raw.data(), raw.size(), cw, ch, hstep, out) && out.size() < raw.size()) {
+		e.codec = MC_HEIGHT;
+		if (hstep > 0.0f) {
+			std::vector<unsigned char> dec(raw.size());
+			if (hf_decode(out.data(), out.size(), dec.data(), dec.size())) e.hash = hash64(dec.data(), dec.size());
+		}
+	}
+	else if (compress && raw.size() > 64 && bytes_deflate(raw.data(), raw.size(), out) && out.size() < raw.size()) {
+		e.codec = MC_DEFLATE;
+	}
+	else {
+		out = raw;
+		e.codec = MC_RAW;
+	}
+	e.size = (uint32_t)out.size();
+}
+// Указатель на распакованные данные: для MC_RAW прямо в отображенный файл
+const unsigned char* payload_unpack(const unsigned char* src, const SmapEntry& e, std::vector<unsigned char>& tmp) {
+	if (e.codec == MC_RAW) return e.size == e.raw ? src : nullptr;
+	tmp.resize(e.raw);
+	if (e.codec == MC_DEFLATE && bytes_inflate(src, e.size, tmp.data(), e.raw)) return tmp.data();
+	if (e.codec == MC_HEIGHT && hf_decode(src, e.size, tmp.data(), e.raw)) return tmp.data();
+	return nullptr;
+}
+
+// Замер кодека высот на текущей карте: степень сжатия против deflate и скорость в ГБ/с
+struct HfBench {
+	double ratio = 0.0, ratio_deflate = 0.0;
+	double enc_gbs = 0.0, dec_gbs = 0.0;
+	float max_err = 0.0f;
+	bool done = false;
+};
+HfBench hf_bench_last;
+void hf_bench() {
+	int nc = chunks_w() * chunks_h();
+	TidPalette pal;
+	std::vector<std::vector<unsigned char>> raw(nc), enc(nc), def(nc), dec(nc);
+	for (int c = 0; c < nc; c++) layer_encode(c, ML_HEIGHT, pal, raw[c]);
+	auto now = [] { return std::chrono::steady_clock::now(); };
+	auto t0 = now();
+	par_for(nc, [&](int a, int b) {
+		for (int c = a; c < b; c++) {
+			DirtyRect d = chunk_rect(c);
+			hf_encode(raw[c].data(), raw[c].size(), d.x1 - d.x0, d.z1 - d.z0, hcodec.step, enc[c]);
+		}
+	}, 1);
+	auto t1 = now();
+	par_for(nc, [&](int a, int b) {
+		for (int c = a; c < b; c++) {
+			dec[c].resize(raw[c].size());
+			hf_decode(enc[c].data(), enc[c].size(), dec[c].data(), dec[c].size());
+		}
+	}, 1);
+	auto t2 = now();
+	par_for(nc, [&](int a, int b) { for (int c = a; c < b; c++) bytes_deflate(raw[c].data(), raw[c].size(), def[c]); }, 1);
+	size_t rb = 0, eb = 0, db = 0;
+	float me = 0.0f;
+	for (int c = 0; c < nc; c++) {
+		rb += raw[c].size(); eb += enc[c].size(); db += def[c].size();
+		size_t n = raw[c].size() / 4;
+		std::vector<float> a(n), b(n);
+		const unsigned char* pa = raw[c].data();
+		const unsigned char* pb = dec[c].data();
+		get_planes(pa, (unsigned char*)a.data(), n);
+		get_planes(pb, (unsigned char*)b.data(), n);
+		for (size_t i = 0; i < n; i++) if (std::isfinite(a[i])) me = std::max(me, std::fabs(a[i] - b[i]));
+	}
+	HfBench& r = hf_bench_last;
+	r.ratio = eb ? (double)rb / eb : 0.0;
+	r.ratio_deflate = db ? (double)rb / db : 0.0;
+	r.enc_gbs = rb / std::max(1e-9, std::chrono::duration<double>(t1 - t0).count()) / 1e9;
+	r.dec_gbs = rb / std::max(1e-9, std::chrono::duration<double>(t2 - t1).count()) / 1e9;
+	r.max_err = me;
+	r.done = true;
+	TraceLog(LOG_INFO, "HF codec: %.1f MB, ratio %.2f (deflate %.2f), encode %.2f GB/s, decode %.2f GB/s, max err %g",
+		rb / (1024.0 * 1024.0), r.ratio, r.ratio_deflate, r.enc_gbs, r.dec_gbs, me);
+}
+
+// dir - текущий каталог целиком. Без дельт он и записан в dir_off - считаем его хеш; с дельтами хеш полного остается прежним
+void smap_seal(SmapHeader& hd, const std::vector<SmapEntry>& dir) {
+	if (!hd.delta_off) {
+		hd.dir_hash = hash64(dir.data(), dir.size() * sizeof(SmapEntry));
+		hd.delta_bytes = 0;
+		hd.delta_count = 0;
+	}
+	hd.live = sizeof(SmapHeader) + hd.meta_size + dir.size() * sizeof(SmapEntry) + hd.delta_bytes;
+	for (const SmapEntry& e : dir) hd.live += e.size;
+}
+// Запись .smap: raw_of(c, layer, out) отдает несжатые данные. Во временный файл и rename - на диске всегда целая карта
+template <class F> bool smap_write(const std::string& path, int w, int h, const json& meta, F&& raw_of, bool compress, bool parallel,
+	SmapHeader* hd_out = nullptr, std::vector<SmapEntry>* dir_out = nullptr, float hstep = 0.0f) {
+	std::string tmp_path = path + ".tmp";
+	std::ofstream f(tmp_path, std::ios::binary | std::ios::trunc);
+	if (!f) return false;
+	int cwn = (w + CHUNK - 1) / CHUNK;
+	int nc = cwn * ((h + CHUNK - 1) / CHUNK);
+	SmapHeader hd = {};
+	memcpy(hd.magic, "SMAP", 4);
+	hd.version = SMAP_VERSION;
+	hd.map_w = w; hd.map_h = h;
+	hd.chunk = CHUNK;
+	hd.layers = ML_COUNT;
+	f.write((const char*)&hd, sizeof(hd));
+	std::string ms = meta.dump();
+	hd.meta_off = sizeof(hd);
+	hd.meta_size = ms.size();
+	f.write(ms.data(), ms.size());
+	std::vector<SmapEntry> dir((size_t)nc * ML_COUNT);
+	uint64_t off = hd.meta_off + hd.meta_size;
+	// пачками, чтобы в памяти не лежала вся сжатая карта
+	const int BATCH = 256;
+	std::vector<std::vector<unsigned char>> out;
+	for (int c0 = 0; c0 < nc; c0 += BATCH) {
+		int cn = std::min(BATCH, nc - c0);
+		out.assign((size_t)cn * ML_COUNT, {});
+		auto enc = [&](int a, int b) {
+			std::vector<unsigned char> raw;
+			for (int k = a; k < b; k++)
+				for (int l = 0; l < ML_COUNT; l++) {
+					int c = c0 + k, cx = c % cwn, cz = c / cwn;
+					raw_of(c, l, raw);
+					payload_pack(raw, compress, dir[(size_t)c * ML_COUNT + l], out[(size_t)k * ML_COUNT + l], l,
+						std::min(CHUNK, w - cx * CHUNK), std::min(CHUNK, h - cz * CHUNK), hstep);
+				}
+		};
+		if (parallel) par_for(cn, enc, 1);
+		else enc(0, cn);
+		for (int k = 0; k < cn * ML_COUNT; k++) {
+			dir[(size_t)c0 * ML_COUNT + k].off = off;
+			f.write((const char*)out[k].data(), out[k].size());
+			off += out[k].size();
+		}
+	}
+	hd.dir_off = off;
+	smap_seal(hd, dir);
+	f.write((const char*)dir.data(), dir.size() * sizeof(SmapEntry));
+	f.seekp(0);
+	f.write((const char*)&hd, sizeof(hd));
+	f.close();
+	if (!f || !file_sync(tmp_path)) return false;
+	std::error_code ec;
+	std::filesystem::rename(tmp_path, path, ec);
+	if (ec) return false;
+	if (hd_out) *hd_out = hd;
+	if (dir_out) dir_out->swap(dir);
+	return true;
+}
+#ifndef SMAP_TOOL
+// Полная перезапись; после нее файл становится базой для журнала. С квантованием высот (hstep > 0) это экспорт:
+// файл расходится с картой в памяти, поэтому базой не становится
+bool map_save_full(const std::string& path, bool compress = true, float hstep = 0.0f) {
+	TidPalette pal = tid_palette_build();
+	std::vector<std::vector<int>> ob = objs_by_chunk(OBJS, MAP_W, MAP_H);
+	json meta = { {"pal", pal.names}, {"r", r}, {"next_obj_id", next_obj_id}, {"texs", texs_to_json()} };
+	SmapHeader hd;
+	std::vector<SmapEntry> dir;
+	bool ok = smap_write(path, MAP_W, MAP_H, meta, [&](int c, int l, std::vector<unsigned char>& o) {
+		if (l == ML_OBJS) objs_encode(OBJS, ob[c], o);
+		else layer_encode(c, l, pal, o);
+	}, compress, true, &hd, &dir, hstep);
+	if (!ok || hstep > 0.0f) return ok;
+	undo_fit();
+	sj.path = path;
+	sj.hd = hd;
+	sj.dir = std::move(dir);
+	sj.pal = std::move(pal);
+	sj.ver = undo.ver;
+	sj.epoch = map_epoch;
+	return true;
+}
+#endif
+// Проверка заголовка и каталога отображенного файла
+// Каталог собирается в dir: полный из dir_off, поверх - дельты от первой к последней
+bool smap_directory(const MappedFile& mf, SmapHeader& hd, std::vector<SmapEntry>& dir) {
+	if (mf.size < sizeof(SmapHeader)) return false;
+	memcpy(&hd, mf.data, sizeof(hd));
+	if (memcmp(hd.magic, "SMAP", 4) != 0 || hd.version > SMAP_VERSION || hd.chunk != CHUNK || hd.layers != ML_COUNT) return false;
+	if (hd.version < 2) hd.dir_hash = hd.live = 0; // v1: заголовок короче, дальше уже meta
+	if (hd.version < 3) hd.delta_off = hd.delta_bytes = hd.delta_count = hd.pad = 0;
+	if (hd.map_w <= 0 || hd.map_h <= 0 || hd.map_w > MAX_MAP_SIDE || hd.map_h > MAX_MAP_SIDE || hd.meta_off + hd.meta_size > mf.size) return false;
+	size_t n = (size_t)((hd.map_w + CHUNK - 1) / CHUNK) * ((hd.map_h + CHUNK - 1) / CHUNK) * ML_COUNT;
+	if (hd.dir_off + n * sizeof(SmapEntry) > mf.size) return false;
+	if (hd.version >= 2 && hash64(mf.data + hd.dir_off, n * sizeof(SmapEntry)) != hd.dir_hash) return false;
+	std::vector<uint64_t> chain;
+	for (uint64_t o = hd.delta_off; o; ) {
+		SmapDeltaHead dh;
+		if (chain.size() >= hd.delta_count || o + sizeof(dh) > mf.size) return false;
+		memcpy(&dh, mf.data + o, sizeof(dh));
+		if (o + sizeof(dh) + (uint64_t)dh.count * sizeof(SmapDeltaEntry) > mf.size) return false;
+		if (hash64(mf.data + o + sizeof(dh), (size_t)dh.count * sizeof(SmapDeltaEntry)) != dh.hash) return false;
+		chain.push_back(o);
+		o = dh.prev;
+	}
+	if (chain.size() != hd.delta_count) return false;
+	dir.resize(n);
+	memcpy(dir.data(), mf.data + hd.dir_off, n * sizeof(SmapEntry));
+	for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+		SmapDeltaHead dh;
+		memcpy(&dh, mf.data + *it, sizeof(dh));
+		for (uint32_t i = 0; i < dh.count; i++) {
+			SmapDeltaEntry de;
+			memcpy(&de, mf.data + *it + sizeof(dh) + (size_t)i * sizeof(de), sizeof(de));
+			if (de.idx >= n) return false;
+			dir[de.idx] = de.e;
+		}
+	}
+	// raw из каталога уходит в resize при распаковке: больше, чем бывает у слоя, - файл битый
+	for (size_t i = 0; i < n; i++) {
+		const SmapEntry& e = dir[i];
+		if (e.off > mf.size || e.size > mf.size - e.off) return false;
+		uint64_t cap;
+		switch ((int)(i % ML_COUNT)) {
+		case ML_TEX: cap = (uint64_t)CHUNK * CHUNK * 2; break;
+		// размер не ограничен форматом - только пределом сжатия deflate (~1032 раза)
+		case ML_PROPS: case ML_OBJS: cap = (uint64_t)e.size * 1032 + 64; break;
+		default: cap = (uint64_t)CHUNK * CHUNK * 4; break;
+		}
+		if (e.raw > cap) return false;
+	}
+	return true;
+}
+// Журнал: новые данные, meta и дельта каталога дописываются в конец, заголовок - последним.
+// Пока он не переписан, файл целиком читается по старому каталогу. Полный каталог пишется заново, когда
+// цепочка дельт длинная или весит больше четверти каталога
+bool smap_append(const std::string& path, SmapHeader& hd, std::vector<SmapEntry>& dir, const std::string& ms,
+	const std::vector<size_t>& idx, std::vector<SmapEntry>& ent, const std::vector<std::vector<unsigned char>>& out) {
+	std::fstream f(path, std::ios::binary | std::ios::in | std::ios::out);
+	if (!f) return false;
+	f.seekp(0, std::ios::end);
+	uint64_t off = (uint64_t)f.tellp();
+	std::vector<SmapEntry> nd = dir;
+	for (size_t i = 0; i < idx.size(); i++) {
+		ent[i].off = off;
+		f.write((const char*)out[i].data(), out[i].size());
+		off += out[i].size();
+		nd[idx[i]] = ent[i];
+	}
+	SmapHeader nh = hd;
+	nh.meta_off = off;
+	nh.meta_size = ms.size();
+	f.write(ms.data(), ms.size());
+	off += ms.size();
+	uint64_t rec = sizeof(SmapDeltaHead) + idx.size() * sizeof(SmapDeltaEntry);
+	if (hd.version < 3 || hd.delta_count >= SMAP_DELTA_MAX || (hd.delta_bytes + rec) * 4 > nd.size() * sizeof(SmapEntry)) {
+		nh.dir_off = off;
+		nh.delta_off = 0;
+		f.write((const char*)nd.data(), nd.size() * sizeof(SmapEntry));
+	}
+	else {
+		std::vector<SmapDeltaEntry> de(idx.size());
+		for (size_t i = 0; i < idx.size(); i++) de[i] = { (uint32_t)idx[i], ent[i] };
+		SmapDeltaHead dh = { hd.delta_off, (uint32_t)de.size(), 0, hash64(de.data(), de.size() * sizeof(SmapDeltaEntry)) };
+		f.write((const char*)&dh, sizeof(dh));
+		f.write((const char*)de.data(), de.size() * sizeof(SmapDeltaEntry));
+		nh.delta_off = off;
+		nh.delta_bytes += rec;
+		nh.delta_count++;
+	}
+	nh.version = SMAP_VERSION;
+	smap_seal(nh, nd);
+	// заголовок - только после того, как все, на что он ссылается, уже на диске; иначе после сбоя питания
+	// новый заголовок может указывать на недописанный хвост
+	f.flush();
+	if (!f || !file_sync(path)) return false;
+	f.seekp(0);
+	f.write((const char*)&nh, sizeof(nh));
+	f.close();
+	if (!f || !file_sync(path)) return false;
+	hd = nh;
+	dir.swap(nd);
+	return true;
+}
+bool smap_needs_compact(const std::string& path, const SmapHeader& hd) {
+	std::error_code ec;
+	uint64_t end = std::filesystem::file_size(path, ec);
+	return !ec && hd.live && end > (uint64_t)(hd.live * SMAP_COMPACT_RATIO) && end - hd.live > ((uint64_t)1 << 20);
+}
+// Сжатые данные копируются как есть, в порядке чанков; файл не должен быть отображен у вызывающего
+bool smap_compact(const std::string& path, SmapHeader& hd, std::vector<SmapEntry>& dir) {
+	std::string tmp_path = path + ".tmp";
+	SmapHeader nh = hd;
+	std::vector<SmapEntry> nd = dir;
+	{
+		MappedFile mf;
+		if (!mf.open(path)) return false;
+		std::ofstream f(tmp_path, std::ios::binary | std::ios::trunc);
+		if (!f || hd.meta_off + hd.meta_size > mf.size) return false;
+		f.write((const char*)&nh, sizeof(nh));
+		nh.meta_off = sizeof(nh);
+		f.write((const char*)mf.data + hd.meta_off, hd.meta_size);
+		uint64_t off = nh.meta_off + nh.meta_size;
+		std::vector<unsigned char> tmp, raw, packed;
+		std::vector<OBJ> objs;
+		for (size_t i = 0; i < nd.size(); i++) {
+			SmapEntry& e = nd[i];
+			if (e.off + e.size > mf.size) return false;
+			// слои объектов старой версии переводятся в текущую
+			if (hd.version < SMAP_VERSION && i % ML_COUNT == ML_OBJS && e.size) {
+				const unsigned char* p = payload_unpack(mf.data + e.off, e, tmp);
+				objs.clear();
+				if (!p || !objs_decode(p, e.raw, objs, hd.version)) return false;
+				std::vector<int> idx(objs.size());
+				std::iota(idx.begin(), idx.end(), 0);
+				objs_encode(objs, idx, raw);
+				payload_pack(raw, true, e, packed, ML_OBJS);
+				f.write((const char*)packed.data(), packed.size());
+			}
+			else f.write((const char*)mf.data + e.off, e.size);
+			e.off = off;
+			off += e.size;
+		}
+		nh.dir_off = off;
+		nh.delta_off = 0;
+		nh.version = SMAP_VERSION;
+		smap_seal(nh, nd);
+		f.write((const char*)nd.data(), nd.size() * sizeof(SmapEntry));
+		f.seekp(0);
+		f.write((const char*)&nh, sizeof(nh));
+		f.close();
+		if (!f || !file_sync(tmp_path)) return false;
+	}
+	std::error_code ec;
+	std::filesystem::rename(tmp_path, path, ec);
+	if (ec) return false;
+	TraceLog(LOG_INFO, "SMAP: compacted %s to %.1f MB", path.c_str(), nh.live / (1024.0 * 1024.0));
+	hd = nh;
+	dir.swap(nd);
+	return true;
+}
+
+#ifndef SMAP_TOOL
+// После замены tiles/OBJS целиком: индексы, история, выделение
+void map_loaded() {
+	map_epoch++;
+	for (const OBJ& o : OBJS) next_obj_id = std::max(next_obj_id, o.id + 1);
+	oix_rebuild();
+	objr_reset();
+	undo_reset();
+	sel_clear();
+	st = nullptr;
+	so_idx = -1;
+	map_changed(0, 0, MAP_W, MAP_H);
+}
+bool map_load_bin(const std::string& path) {
+	MappedFile mf;
+	if (!mf.open(path)) return false;
+	SmapHeader hd;
+	std::vector<SmapEntry> dir;
+	if (!smap_directory(mf, hd, dir)) return false;
+	json meta = json::parse(mf.data + hd.meta_off, mf.data + hd.meta_off + hd.meta_size, nullptr, false);
+	if (meta.is_discarded()) return false;
+	std::vector<std::string> pal = meta.value("pal", std::vector<std::string>());
+	// раскладываем в свои тайлы; открытая карта заменяется, только если все чанки целы
+	const int mw = hd.map_w, mh = hd.map_h;
+	if ((size_t)mw * mh > MAX_LOAD_TILES) {
+		TraceLog(LOG_WARNING, "SMAP: %s is %dx%d, too large to load whole", path.c_str(), mw, mh);
+		return false;
+	}
+	std::vector<Tile> nt((size_t)mw * mh);
+	int nc = ((mw + CHUNK - 1) / CHUNK) * ((mh + CHUNK - 1) / CHUNK);
+	std::vector<std::vector<OBJ>> objs(nc);
+	std::atomic<bool> ok = true;
+	// чанки независимы - распаковываем и раскладываем по тайлам во всех потоках
+	par_for(nc, [&](int a, int b) {
+		std::vector<unsigned char> tmp;
+		for (int c = a; c < b && ok; c++) {
+			for (int l = 0; l < ML_COUNT; l++) {
+				SmapEntry e;
+				memcpy(&e, &dir[(size_t)c * ML_COUNT + l], sizeof(e));
+				if (e.size == 0) continue;
+				if (e.off + e.size > mf.size) { ok = false; break; }
+				const unsigned char* p = payload_unpack(mf.data + e.off, e, tmp);
+				if (!p || !layer_decode(c, l, p, e.raw, pal, objs[c], nt, mw, mh, hd.version)) { ok = false; break; }
+			}
+		}
+	}, 4);
+	if (!ok) {
+		TraceLog(LOG_WARNING, "SMAP: %s has damaged chunks, map not loaded", path.c_str());
+		return false;
+	}
+	MAP_W = mw;
+	MAP_H = mh;
+	tiles.swap(nt);
+	nt = std::vector<Tile>();
+	OBJS.clear();
+	for (auto& v : objs) for (OBJ& o : v) OBJS.push_back(std::move(o));
+	if (meta.contains("r")) r = meta["r"];
+	// автосохранение пака не пишет, ссылается на последний сохраненный
+	if (!pack_open(pack_path(path)) && meta.contains("pack")) pack_open(meta["pack"].get<std::string>());
+	texs_from_json(meta.value("texs", json::object()));
+	next_obj_id = meta.value("next_obj_id", 1);
+	map_loaded();
+	sj = SmapJournal();
+	undo_fit();
+	sj.path = path;
+	sj.hd = hd;
+	sj.dir = std::move(dir);
+	for (const std::string& t : pal) {
+		sj.pal.idx.emplace(t, (uint16_t)sj.pal.names.size());
+		sj.pal.names.push_back(t);
+	}
+	sj.ver = undo.ver;
+	// файл старой версии переписывается целиком при следующем сохранении
+	sj.epoch = hd.version < SMAP_VERSION ? -1 : map_epoch;
+	return true;
+}
+// Сохранение в тот же файл: дописываются только слои, изменившиеся с прошлой записи/чтения
+bool map_save_bin(const std::string& path, bool compress = true) {
+	undo_fit();
+	bool ok;
+	if (sj.epoch != map_epoch || sj.path != path || sj.hd.map_w != MAP_W || sj.hd.map_h != MAP_H || sj.ver.size() != undo.ver.size() || !std::filesystem::exists(path))
+		ok = map_save_full(path, compress);
+	else {
+		auto t0 = std::chrono::steady_clock::now();
+		int nc = chunks_w() * chunks_h();
+		std::vector<std::vector<int>> ob = objs_by_chunk(OBJS, MAP_W, MAP_H);
+		std::vector<int> cand;
+		std::vector<char> tdirty(nc, 0);
+		for (int c = 0; c < nc; c++) {
+			tdirty[c] = undo.ver[c] != sj.ver[c];
+			if (tdirty[c]) {
+				// новые tid - в палитру файла заранее, чтобы кодировать параллельно
+				DirtyRect d = chunk_rect(c);
+				for (int z = d.z0; z < d.z1; z++)
+					for (int x = d.x0; x < d.x1; x++) sj.pal.get(tiles[(size_t)z * MAP_W + x].tid);
+			}
+			// объекты не трогают undo.ver - сверяем их по хешу
+			if (tdirty[c] || !ob[c].empty() || sj.dir[(size_t)c * ML_COUNT + ML_OBJS].size) cand.push_back(c);
+		}
+		std::vector<std::vector<std::vector<unsigned char>>> out(cand.size());
+		std::vector<std::vector<SmapEntry>> ent(cand.size());
+		std::vector<std::vector<size_t>> idx(cand.size());
+		par_for((int)cand.size(), [&](int a, int b) {
+			std::vector<unsigned char> raw;
+			for (int k = a; k < b; k++) {
+				int c = cand[k];
+				for (int l = 0; l < ML_COUNT; l++) {
+					if (l == ML_OBJS) objs_encode(OBJS, ob[c], raw);
+					else if (tdirty[c]) layer_encode(c, l, sj.pal, raw);
+					else continue;
+					const SmapEntry& e = sj.dir[(size_t)c * ML_COUNT + l];
+					if (l == ML_OBJS && e.size == 0 && ob[c].empty()) continue;
+					if (e.raw == raw.size() && e.hash == hash64(raw.data(), raw.size())) continue;
+					idx[k].push_back((size_t)c * ML_COUNT + l);
+					ent[k].emplace_back();
+					out[k].emplace_back();
+					DirtyRect d = chunk_rect(c);
+					payload_pack(raw, compress, ent[k].back(), out[k].back(), l, d.x1 - d.x0, d.z1 - d.z0);
+				}
+			}
+		}, 4);
+		std::vector<size_t> fi;
+		std::vector<SmapEntry> fe;
+		std::vector<std::vector<unsigned char>> fo;
+		size_t bytes = 0;
+		for (size_t k = 0; k < cand.size(); k++)
+			for (size_t i = 0; i < idx[k].size(); i++) {
+				fi.push_back(idx[k][i]);
+				fe.push_back(ent[k][i]);
+				bytes += out[k][i].size();
+				fo.push_back(std::move(out[k][i]));
+			}
+		json meta = { {"pal", sj.pal.names}, {"r", r}, {"next_obj_id", next_obj_id}, {"texs", texs_to_json()} };
+		ok = smap_append(path, sj.hd, sj.dir, meta.dump(), fi, fe, fo);
+		if (ok) {
+			sj.ver = undo.ver;
+			TraceLog(LOG_INFO, "SMAP: appended %d layers (%.1f KB) in %.3f s", (int)fi.size(), bytes / 1024.0,
+				std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+			if (smap_needs_compact(path, sj.hd)) smap_compact(path, sj.hd, sj.dir);
+		}
+	}
+	if (ok && !texs_for_list.empty()) return pack_save(pack_path(path));
+	return ok;
+}
+#endif
+
+// ===== Сравнение и трёхстороннее слияние .smap (консоль, без окна) =====
+// SmapCr diff a.smap b.smap
+// SmapCr merge base.smap ours.smap theirs.smap out.smap
+// Слои чанков сравниваются по хешу из каталога, распаковываются только различающиеся
+const char* ML_NAMES[ML_COUNT] = { "height", "tex", "biome", "props", "objs", "id" };
+
+// Отображенный .smap только для чтения
+struct SmapView {
+	MappedFile mf;
+	SmapHeader hd = {};
+	std::vector<SmapEntry> dir;
+	json meta;
+	std::vector<std::string> pal;
+	bool open(const std::string& path) {
+		if (!mf.open(path) || !smap_directory(mf, hd, dir)) return false;
+		meta = json::parse(mf.data + hd.meta_off, mf.data + hd.meta_off + hd.meta_size, nullptr, false);
+		if (meta.is_discarded()) return false;
+		pal = meta.value("pal", std::vector<std::string>());
+		return true;
+	}
+	SmapEntry entry(int c, int l) const {
+		SmapEntry e;
+		memcpy(&e, &dir[(size_t)c * ML_COUNT + l], sizeof(e));
+		return e;
+	}
+	// Распакованный слой, len = 0 - слоя нет
+	const unsigned char* layer(int c, int l, std::vector<unsigned char>& tmp, size_t& len) const {
+		SmapEntry e = entry(c, l);
+		len = e.raw;
+		if (e.size == 0) {
+			len = 0;
+			return (const unsigned char*)"";
+		}
+		if (e.off + e.size > mf.size) return nullptr;
+		return payload_unpack(mf.data + e.off, e, tmp);
+	}
+};
+// Слой чанка по тайлам: число, индекс tid в общей палитре или хеш json свойств (0 - нет свойств)
+struct SmapCells {
+	std::vector<uint64_t> v;
+	std::vector<std::string_view> props; // только ML_PROPS, указывают в buf или в файл
+	std::vector<unsigned char> buf;
+};
+bool smap_cells(const SmapView& s, const std::vector<uint32_t>& remap, int c, int l, SmapCells& out) {
+	DirtyRect r = chunk_rect(c);
+	size_t n = (size_t)(r.x1 - r.x0) * (r.z1 - r.z0), len;
+	const unsigned char* p = s.layer(c, l, out.buf, len);
+	if (!p) return false;
+	out.v.assign(n, 0);
+	if (l == ML_PROPS) out.props.assign(n, {});
+	if (len == 0) return true;
+	if (l == ML_PROPS) {
+		const unsigned char* end = p + len;
+		if (len < 4) return false;
+		uint32_t k = get_raw<uint32_t>(p);
+		for (uint32_t i = 0; i < k; i++) {
+			if (end - p < 6) return false;
+			uint16_t ix = get_raw<uint16_t>(p);
+			uint32_t jl = get_raw<uint32_t>(p);
+			if ((size_t)(end - p) < jl || ix >= n) return false;
+			out.props[ix] = std::string_view((const char*)p, jl);
+			out.v[ix] = hash64(p, jl) | 1;
+			p += jl;
+		}
+		return true;
+	}
+	if (l == ML_TEX) {
+		if (len != n * 2) return false;
+		for (size_t i = 0; i < n; i++) {
+			uint16_t k;
+			memcpy(&k, p + i * 2, 2);
+			out.v[i] = k < remap.size() ? remap[k] : UINT32_MAX;
+		}
+		return true;
+	}
+	if (len != n * 4) return false;
+	std::vector<uint32_t> v(n);
+	get_planes(p, (unsigned char*)v.data(), n);
+	for (size_t i = 0; i < n; i++) out.v[i] = v[i];
+	return true;
+}
+// Обратно в байты слоя; tid - через u2o из общей палитры в палитру файла
+void smap_cells_encode(int l, const std::vector<uint64_t>& v, const std::vector<std::string_view>& props, const std::vector<uint16_t>& u2o, std::vector<unsigned char>& o) {
+	size_t n = v.size();
+	o.clear();
+	if (l == ML_PROPS) {
+		put_raw<uint32_t>(o, 0);
+		uint32_t k = 0;
+		for (size_t i = 0; i < n; i++) {
+			if (!v[i]) continue;
+			put_raw<uint16_t>(o, (uint16_t)i);
+			put_raw<uint32_t>(o, (uint32_t)props[i].size());
+			o.insert(o.end(), props[i].begin(), props[i].end());
+			k++;
+		}
+		memcpy(o.data(), &k, 4);
+		return;
+	}
+	if (l == ML_TEX) {
+		o.resize(n * 2);
+		for (size_t i = 0; i < n; i++) {
+			uint16_t k = v[i] < u2o.size() ? u2o[v[i]] : 0;
+			memcpy(&o[i * 2], &k, 2);
+		}
+		return;
+	}
+	std::vector<uint32_t> u(n);
+	for (size_t i = 0; i < n; i++) u[i] = (uint32_t)v[i];
+	put_planes(o, (const unsigned char*)u.data(), n);
+}
+// Набор карт с общей палитрой tid
+struct SmapSet {
+	std::vector<std::unique_ptr<SmapView>> maps;
+	TidPalette upal;
+	std::vector<std::vector<uint32_t>> remap;
+	bool open(const std::vector<std::string>& paths) {
+		for (const std::string& p : paths) {
+			maps.push_back(std::make_unique<SmapView>());
+			if (!maps.back()->open(p)) {
+				fprintf(stderr, "%s: not a readable .smap\n", p.c_str());
+				return false;
+			}
+			if (maps.back()->hd.map_w != maps[0]->hd.map_w || maps.back()->hd.map_h != maps[0]->hd.map_h) {
+				fprintf(stderr, "%s: map size %dx%d differs from %dx%d\n", p.c_str(), maps.back()->hd.map_w, maps.back()->hd.map_h, maps[0]->hd.map_w, maps[0]->hd.map_h);
+				return false;
+			}
+		}
+		for (auto& m : maps) {
+			remap.emplace_back();
+			for (const std::string& t : m->pal) remap.back().push_back(upal.get(t));
+		}
+		// chunk_rect и прочие считают от глобального размера карты
+		MAP_W = maps[0]->hd.map_w;
+		MAP_H = maps[0]->hd.map_h;
+		return true;
+	}
+	// Быстро по каталогу; tid при разных палитрах и несовпавший хеш - по тайлам не сравниваем, это делает вызывающий
+	bool same(int a, int b, int c, int l) const {
+		SmapEntry ea = maps[a]->entry(c, l), eb = maps[b]->entry(c, l);
+		if (ea.raw != eb.raw || ea.hash != eb.hash) return false;
+		return l != ML_TEX || maps[a]->pal == maps[b]->pal || cells_same(a, b, c, l);
+	}
+	bool cells_same(int a, int b, int c, int l) const {
+		SmapCells ca, cb;
+		return smap_cells(*maps[a], remap[a], c, l, ca) && smap_cells(*maps[b], remap[b], c, l, cb) && ca.v == cb.v;
+	}
+	bool objs(int m, int c, std::vector<OBJ>& out) const {
+		std::vector<unsigned char> tmp;
+		size_t len;
+		const unsigned char* p = maps[m]->layer(c, ML_OBJS, tmp, len);
+		if (!p) return false;
+		size_t first = out.size();
+		return objs_decode(p, len, out, maps[m]->hd.version);
+	}
+};
+// Объект в байтах - для сравнения версий
+std::string smap_obj_key(const OBJ& o) {
+	std::vector<unsigned char> b;
+	obj_write(b, o);
+	return std::string(b.begin(), b.end());
+}
+struct SmapRegion {
+	int c = 0, layer = 0, tiles = 0;
+	DirtyRect bb;
+	void add(int x, int z) {
+		if (tiles++ == 0) bb = { x, z, x + 1, z + 1 };
+		else bb = { std::min(bb.x0, x), std::min(bb.z0, z), std::max(bb.x1, x + 1), std::max(bb.z1, z + 1) };
+	}
+};
+
+int smap_diff_tool(const std::string& pa, const std::string& pb) {
+	auto t0 = std::chrono::steady_clock::now();
+	SmapSet ss;
+	if (!ss.open({ pa, pb })) return 2;
+	int nc = chunks_w() * chunks_h();
+	std::vector<std::vector<SmapRegion>> reg(nc);
+	std::vector<char> objs_diff(nc, 0);
+	std::atomic<bool> ok = true;
+	std::atomic<int> skipped = 0;
+	par_for(nc, [&](int a, int b) {
+		SmapCells ca, cb;
+		for (int c = a; c < b; c++) {
+			DirtyRect r = chunk_rect(c);
+			int w = r.x1 - r.x0;
+			for (int l = 0; l < ML_COUNT; l++) {
+				if (ss.same(0, 1, c, l)) { skipped++; continue; }
+				if (l == ML_OBJS) { objs_diff[c] = 1; continue; }
+				if (!smap_cells(*ss.maps[0], ss.remap[0], c, l, ca) || !smap_cells(*ss.maps[1], ss.remap[1], c, l, cb)) { ok = false; continue; }
+				SmapRegion g;
+				g.c = c;
+				g.layer = l;
+				for (size_t i = 0; i < ca.v.size(); i++)
+					if (ca.v[i] != cb.v[i]) g.add(r.x0 + (int)i % w, r.z0 + (int)i / w);
+				if (g.tiles) reg[c].push_back(g);
+			}
+		}
+	}, 4);
+	if (!ok) {
+		fprintf(stderr, "damaged chunks, diff is incomplete\n");
+		return 2;
+	}
+	int regions = 0;
+	for (int c = 0; c < nc; c++)
+		for (const SmapRegion& g : reg[c]) {
+			printf("chunk %d,%d %-6s %5d tiles in [%d,%d]-[%d,%d)\n", c % chunks_w(), c / chunks_w(), ML_NAMES[g.layer], g.tiles, g.bb.x0, g.bb.z0, g.bb.x1, g.bb.z1);
+			regions++;
+		}
+	// объекты сравниваем по id, только из чанков с отличиями; переехавший объект меняет оба чанка
+	std::map<int, std::string> oa, ob;
+	for (int c = 0; c < nc; c++) {
+		if (!objs_diff[c]) continue;
+		std::vector<OBJ> va, vb;
+		if (!ss.objs(0, c, va) || !ss.objs(1, c, vb)) return 2;
+		for (const OBJ& o : va) oa[o.id] = smap_obj_key(o);
+		for (const OBJ& o : vb) ob[o.id] = smap_obj_key(o);
+	}
+	int added = 0, removed = 0, changed = 0;
+	for (auto& [id, k] : oa) {
+		auto it = ob.find(id);
+		if (it == ob.end()) { printf("obj %d removed\n", id); removed++; }
+		else if (it->second != k) { printf("obj %d changed\n", id); changed++; }
+	}
+	for (auto& [id, k] : ob)
+		if (!oa.count(id)) { printf("obj %d added\n", id); added++; }
+	printf("%d differing regions, objects +%d -%d ~%d, %d of %d layers skipped by hash, %.3f s\n", regions, added, removed, changed,
+		(int)skipped, nc * ML_COUNT, std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+	return regions || added || removed || changed ? 1 : 0;
+}
+
+// Поле r из meta: по ключам верхнего уровня, при конфликте - ours
+json smap_merge_json(const json& b, const json& o, const json& t) {
+	if (!o.is_object() || !t.is_object()) return o == b ? t : o;
+	json m = o;
+	for (auto it = t.begin(); it != t.end(); ++it) {
+		bool in_b = b.is_object() && b.contains(it.key());
+		if (!o.contains(it.key())) {
+			if (!in_b) m[it.key()] = it.value(); // добавлено в theirs
+			continue; // удалено в ours
+		}
+		if (in_b && o[it.key()] == b[it.key()]) m[it.key()] = it.value();
+	}
+	// удалено в theirs, не тронуто в ours
+	if (b.is_object())
+		for (auto it = b.begin(); it != b.end(); ++it)
+			if (!t.contains(it.key()) && o.contains(it.key()) && o[it.key()] == it.value()) m.erase(it.key());
+	return m;
+}
+// Конфликтующие тайлы и объекты берутся из ours и перечисляются в meta["merge_conflicts"]
+int smap_merge_tool(const std::string& pb, const std::string& po, const std::string& pt, const std::string& out) {
+	auto t0 = std::chrono::steady_clock::now();
+	SmapSet ss;
+	if (!ss.open({ pb, po, pt })) return 2;
+	const int B = 0, O = 1, T = 2;
+	const SmapView& mo = *ss.maps[O];
+	int nc = chunks_w() * chunks_h();
+	// палитра результата начинается с палитры ours - ее слои tid копируются как есть
+	TidPalette opal;
+	for (const std::string& t : mo.pal) opal.get(t);
+	for (const std::string& t : ss.maps[T]->pal) opal.get(t);
+	std::vector<uint16_t> u2o(ss.upal.names.size(), 0);
+	for (size_t i = 0; i < u2o.size(); i++) {
+		auto it = opal.idx.find(ss.upal.names[i]);
+		if (it != opal.idx.end()) u2o[i] = it->second;
+	}
+
+	// объекты: по id из чанков, где хоть одна сторона что-то меняла
+	std::vector<char> ochg(nc, 0);
+	std::map<int, std::array<const OBJ*, 3>> ver;
+	std::array<std::vector<OBJ>, 3> all;
+	// слои объектов ours старой версии не копируются как есть - перекодируются все
+	for (int c = 0; c < nc; c++) ochg[c] = mo.hd.version < SMAP_VERSION || !(ss.same(B, O, c, ML_OBJS) && ss.same(B, T, c, ML_OBJS));
+	for (int m = 0; m < 3; m++)
+		for (int c = 0; c < nc; c++)
+			if (ochg[c] && !ss.objs(m, c, all[m])) return 2;
+	// добавленные в theirs (id нет в base) получают новые id выше занятых обеими сторонами,
+	// иначе они совпали бы с независимыми добавлениями ours
+	const json& mb = ss.maps[B]->meta;
+	const json& mt = ss.maps[T]->meta;
+	int next_id = std::max({ mb.value("next_obj_id", 1), mo.meta.value("next_obj_id", 1), mt.value("next_obj_id", 1) });
+	std::unordered_set<int> base_ids;
+	for (const OBJ& o : all[B]) base_ids.insert(o.id);
+	for (int m = 0; m < 3; m++)
+		for (const OBJ& o : all[m]) next_id = std::max(next_id, o.id + 1);
+	int renumbered = 0;
+	for (OBJ& o : all[T])
+		if (!base_ids.count(o.id)) {
+			o.id = next_id++;
+			renumbered++;
+		}
+	for (int m = 0; m < 3; m++)
+		for (const OBJ& o : all[m]) ver[o.id][m] = &o;
+	std::vector<OBJ> merged;
+	std::vector<int> obj_conflicts;
+	for (auto& [id, v] : ver) {
+		std::string kb = v[B] ? smap_obj_key(*v[B]) : std::string(), ko = v[O] ? smap_obj_key(*v[O]) : std::string(), kt = v[T] ? smap_obj_key(*v[T]) : std::string();
+		const OBJ* pick = v[O];
+		if (ko == kb) pick = v[T];
+		else if (kt != kb && kt != ko) obj_conflicts.push_back(id);
+		if (pick) merged.push_back(*pick);
+	}
+	std::vector<std::vector<int>> mob = objs_by_chunk(merged, MAP_W, MAP_H);
+	// объект уехал в чанк, где никто ничего не менял: в таком чанке остаются объекты ours
+	for (int c = 0; c < nc; c++) {
+		if (ochg[c] || mob[c].empty()) continue;
+		std::vector<OBJ> keep;
+		if (!ss.objs(O, c, keep)) return 2;
+		for (OBJ& o : keep) {
+			mob[c].push_back((int)merged.size());
+			merged.push_back(std::move(o));
+		}
+		ochg[c] = 1;
+	}
+
+	// слой, измененный обеими сторонами по-разному, сливается по тайлам
+	auto merge_layer = [&](int c, int l, std::vector<unsigned char>& o, SmapRegion& note) {
+		SmapCells cb, co, ct;
+		if (!smap_cells(*ss.maps[B], ss.remap[B], c, l, cb) || !smap_cells(mo, ss.remap[O], c, l, co) || !smap_cells(*ss.maps[T], ss.remap[T], c, l, ct)) return false;
+		DirtyRect r = chunk_rect(c);
+		int w = r.x1 - r.x0;
+		std::vector<uint64_t> v = co.v;
+		std::vector<std::string_view> pr = co.props;
+		for (size_t i = 0; i < v.size(); i++) {
+			if (co.v[i] == cb.v[i]) {
+				v[i] = ct.v[i];
+				if (l == ML_PROPS) pr[i] = ct.props[i];
+			}
+			else if (ct.v[i] != cb.v[i] && ct.v[i] != co.v[i]) note.add(r.x0 + (int)i % w, r.z0 + (int)i / w);
+		}
+		smap_cells_encode(l, v, pr, u2o, o);
+		return true;
+	};
+	// 0 - слой ours, 1 - theirs, 2 - по тайлам
+	auto source = [&](int c, int l) {
+		if (l == ML_OBJS || ss.same(B, T, c, l)) return 0;
+		if (ss.same(B, O, c, l)) return 1;
+		return ss.same(O, T, c, l) ? 0 : 2;
+	};
+	// конфликты нужны в meta, а она пишется первой - сначала отдельный проход по слоям, измененным с обеих сторон;
+	// слитые слои остаются в merged_l до записи
+	std::vector<SmapRegion> notes((size_t)nc * ML_COUNT);
+	std::vector<std::vector<unsigned char>> merged_l((size_t)nc * ML_COUNT);
+	std::atomic<bool> ok = true;
+	par_for(nc, [&](int a, int b) {
+		for (int c = a; c < b; c++)
+			for (int l = 0; l < ML_COUNT; l++) {
+				if (source(c, l) != 2) continue;
+				SmapRegion& g = notes[(size_t)c * ML_COUNT + l];
+				g.c = c;
+				g.layer = l;
+				if (!merge_layer(c, l, merged_l[(size_t)c * ML_COUNT + l], g)) ok = false;
+			}
+	}, 4);
+	if (!ok) {
+		fprintf(stderr, "damaged chunks, nothing written\n");
+		return 2;
+	}
+	json conf = json::array();
+	for (const SmapRegion& g : notes)
+		if (g.tiles) {
+			conf.push_back({ {"layer", ML_NAMES[g.layer]}, {"x0", g.bb.x0}, {"z0", g.bb.z0}, {"x1", g.bb.x1}, {"z1", g.bb.z1}, {"tiles", g.tiles} });
+			printf("CONFLICT chunk %d,%d %-6s %5d tiles in [%d,%d]-[%d,%d), kept ours\n", g.c % chunks_w(), g.c / chunks_w(), ML_NAMES[g.layer], g.tiles, g.bb.x0, g.bb.z0, g.bb.x1, g.bb.z1);
+		}
+	for (int id : obj_conflicts) printf("CONFLICT obj %d, kept ours\n", id);
+
+	json texs = mo.meta.value("texs", json::object());
+	json tt = mt.value("texs", json::object());
+	if (texs.is_object() && tt.is_object())
+		for (auto it = tt.begin(); it != tt.end(); ++it)
+			if (!texs.contains(it.key())) texs[it.key()] = it.value();
+	json meta = { {"pal", opal.names}, {"r", smap_merge_json(mb.value("r", json()), mo.meta.value("r", json()), mt.value("r", json()))},
+		{"next_obj_id", next_id}, {"texs", texs} };
+	// текстуры остаются в паке ours
+	std::error_code ec;
+	if (mo.meta.contains("pack")) meta["pack"] = mo.meta["pack"];
+	else if (std::filesystem::exists(pack_path(po))) meta["pack"] = std::filesystem::absolute(pack_path(po), ec).string();
+	if (!conf.empty() || !obj_conflicts.empty()) meta["merge_conflicts"] = { {"tiles", conf}, {"objs", obj_conflicts} };
+
+	std::atomic<int> from_t = 0, mixed = 0;
+	bool wr = smap_write(out, MAP_W, MAP_H, meta, [&](int c, int l, std::vector<unsigned char>& o) {
+		if (l == ML_OBJS && ochg[c]) {
+			objs_encode(merged, mob[c], o);
+			return;
+		}
+		int src = source(c, l);
+		if (src == 2) {
+			mixed++;
+			o.swap(merged_l[(size_t)c * ML_COUNT + l]);
+			return;
+		}
+		if (src == 1) from_t++;
+		std::vector<unsigned char> tmp;
+		size_t len;
+		// tid theirs - через общую палитру, остальное и ours - байты слоя как есть
+		if (src == 1 && l == ML_TEX) {
+			SmapCells ct;
+			if (!smap_cells(*ss.maps[T], ss.remap[T], c, l, ct)) ok = false;
+			else smap_cells_encode(l, ct.v, ct.props, u2o, o);
+			return;
+		}
+		const unsigned char* p = ss.maps[src ? T : O]->layer(c, l, tmp, len);
+		if (p) o.assign(p, p + len);
+		else {
+			o.clear();
+			ok = false;
+		}
+	}, true, true);
+	if (!wr || !ok) {
+		fprintf(stderr, "%s: write failed\n", out.c_str());
+		return 2;
+	}
+	int nconf = (int)conf.size() + (int)obj_conflicts.size();
+	printf("%d layers from theirs, %d merged by tile, %d objects in changed chunks (%d new from theirs renumbered), %d conflicts, %.3f s\n", (int)from_t, (int)mixed, (int)merged.size(), renumbered, nconf,
+		std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+	return nconf ? 1 : 0;
+}
+void smap_tool_usage(const char* exe) {
+	printf("usage: %s diff a.smap b.smap\n       %s merge base.smap ours.smap theirs.smap out.smap\n", exe, exe);
+}
+// Консольные команды; -1 - команды нет (в редакторе дальше открывается окно)
+int smap_tool_main(int argc, char** argv) {
+	if (argc < 2) return -1;
+	std::string cmd = argv[1];
+	if (cmd == "diff" && argc == 4) return smap_diff_tool(argv[2], argv[3]);
+	if (cmd == "merge" && argc == 6) return smap_merge_tool(argv[2], argv[3], argv[4], argv[5]);
+	if (cmd != "diff" && cmd != "merge") return -1;
+	smap_tool_usage(argv[0]);
+	return 2;
+}
+
+#ifndef SMAP_TOOL
+// ===== JSON обмен: потоковая запись и SAX-чтение без DOM всей карты =====
+// { "w", "h", "tiles": [ {id, bid, tid, h, j} ... по строкам ], "objs": [ {id, tid, proch, x, y, z, pov, razm, anim, j} ... ], прочие ключи - из r }
+struct JsonIoStat {
+	size_t bytes = 0;
+	double sec = 0.0;
+	double mbps() const { return sec > 0.0 ? bytes / sec / (1024.0 * 1024.0) : 0.0; }
+};
+JsonIoStat json_io_last;
+
+struct JsonOut {
+	std::ofstream f;
+	std::string buf;
+	size_t total = 0;
+	bool first = true; // первый элемент в текущем объекте/массиве
+	void flush() {
+		f.write(buf.data(), buf.size());
+		total += buf.size();
+		buf.clear();
+	}
+	void raw(const char* s, size_t n) {
+		buf.append(s, n);
+		if (buf.size() >= (1 << 20)) flush();
+	}
+	void raw(const char* s) { raw(s, strlen(s)); }
+	void sep() {
+		if (!first) buf += ',';
+		first = false;
+	}
+	void str(const std::string& s) {
+		buf += '"';
+		for (unsigned char c : s) {
+			if (c == '"' || c == '\\') { buf += '\\'; buf += (char)c; }
+			else if (c < 0x20) {
+				char e[8];
+				snprintf(e, sizeof(e), "\\u%04x", c);
+				buf += e;
+			}
+			else buf += (char)c;
+		}
+		buf += '"';
+	}
+	void key(const char* k) {
+		sep();
+		buf += '"'; buf += k; buf += "\":";
+	}
+	void num(long long v) {
+		char t[24];
+		auto r = std::to_chars(t, t + sizeof(t), v);
+		buf.append(t, r.ptr - t);
+	}
+	void num(float v) {
+		if (!std::isfinite(v)) { buf += '0'; return; }
+		char t[32];
+		auto r = std::to_chars(t, t + sizeof(t), v);
+		buf.append(t, r.ptr - t);
+	}
+	void open(char c) { buf += c; first = true; }
+	void close(char c) { buf += c; first = false; }
+};
+bool map_save_json(const std::string& path) {
+	auto t0 = std::chrono::steady_clock::now();
+	JsonOut o;
+	std::string tmp_path = path + ".tmp";
+	o.f.open(tmp_path, std::ios::binary | std::ios::trunc);
+	if (!o.f) return false;
+	o.open('{');
+	o.key("w"); o.num((long long)MAP_W);
+	o.key("h"); o.num((long long)MAP_H);
+	if (r.is_object())
+		for (auto it = r.begin(); it != r.end(); ++it) {
+			if (it.key() == "w" || it.key() == "h" || it.key() == "tiles" || it.key() == "objs" || it.key() == "texs") continue;
+			o.sep();
+			o.str(it.key());
+			o.buf += ':';
+			o.buf += it.value().dump();
+		}
+	o.key("texs");
+	o.buf += texs_to_json().dump();
+	o.key("tiles"); o.open('[');
+	for (const Tile& t : tiles) {
+		o.sep(); o.open('{');
+		o.key("id"); o.num((long long)t.id);
+		o.key("bid"); o.num((long long)t.bid);
+		o.key("tid"); o.str(t.tid);
+		o.key("h"); o.num(t.h);
+		if (!t.j.is_null()) { o.key("j"); o.buf += t.j.dump(); }
+		o.close('}');
+		if (o.buf.size() >= (1 << 20)) o.flush();
+	}
+	o.close(']');
+	o.key("objs"); o.open('[');
+	for (const OBJ& ob : OBJS) {
+		o.sep(); o.open('{');
+		o.key("id"); o.num((long long)ob.id);
+		o.key("tid"); o.str(ob.tid);
+		o.key("proch"); o.num((long long)ob.proch);
+		o.key("x"); o.num(ob.vec3.x);
+		o.key("y"); o.num(ob.vec3.y);
+		o.key("z"); o.num(ob.vec3.z);
+		o.key("pov"); o.num(ob.pov);
+		o.key("razm"); o.num(ob.razm);
+		o.key("anim"); o.str(ob.anim);
+		if (!ob.j.is_null()) { o.key("j"); o.buf += ob.j.dump(); }
+		o.close('}');
+		if (o.buf.size() >= (1 << 20)) o.flush();
+	}
+	o.close(']');
+	o.close('}');
+	o.flush();
+	o.f.close();
+	if (!o.f) return false;
+	std::error_code ec;
+	std::filesystem::rename(tmp_path, path, ec);
+	json_io_last.bytes = o.total;
+	json_io_last.sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	TraceLog(LOG_INFO, "JSON: wrote %.1f MB in %.3f s (%.1f MB/s)", o.total / (1024.0 * 1024.0), json_io_last.sec, json_io_last.mbps());
+	if (!ec && !texs_for_list.empty()) return pack_save(pack_path(path));
+	return !ec;
+}
+
+// SAX: тайлы и объекты пишутся сразу в хранилища, DOM строится только для j и прочих ключей верхнего уровня
+struct MapSax : nlohmann::json_sax<json> {
+	enum SEC { S_NONE, S_TILES, S_OBJS, S_META };
+	int depth = 0;
+	int sec = S_NONE;
+	std::string k; // текущий ключ
+	int w = 0, h = 0;
+	std::vector<Tile> nt;
+	std::vector<OBJ> no;
+	json meta = json::object();
+	std::string err;
+	// поддерево j / мета-ключа
+	json sub;
+	std::vector<json*> sub_st;
+	std::string sub_key;
+	int sub_depth = -1;
+
+	bool sub_active() const { return sub_depth >= 0; }
+	void sub_begin(json v) {
+		sub = std::move(v);
+		sub_st.clear();
+		if (sub.is_structured()) sub_st.push_back(&sub);
+		sub_depth = depth;
+		if (!sub.is_structured()) sub_end();
+	}
+	void sub_end() {
+		if (sec == S_META) meta[sub_key] = std::move(sub);
+		else if (sec == S_TILES && !nt.empty()) nt.back().j = std::move(sub);
+		else if (sec == S_OBJS && !no.empty()) no.back().j = std::move(sub);
+		sub = json();
+		sub_depth = -1;
+		if (sec == S_META) sec = S_NONE;
+	}
+	json* sub_put(json v) {
+		json& top = *sub_st.back();
+		if (top.is_object()) return &(top[k] = std::move(v));
+		top.push_back(std::move(v));
+		return &top.back();
+	}
+	// скаляр или начало структуры; true - поглощено поддеревом
+	bool value(json v) {
+		if (sub_active()) {
+			json* p = sub_put(std::move(v));
+			if (p->is_structured()) sub_st.push_back(p);
+			return true;
+		}
+		if (depth == 1) {
+			if (k == "tiles" || k == "objs") return false;
+			if (k == "w" && v.is_number()) { w = v.get<int>(); return true; }
+			if (k == "h" && v.is_number()) { h = v.get<int>(); return true; }
+			sec = S_META;
+			sub_key = k;
+			sub_begin(std::move(v));
+			return true;
+		}
+		if (depth == 3 && k == "j") {
+			sub_begin(std::move(v));
+			return true;
+		}
+		return false;
+	}
+	void field(double d, const std::string& s, bool is_str) {
+		if (depth != 3) return;
+		if (sec == S_TILES && !nt.empty()) {
+			Tile& t = nt.back();
+			if (k == "tid" && is_str) t.tid = s;
+			else if (k == "id") t.id = (int)d;
+			else if (k == "bid") t.bid = (int)d;
+			else if (k == "h") t.h = (float)d;
+		}
+		else if (sec == S_OBJS && !no.empty()) {
+			OBJ& o = no.back();
+			if (k == "anim" && is_str) o.anim = s;
+			else if (k == "id") o.id = (int)d;
+			else if (k == "tid") o.tid = is_str ? s : "#" + std::to_string((int)d);
+			else if (k == "proch") o.proch = (int)d;
+			else if (k == "x") o.vec3.x = (float)d;
+			else if (k == "y") o.vec3.y = (float)d;
+			else if (k == "z") o.vec3.z = (float)d;
+			else if (k == "pov") o.pov = (float)d;
+			else if (k == "razm") o.razm = (float)d;
+		}
+	}
+	bool null() override { if (!value(json())) field(0, {}, false); return true; }
+	bool boolean(bool b) override { if (!value(b)) field(b, {}, false); return true; }
+	bool number_integer(number_integer_t v) override { if (!value(v)) field((double)v, {}, false); return true; }
+	bool number_unsigned(number_unsigned_t v) override { if (!value(v)) field((double)v, {}, false); return true; }
+	bool number_float(number_float_t v, const string_t&) override { if (!value(v)) field(v, {}, false); return true; }
+	bool string(string_t& v) override {
+		if (sub_active() || depth == 1 || (depth == 3 && k == "j")) value(v);
+		else field(0, v, true);
+		return true;
+	}
+	bool binary(binary_t&) override { return true; }
+	bool start_object(std::size_t) override {
+		if (!value(json::object())) {
+			if (depth == 2 && sec == S_TILES) nt.push_back(Tile{});
+			else if (depth == 2 && sec == S_OBJS) {
+				no.push_back(OBJ{});
+				no.back().razm = 1.0f;
+			}
+		}
+		depth++;
+		return true;
+	}
+	bool key(string_t& v) override {
+		k = v;
+		return true;
+	}
+	bool end_object() override {
+		depth--;
+		if (sub_active()) {
+			sub_st.pop_back();
+			if (depth == sub_depth) sub_end();
+		}
+		return true;
+	}
+	bool start_array(std::size_t) override {
+		if (depth == 1 && !sub_active() && (k == "tiles" || k == "objs")) {
+			sec = k == "tiles" ? S_TILES : S_OBJS;
+			if (sec == S_TILES && w > 0 && h > 0) nt.reserve((size_t)w * h);
+			depth++;
+			return true;
+		}
+		value(json::array());
+		depth++;
+		return true;
+	}
+	bool end_array() override {
+		depth--;
+		if (sub_active()) {
+			sub_st.pop_back();
+			if (depth == sub_depth) sub_end();
+		}
+		else if (depth == 1) sec = S_NONE;
+		return true;
+	}
+	bool parse_error(std::size_t pos, const std::string&, const nlohmann::detail::exception& e) override {
+		err = TextFormat("%s (byte %zu)", e.what(), pos);
+		return false;
+	}
+};
+// Параллельная загрузка: быстрый проход по байтам находит границы элементов "tiles"/"objs"
+// (учитывая строки), затем диапазоны элементов разбираются тем же MapSax на всех ядрах
+struct JsonMapIndex {
+	std::vector<std::pair<const char*, const char*>> tiles, objs; // элементы массивов
+	std::string head; // все остальные ключи верхнего уровня одним объектом
+};
+const char* json_skip_ws(const char* p, const char* e) {
+	while (p < e && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+	return p;
+}
+const char* json_skip_string(const char* p, const char* e) {
+	for (p++; p < e; p++) {
+		if (*p == '\\') p++;
+		else if (*p == '"') return p + 1;
+	}
+	return nullptr;
+}
+// Конец значения, начинающегося в p; nullptr - обрыв
+const char* json_skip_value(const char* p, const char* e) {
+	if (p >= e) return nullptr;
+	if (*p == '"') return json_skip_string(p, e);
+	if (*p == '{' || *p == '[') {
+		int depth = 0;
+		for (; p < e; p++) {
+			char c = *p;
+			if (c == '"') {
+				p = json_skip_string(p, e);
+				if (!p) return nullptr;
+				p--;
+			}
+			else if (c == '{' || c == '[') depth++;
+			else if ((c == '}' || c == ']') && --depth == 0) return p + 1;
+		}
+		return nullptr;
+	}
+	while (p < e && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\n' && *p != '\r' && *p != '\t') p++;
+	return p;
+}
+bool json_index_map(const char* p, const char* e, JsonMapIndex& ix) {
+	p = json_skip_ws(p, e);
+	if (p >= e || *p != '{') return false;
+	ix.head = "{";
+	p = json_skip_ws(p + 1, e);
+	while (p < e && *p != '}') {
+		if (*p != '"') return false;
+		const char* k0 = p;
+		const char* k1 = json_skip_string(p, e);
+		if (!k1) return false;
+		p = json_skip_ws(k1, e);
+		if (p >= e || *p != ':') return false;
+		p = json_skip_ws(p + 1, e);
+		std::string_view key(k0, k1 - k0);
+		auto* arr = key == "\"tiles\"" ? &ix.tiles : key == "\"objs\"" ? &ix.objs : nullptr;
+		if (arr && *p == '[') {
+			p = json_skip_ws(p + 1, e);
+			while (p < e && *p != ']') {
+				const char* v1 = json_skip_value(p, e);
+				if (!v1) return false;
+				arr->push_back({ p, v1 });
+				p = json_skip_ws(v1, e);
+				if (p < e && *p == ',') p = json_skip_ws(p + 1, e);
+			}
+			if (p >= e) return false;
+			p++;
+		}
+		else {
+			const char* v1 = json_skip_value(p, e);
+			if (!v1) return false;
+			if (ix.head.size() > 1) ix.head += ',';
+			ix.head.append(k0, k1 - k0);
+			ix.head += ':';
+			ix.head.append(p, v1 - p);
+			p = v1;
+		}
+		p = json_skip_ws(p, e);
+		if (p < e && *p == ',') p = json_skip_ws(p + 1, e);
+	}
+	ix.head += '}';
+	return p < e;
+}
+// Вход парсера из трех кусков: префикс, байты прямо из mmap, суффикс - без копии
+struct JsonSegIter {
+	using iterator_category = std::forward_iterator_tag;
+	using value_type = char;
+	using difference_type = std::ptrdiff_t;
+	using pointer = const char*;
+	using reference = const char&;
+	const std::pair<const char*, const char*>* seg = nullptr;
+	int si = 3;
+	const char* p = nullptr;
+	void skip() { while (si < 3 && p == seg[si].second) if (++si < 3) p = seg[si].first; }
+	reference operator*() const { return *p; }
+	JsonSegIter& operator++() { ++p; skip(); return *this; }
+	JsonSegIter operator++(int) { JsonSegIter t = *this; ++*this; return t; }
+	bool operator==(const JsonSegIter& o) const { return si == o.si && (si == 3 || p == o.p); }
+	bool operator!=(const JsonSegIter& o) const { return !(*this == o); }
+};
+// Элементы [a, b) массива key как отдельный документ {"key":[...]}
+bool json_parse_range(const char* key, const std::vector<std::pair<const char*, const char*>>& el, size_t a, size_t b, MapSax& sax) {
+	if (a >= b) return true;
+	char pre[64];
+	int pn = snprintf(pre, sizeof(pre), "{\"%s\":[", key);
+	if (pn <= 0 || pn >= (int)sizeof(pre)) return false;
+	static const char suf[] = "]}";
+	std::pair<const char*, const char*> seg[3] = { { pre, pre + pn }, { el[a].first, el[b - 1].second }, { suf, suf + 2 } };
+	JsonSegIter first{ seg, 0, pre }, last;
+	first.skip();
+	return json::sax_parse(first, last, &sax);
+}
+bool json_load_parallel(const MappedFile& mf, MapSax& out) {
+	JsonMapIndex ix;
+	const char* p = (const char*)mf.data;
+	if (!json_index_map(p, p + mf.size, ix)) return false;
+	if (!json::sax_parse(ix.head, &out)) return false;
+	// диапазонов больше, чем ядер, чтобы потоки не ждали самый тяжелый
+	int parts = (int)std::max(1u, std::thread::hardware_concurrency()) * 4;
+	auto run = [&](const char* key, const std::vector<std::pair<const char*, const char*>>& el, bool tiles_arr) {
+		size_t n = el.size(), per = (n + parts - 1) / parts;
+		if (n == 0) return true;
+		int np = (int)((n + per - 1) / per);
+		std::vector<MapSax> res(np);
+		std::atomic<bool> ok = true;
+		par_for(np, [&](int a, int b) {
+			for (int k = a; k < b; k++)
+				if (!json_parse_range(key, el, k * per, std::min(n, (k + 1) * per), res[k])) ok = false;
+		}, 1);
+		if (!ok) return false;
+		if (tiles_arr) {
+			out.nt.reserve(n);
+			for (MapSax& r : res) std::move(r.nt.begin(), r.nt.end(), std::back_inserter(out.nt));
+		}
+		else {
+			out.no.reserve(n);
+			for (MapSax& r : res) std::move(r.no.begin(), r.no.end(), std::back_inserter(out.no));
+		}
+		return true;
+	};
+	return run("tiles", ix.tiles, true) && run("objs", ix.objs, false);
+}
+// tid числом в старых JSON-картах - индекс в ключах "texs" по порядку
+void json_resolve_tids(std::vector<OBJ>& objs, const json& texs) {
+	std::vector<std::string> names;
+	if (texs.is_object())
+		for (auto it = texs.begin(); it != texs.end(); ++it) names.push_back(it.key());
+	for (OBJ& o : objs) {
+		if (o.tid.empty() || o.tid[0] != '#') continue;
+		int k = std::atoi(o.tid.c_str() + 1);
+		o.tid = k >= 0 && k < (int)names.size() ? names[k] : std::string();
+	}
+}
+bool map_load_json(const std::string& path) {
+	auto t0 = std::chrono::steady_clock::now();
+	MappedFile mf;
+	if (!mf.open(path)) return false;
+	MapSax sax;
+	bool ok = json_load_parallel(mf, sax);
+	if (!ok) {
+		// нестандартная раскладка - обычный потоковый разбор
+		sax = MapSax();
+		ok = json::sax_parse(mf.data, mf.data + mf.size, &sax);
+	}
+	if (!ok || sax.w <= 0 || sax.h <= 0 || sax.nt.size() != (size_t)sax.w * sax.h) {
+		TraceLog(LOG_WARNING, "JSON: %s is not a map: %s", path.c_str(), sax.err.empty() ? "bad tiles size" : sax.err.c_str());
+		return false;
+	}
+	MAP_W = sax.w;
+	MAP_H = sax.h;
+	tiles = std::move(sax.nt);
+	OBJS = std::move(sax.no);
+	r = std::move(sax.meta);
+	json_resolve_tids(OBJS, r.value("texs", json::object()));
+	pack_open(pack_path(path));
+	texs_from_json(r.value("texs", json::object()));
+	r.erase("texs");
+	map_loaded();
+	json_io_last.bytes = mf.size;
+	json_io_last.sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	TraceLog(LOG_INFO, "JSON: read %.1f MB in %.3f s (%.1f MB/s)", mf.size / (1024.0 * 1024.0), json_io_last.sec, json_io_last.mbps());
+	return true;
+}
+
+// ===== Подкачка: окно тайлов вокруг камеры поверх большого .smap =====
+// tiles/OBJS держат только окно pw.win x pw.win (координаты - от угла окна). Чанки вне окна
+// лежат в файле или в кеше страниц (несжатые слои, LRU по бюджету). Поток подкачки заранее
+// распаковывает чанки в сторону движения камеры. Измененные страницы дописываются в конец
+// файла вместе с новым каталогом, последним переписывается заголовок
+struct Page {
+	std::array<std::vector<unsigned char>, ML_COUNT> raw;
+	bool dirty = false;
+	uint64_t used = 0;
+	size_t bytes = 0;
+};
+struct PagedWorld {
+	bool active = false;
+	std::string path;
+	MappedFile mf;
+	SmapHeader hd = {};
+	std::vector<SmapEntry> dir;
+	json meta;
+	TidPalette pal;
+	int win = 2048; // сторона окна в тайлах, кратно CHUNK
+	int ox = 0, oz = 0; // угол окна в мире
+	size_t budget = (size_t)4 << 30; // кеш страниц
+	size_t bytes = 0;
+	uint64_t tick = 0;
+	std::unordered_map<int, Page> cache; // мировой индекс чанка -> страница
+	std::vector<unsigned int> ver; // undo.ver окна после загрузки/записи
+	std::shared_mutex io; // mf и dir; уникально только при дописывании файла
+	std::mutex m; // cache, bytes, want
+	std::condition_variable cv;
+	std::deque<int> want;
+	std::thread pf;
+	bool quit = false;
+	Vector2 vel = { 0 }; // сглаженная скорость камеры, тайлов/кадр
+	Vector3 last = { 0 };
+};
+PagedWorld pw;
+int page_cw() { return pw.hd.map_w / CHUNK; }
+int page_ch() { return pw.hd.map_h / CHUNK; }
+// Мировой чанк окна c (индекс в сетке окна)
+int page_world_chunk(int c) {
+	return (pw.oz / CHUNK + c / chunks_w()) * page_cw() + pw.ox / CHUNK + c % chunks_w();
+}
+bool page_read(int wc, Page& pg) {
+	std::shared_lock lk(pw.io);
+	std::vector<unsigned char> tmp;
+	pg.bytes = 0;
+	for (int l = 0; l < ML_COUNT; l++) {
+		SmapEntry e = pw.dir[(size_t)wc * ML_COUNT + l];
+		pg.raw[l].clear();
+		if (e.size == 0) continue;
+		if (e.off + e.size > pw.mf.size) return false;
+		const unsigned char* p = payload_unpack(pw.mf.data + e.off, e, tmp);
+		if (!p) return false;
+		pg.raw[l].assign(p, p + e.raw);
+		pg.bytes += e.raw;
+	}
+	return true;
+}
+// Страница из кеша или с диска; ссылка живет до page_evict (узлы unordered_map не переезжают)
+Page& page_get(int wc) {
+	{
+		std::lock_guard<std::mutex> lk(pw.m);
+		auto it = pw.cache.find(wc);
+		if (it != pw.cache.end()) {
+			it->second.used = ++pw.tick;
+			return it->second;
+		}
+	}
+	Page pg;
+	if (!page_read(wc, pg)) TraceLog(LOG_WARNING, "PAGE: chunk %d is damaged", wc);
+	std::lock_guard<std::mutex> lk(pw.m);
+	auto [it, fresh] = pw.cache.emplace(wc, std::move(pg));
+	if (fresh) pw.bytes += it->second.bytes;
+	it->second.used = ++pw.tick;
+	return it->second;
+}
+void page_prefetch_loop() {
+	for (;;) {
+		int wc;
+		{
+			std::unique_lock<std::mutex> lk(pw.m);
+			pw.cv.wait(lk, [] { return pw.quit || !pw.want.empty(); });
+			if (pw.quit) return;
+			wc = pw.want.front();
+			pw.want.pop_front();
+			if (pw.cache.count(wc)) continue;
+		}
+		Page pg;
+		if (!page_read(wc, pg)) continue;
+		std::lock_guard<std::mutex> lk(pw.m);
+		auto [it, fresh] = pw.cache.emplace(wc, std::move(pg));
+		if (fresh) {
+			pw.bytes += it->second.bytes;
+			it->second.used = pw.tick; // старше всего, что реально понадобилось
+		}
+	}
+}
+// Объекты чанка окна в мировых координатах
+void page_encode_objs(const std::vector<int>& idx, std::vector<unsigned char>& o) {
+	std::vector<OBJ> w;
+	w.reserve(idx.size());
+	for (int i : idx) {
+		w.push_back(OBJS[i]);
+		w.back().vec3.x += pw.ox;
+		w.back().vec3.z += pw.oz;
+	}
+	std::vector<int> all(w.size());
+	for (int i = 0; i < (int)all.size(); i++) all[i] = i;
+	objs_encode(w, all, o);
+}
+// Чанк окна -> грязная страница кеша, если тайлы или объекты менялись
+void page_store(int c, const std::vector<int>& objs) {
+	int wc = page_world_chunk(c);
+	std::vector<unsigned char> ob;
+	page_encode_objs(objs, ob);
+	const SmapEntry& eo = pw.dir[(size_t)wc * ML_COUNT + ML_OBJS];
+	bool objs_same = eo.size == 0 ? objs.empty() : eo.hash == hash64(ob.data(), ob.size());
+	bool tiles_same = undo.ver[c] == pw.ver[c];
+	if (tiles_same && objs_same) return;
+	Page pg;
+	for (int l = 0; l < ML_COUNT; l++) {
+		if (l == ML_OBJS) pg.raw[l] = std::move(ob);
+		else layer_encode(c, l, pw.pal, pg.raw[l]);
+		pg.bytes += pg.raw[l].size();
+	}
+	pg.dirty = true;
+	std::lock_guard<std::mutex> lk(pw.m);
+	Page& dst = pw.cache[wc];
+	pw.bytes -= dst.bytes;
+	dst = std::move(pg);
+	dst.used = ++pw.tick;
+	pw.bytes += dst.bytes;
+}
+// Грязные страницы (и правки в окне) дописываются в конец файла
+bool page_flush() {
+	if (!pw.active) return false;
+	undo_fit();
+	std::vector<std::vector<int>> ob = objs_by_chunk(OBJS, MAP_W, MAP_H);
+	for (int c = 0; c < (int)ob.size(); c++) page_store(c, ob[c]);
+	std::vector<std::pair<int, Page*>> dirty;
+	{
+		std::lock_guard<std::mutex> lk(pw.m);
+		for (auto& [wc, pg] : pw.cache) if (pg.dirty) dirty.push_back({ wc, &pg });
+	}
+	pw.ver = undo.ver;
+	if (dirty.empty()) return true;
+	std::vector<std::vector<unsigned char>> out(dirty.size() * ML_COUNT);
+	std::vector<SmapEntry> ent(dirty.size() * ML_COUNT);
+	std::vector<size_t> idx(dirty.size() * ML_COUNT);
+	par_for((int)dirty.size(), [&](int a, int b) {
+		for (int k = a; k < b; k++)
+			for (int l = 0; l < ML_COUNT; l++) {
+				size_t i = (size_t)k * ML_COUNT + l;
+				idx[i] = (size_t)dirty[k].first * ML_COUNT + l;
+				payload_pack(dirty[k].second->raw[l], true, ent[i], out[i], l, CHUNK, CHUNK);
+			}
+	}, 1);
+	pw.meta["pal"] = pw.pal.names;
+	pw.meta["r"] = r;
+	pw.meta["next_obj_id"] = next_obj_id;
+	pw.meta["texs"] = texs_to_json();
+	std::unique_lock lk(pw.io);
+	pw.mf.close();
+	bool ok = smap_append(pw.path, pw.hd, pw.dir, pw.meta.dump(), idx, ent, out);
+	if (ok && smap_needs_compact(pw.path, pw.hd)) smap_compact(pw.path, pw.hd, pw.dir);
+	if (!pw.mf.open(pw.path)) ok = false;
+	lk.unlock();
+	if (ok) for (auto& d : dirty) d.second->dirty = false;
+	if (ok && !texs_for_list.empty()) pack_save(pack_path(pw.path));
+	return ok;
+}
+// Вытеснение самых старых чистых страниц; если мешают грязные - сначала запись
+void page_evict() {
+	if (pw.bytes <= pw.budget) return;
+	std::vector<std::pair<uint64_t, int>> v;
+	bool any_dirty = false;
+	{
+		std::lock_guard<std::mutex> lk(pw.m);
+		for (auto& [wc, pg] : pw.cache) {
+			if (pg.dirty) any_dirty = true;
+			else v.push_back({ pg.used, wc });
+		}
+	}
+	size_t clean = 0;
+	{
+		std::lock_guard<std::mutex> lk(pw.m);
+		for (auto& [u, wc] : v) clean += pw.cache[wc].bytes;
+	}
+	if (any_dirty && pw.bytes - clean > pw.budget * 3 / 4) {
+		if (page_flush()) page_evict();
+		return;
+	}
+	std::sort(v.begin(), v.end());
+	std::lock_guard<std::mutex> lk(pw.m);
+	for (auto& [u, wc] : v) {
+		if (pw.bytes <= pw.budget * 3 / 4) break;
+		pw.bytes -= pw.cache[wc].bytes;
+		pw.cache.erase(wc);
+	}
+}
+// Новый угол окна (кратно CHUNK). Камера сдвигается вместе с ним
+void sel_shift(int dx, int dz);
+void page_shift(int nox, int noz, Camera3D& cam) {
+	nox = std::clamp(nox, 0, pw.hd.map_w - MAP_W) / CHUNK * CHUNK;
+	noz = std::clamp(noz, 0, pw.hd.map_h - MAP_H) / CHUNK * CHUNK;
+	if (nox == pw.ox && noz == pw.oz) return;
+	ProfScope ps("page_shift");
+	undo_fit();
+	int cw = chunks_w(), chh = chunks_h();
+	int dcx = (nox - pw.ox) / CHUNK, dcz = (noz - pw.oz) / CHUNK;
+	std::vector<std::vector<int>> ob = objs_by_chunk(OBJS, MAP_W, MAP_H);
+	// уходящие чанки - в кеш (если менялись)
+	for (int c = 0; c < cw * chh; c++) {
+		int cx = c % cw - dcx, cz = c / cw - dcz;
+		if (cx >= 0 && cx < cw && cz >= 0 && cz < chh) continue;
+		page_store(c, ob[c]);
+	}
+	// остающиеся тайлы и объекты переезжают
+	std::vector<Tile> nt((size_t)MAP_W * MAP_H);
+	std::vector<OBJ> no;
+	std::vector<int> incoming;
+	for (int c = 0; c < cw * chh; c++) {
+		int sx = c % cw + dcx, sz = c / cw + dcz; // откуда в старом окне
+		if (sx < 0 || sx >= cw || sz < 0 || sz >= chh) { incoming.push_back(c); continue; }
+		int sc = sz * cw + sx;
+		DirtyRect d = chunk_rect(c);
+		for (int z = 0; z < CHUNK; z++)
+			for (int x = 0; x < CHUNK; x++)
+				nt[(size_t)(d.z0 + z) * MAP_W + d.x0 + x] = std::move(tiles[(size_t)(sz * CHUNK + z) * MAP_W + sx * CHUNK + x]);
+		for (int i : ob[sc]) {
+			no.push_back(std::move(OBJS[i]));
+			no.back().vec3.x -= nox - pw.ox;
+			no.back().vec3.z -= noz - pw.oz;
+		}
+	}
+	tiles.swap(nt);
+	nt.clear();
+	pw.ox = nox;
+	pw.oz = noz;
+	// приходящие - из кеша/файла, параллельно
+	std::vector<std::vector<OBJ>> inc(incoming.size());
+	par_for((int)incoming.size(), [&](int a, int b) {
+		for (int k = a; k < b; k++) {
+			int c = incoming[k];
+			Page& pg = page_get(page_world_chunk(c));
+			for (int l = 0; l < ML_COUNT; l++)
+				layer_decode(c, l, pg.raw[l].data(), pg.raw[l].size(), pw.pal.names, inc[k]);
+		}
+	}, 4);
+	for (auto& v : inc) {
+		for (OBJ& o : v) {
+			o.vec3.x -= pw.ox;
+			o.vec3.z -= pw.oz;
+			no.push_back(std::move(o));
+		}
+	}
+	int so_id = so_idx >= 0 && so_idx < (int)OBJS.size() ? OBJS[so_idx].id : 0;
+	OBJS.swap(no);
+	cam.position.x -= dcx * CHUNK; cam.target.x -= dcx * CHUNK;
+	cam.position.z -= dcz * CHUNK; cam.target.z -= dcz * CHUNK;
+	pw.last.x -= dcx * CHUNK;
+	pw.last.z -= dcz * CHUNK;
+	// не map_loaded: история, выделение и несохраненные правки остающихся чанков переезжают вместе с окном
+	for (const OBJ& o : OBJS) next_obj_id = std::max(next_obj_id, o.id + 1);
+	oix_rebuild();
+	objr_reset();
+	so_idx = so_id ? obj_find(so_id) : -1;
+	st = nullptr;
+	sel_shift(dcx * CHUNK, dcz * CHUNK);
+	undo_shift(dcx, dcz);
+	std::vector<unsigned int> pv(pw.ver.size(), 0);
+	for (int c = 0; c < cw * chh; c++) {
+		int sx = c % cw + dcx, sz = c / cw + dcz;
+		if (sx >= 0 && sx < cw && sz >= 0 && sz < chh) pv[c] = pw.ver[sz * cw + sx];
+	}
+	pw.ver.swap(pv);
+	autotile_shift(dcx * CHUNK, dcz * CHUNK);
+	for (int c : incoming) {
+		DirtyRect d = chunk_rect(c);
+		undo_bump(d.x0, d.z0, d.x1, d.z1);
+		autotile_mark(d.x0 - 1, d.z0 - 1, d.x1 + 1, d.z1 + 1);
+		pw.ver[c] = undo.ver[c];
+	}
+	// высоты на GPU, пирамида пика и миникарта адресуются координатами окна - их содержимое сдвинулось целиком
+	hf_gpu_mark(0, 0, MAP_W, MAP_H);
+	pick_mark(0, 0, MAP_W, MAP_H);
+	minimap_mark(0, 0, MAP_W, MAP_H);
+	page_evict();
+}
+void page_close() {
+	if (!pw.active) return;
+	page_flush();
+	{
+		std::lock_guard<std::mutex> lk(pw.m);
+		pw.quit = true;
+		pw.want.clear();
+	}
+	pw.cv.notify_all();
+	if (pw.pf.joinable()) pw.pf.join();
+	pw.cache.clear();
+	pw.bytes = 0;
+	pw.mf.close();
+	pw.active = false;
+}
+// Карта больше окна и с целыми чанками - открываем с подкачкой
+bool smap_pageable(const std::string& path) {
+	std::ifstream f(path, std::ios::binary);
+	SmapHeader hd = {};
+	if (!f.read((char*)&hd, sizeof(hd)) || memcmp(hd.magic, "SMAP", 4) != 0) return false;
+	return hd.map_w % CHUNK == 0 && hd.map_h % CHUNK == 0 && (hd.map_w > pw.win || hd.map_h > pw.win);
+}
+bool page_open(const std::string& path, Camera3D& cam) {
+	page_close();
+	{
+		// файл старой версии один раз переводится в текущую, страницы дальше читаются без оглядки на версию
+		MappedFile mf;
+		SmapHeader hd;
+		std::vector<SmapEntry> dir;
+		if (!mf.open(path) || !smap_directory(mf, hd, dir)) return false;
+		mf.close();
+		if (hd.version < SMAP_VERSION && !smap_compact(path, hd, dir)) {
+			TraceLog(LOG_WARNING, "SMAP: %s could not be converted to version %u", path.c_str(), SMAP_VERSION);
+			return false;
+		}
+	}
+	if (!pw.mf.open(path)) return false;
+	if (!smap_directory(pw.mf, pw.hd, pw.dir) || pw.hd.map_w % CHUNK || pw.hd.map_h % CHUNK) { pw.mf.close(); return false; }
+	pw.meta = json::parse(pw.mf.data + pw.hd.meta_off, pw.mf.data + pw.hd.meta_off + pw.hd.meta_size, nullptr, false);
+	if (!pw.meta.is_object()) pw.meta = json::object();
+	pw.pal = TidPalette();
+	for (const std::string& t : pw.meta.value("pal", std::vector<std::string>())) {
+		pw.pal.idx.emplace(t, (uint16_t)pw.pal.names.size());
+		pw.pal.names.push_back(t);
+	}
+	pw.path = path;
+	pw.active = true;
+	pw.quit = false;
+	pw.ox = pw.oz = 0;
+	MAP_W = std::min(pw.win, pw.hd.map_w);
+	MAP_H = std::min(pw.win, pw.hd.map_h);
+	tiles.assign((size_t)MAP_W * MAP_H, Tile());
+	OBJS.clear();
+	int nc = chunks_w() * chunks_h();
+	std::vector<std::vector<OBJ>> objs(nc);
+	par_for(nc, [&](int a, int b) {
+		for (int c = a; c < b; c++) {
+			Page& pg = page_get(page_world_chunk(c));
+			for (int l = 0; l < ML_COUNT; l++) layer_decode(c, l, pg.raw[l].data(), pg.raw[l].size(), pw.pal.names, objs[c]);
+		}
+	}, 4);
+	for (auto& v : objs) for (OBJ& o : v) OBJS.push_back(std::move(o));
+	if (pw.meta.contains("r")) r = pw.meta["r"];
+	next_obj_id = pw.meta.value("next_obj_id", 1);
+	pack_open(pack_path(path));
+	texs_from_json(pw.meta.value("texs", json::object()));
+	map_loaded();
+	undo_fit();
+	pw.ver = undo.ver;
+	pw.last = cam.target;
+	pw.pf = std::thread(page_prefetch_loop);
+	return true;
+}
+// Пустой мир w x h: только каталог с пустыми записями, чанки появятся при записи
+bool page_new_world(const std::string& path, int w, int h) {
+	w = (w + CHUNK - 1) / CHUNK * CHUNK;
+	h = (h + CHUNK - 1) / CHUNK * CHUNK;
+	json meta = { {"pal", json::array()}, {"r", json::object()}, {"next_obj_id", 1}, {"texs", json::object()} };
+	return smap_write(path, w, h, meta, [](int, int, std::vector<unsigned char>& o) { o.clear(); }, false, true);
+}
+// Раз в кадр: сдвиг окна у края и упреждающая загрузка по направлению движения
+void page_tick(Camera3D& cam, bool busy) {
+	if (!pw.active) return;
+	pw.vel.x = pw.vel.x * 0.9f + (cam.target.x - pw.last.x) * 0.1f;
+	pw.vel.y = pw.vel.y * 0.9f + (cam.target.z - pw.last.z) * 0.1f;
+	pw.last = cam.target;
+	int q = MAP_W / 4;
+	// во время правки окно не двигается: чанки под операцией остаются на месте
+	if (!busy) {
+		int nox = pw.ox, noz = pw.oz;
+		if (cam.target.x < q) nox -= MAP_W / 2;
+		else if (cam.target.x > MAP_W - q) nox += MAP_W / 2;
+		if (cam.target.z < q) noz -= MAP_H / 2;
+		else if (cam.target.z > MAP_H - q) noz += MAP_H / 2;
+		page_shift(nox, noz, cam);
+	}
+	// полоса за краем окна, которая придет при следующем сдвиге
+	int sx = pw.vel.x > 0.05f ? 1 : pw.vel.x < -0.05f ? -1 : 0;
+	int sz = pw.vel.y > 0.05f ? 1 : pw.vel.y < -0.05f ? -1 : 0;
+	if (!sx && !sz) return;
+	int cw = chunks_w(), chh = chunks_h(), half = cw / 2;
+	int c0x = pw.ox / CHUNK, c0z = pw.oz / CHUNK;
+	std::deque<int> want;
+	for (int cz = c0z - (sz < 0 ? half : 0); cz < c0z + chh + (sz > 0 ? half : 0); cz++)
+		for (int cx = c0x - (sx < 0 ? half : 0); cx < c0x + cw + (sx > 0 ? half : 0); cx++) {
+			if (cx < 0 || cz < 0 || cx >= page_cw() || cz >= page_ch()) continue;
+			if (cx >= c0x && cx < c0x + cw && cz >= c0z && cz < c0z + chh) continue;
+			want.push_back(cz * page_cw() + cx);
+		}
+	{
+		std::lock_guard<std::mutex> lk(pw.m);
+		pw.want.swap(want);
+	}
+	pw.cv.notify_one();
+}
+
+// ===== Автосохранение: снимок чанков с копированием при записи, сжатие и запись в фоне =====
+// Закодированные слои чанка неизменяемы и общие между снимками; перекодируются только чанки,
+// чья версия (undo.ver, растет в map_changed) ушла вперед. Кодирование - в пределах бюджета кадра
+typedef std::shared_ptr<const std::array<std::vector<unsigned char>, ML_COUNT>> ChunkImage;
+struct AutoSave {
+	float interval = 120.0f; // сек, 0 - выключено
+	std::string path = "autosave.smap";
+	double budget_ms = 2.0; // на кадр
+	double next = 0.0;
+	bool collecting = false;
+	int epoch = -1;
+	std::vector<unsigned int> ver;
+	std::vector<ChunkImage> img;
+	TidPalette pal; // только растет, чтобы старые образы оставались верными
+	std::thread worker;
+	std::atomic<bool> busy = false;
+	std::atomic<double> last_sec = 0.0; // длительность последней фоновой записи, пишет поток
+	double next_set = 0.0; // interval, от которого посчитан next
+	double last_done = -1.0; // GetTime() окончания
+};
+AutoSave autos;
+
+void autosave_wait() {
+	if (autos.worker.joinable()) autos.worker.join();
+}
+// Снимок собран: все, что нужно для записи, копируется и уходит в поток
+void autosave_launch() {
+	autosave_wait();
+	auto objs = std::make_shared<std::vector<OBJ>>(OBJS);
+	std::vector<ChunkImage> img = autos.img;
+	json meta = { {"pal", autos.pal.names}, {"r", r}, {"next_obj_id", next_obj_id}, {"texs", texs_to_json()} };
+	if (!apk.path.empty()) meta["pack"] = std::filesystem::absolute(apk.path).string();
+	int w = MAP_W, h = MAP_H;
+	std::string path = autos.path;
+	autos.busy = true;
+	autos.worker = std::thread([img = std::move(img), objs, meta = std::move(meta), w, h, path]() {
+		auto t0 = std::chrono::steady_clock::now();
+		std::vector<std::vector<int>> ob = objs_by_chunk(*objs, w, h);
+		bool ok = smap_write(path, w, h, meta, [&](int c, int l, std::vector<unsigned char>& o) {
+			if (l == ML_OBJS) objs_encode(*objs, ob[c], o);
+			else o = (*img[c])[l];
+		}, true, false);
+		autos.last_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		if (!ok) TraceLog(LOG_WARNING, "AUTOSAVE: failed to write %s", path.c_str());
+		autos.busy = false;
+	});
+}
+// Раз в кадр из главного цикла
+void autosave_tick(double now) {
+	// при подкачке в памяти только окно; его правки дописывает page_flush
+	if (autos.interval <= 0.0f || pw.active) { autos.collecting = false; return; }
+	// интервал поменяли ползунком - срок от прошлого запуска по новому интервалу
+	if (autos.next_set != autos.interval) {
+		autos.next += autos.interval - autos.next_set;
+		autos.next_set = autos.interval;
+	}
+	if (!autos.busy && autos.worker.joinable()) {
+		autos.worker.join();
+		autos.last_done = now;
+	}
+	if (!autos.collecting) {
+		if (now < autos.next || autos.busy) return;
+		autos.collecting = true;
+	}
+	undo_fit();
+	size_t nc = undo.ver.size();
+	if (autos.epoch != map_epoch || autos.img.size() != nc) {
+		autos.epoch = map_epoch;
+		autos.ver.assign(nc, 0);
+		autos.img.assign(nc, nullptr);
+		autos.pal = TidPalette();
+	}
+	auto t0 = std::chrono::steady_clock::now();
+	bool stale = false;
+	for (size_t c = 0; c < nc; c++) {
+		if (autos.img[c] && autos.ver[c] == undo.ver[c]) continue;
+		if (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count() > autos.budget_ms) {
+			stale = true;
+			break;
+		}
+		auto im = std::make_shared<std::array<std::vector<unsigned char>, ML_COUNT>>();
+		for (int l = 0; l < ML_COUNT; l++) if (l != ML_OBJS) layer_encode((int)c, l, autos.pal, (*im)[l]);
+		autos.img[c] = im;
+		autos.ver[c] = undo.ver[c];
+	}
+	// правки между кадрами снова делают чанки устаревшими - снимок целый только когда за один проход все свежие
+	if (stale) return;
+	autos.collecting = false;
+	autos.next = now + autos.interval;
+	autos.next_set = autos.interval;
+	autosave_launch();
+}
+
+// ===== Cooked-экспорт для движка: готовые данные по чанкам в одном файле под mmap =====
+// [CookHeader][CookChunk x чанков][CookMat x материалов][атлас RGBA8][данные чанков, выровнены по 64]
+// В данных чанка секции выровнены по 16: вершины, индексы u16, высоты коллизии, проходимость u8,
+// материал тайла u16, экземпляры объектов. Чанк с тем же хешем исходных данных копируется из прошлого файла
+struct CookSet {
+	int cell = 64; // размер клетки атласа
+	float max_step = 1.0f; // перепад высот тайла, выше которого не пройти
+};
+CookSet cook_set;
+#pragma pack(push, 1)
+struct CookHeader {
+	char magic[4];
+	uint32_t version;
+	int32_t map_w, map_h, chunk;
+	uint32_t chunks, mats;
+	int32_t atlas_w, atlas_h;
+	uint64_t table_off, mat_off, atlas_off;
+};
+struct CookChunk {
+	uint64_t off;
+	uint32_t size;
+	uint32_t reserved;
+	uint64_t hash;
+	int32_t x0, z0, w, h;
+	float hmin, hmax;
+	// смещения от начала данных чанка
+	uint32_t vb_off, vb_n; // CookVertex, (w + 1) * (h + 1)
+	uint32_t ib_off, ib_n; // uint16
+	uint32_t col_off; // float, (w + 1) * (h + 1)
+	uint32_t walk_off; // uint8, w * h
+	uint32_t mat_off; // uint16 индекс CookMat, w * h
+	uint32_t inst_off, inst_n; // CookInst
+};
+struct CookVertex {
+	float px, py, pz;
+	float nx, ny, nz;
+	float u, v; // в тайлах, повтор текстуры на каждый тайл
+};
+struct CookInst {
+	float xf[16];
+	int32_t id, tid; // tid - индекс CookMat
+};
+struct CookMat {
+	char name[48];
+	float u0, v0, u1, v1; // прямоугольник в атласе
+};
+#pragma pack(pop)
+struct CookStat {
+	int cooked = 0, reused = 0;
+	double sec = 0.0;
+};
+CookStat cook_last;
 
-struct Tile {
-	int id;
-	int bid; // 0 - ничего ++++++ 1 - холм +++++++++ 2 - лесок ++++++ 3 - лес ++++++++ 4 - море +++++++++ 5 - речка
-	std::string tid; // texs 
-	float h;
-	json j;
+template <class T> uint32_t cook_put(std::vector<unsigned char>& b, const std::vector<T>& v) {
+	b.resize((b.size() + 15) & ~(size_t)15);
+	uint32_t off = (uint32_t)b.size();
+	b.insert(b.end(), (const unsigned char*)v.data(), (const unsigned char*)(v.data() + v.size()));
+	return off;
+}
+// Хеш считается по тому, из чего собирается чанк; при совпадении с old данные берутся оттуда
+void cook_chunk(int c, const std::vector<int>& objs, const TidPalette& pal, uint64_t base_hash,
+	const CookChunk* old, const unsigned char* old_data, size_t old_size, CookChunk& ch, std::vector<unsigned char>& blob, bool& reused) {
+	DirtyRect d = chunk_rect(c);
+	int w = d.x1 - d.x0, h = d.z1 - d.z0, aw = w + 3;
+	// высоты с полем в одну вершину: по нему считаются нормали края, поэтому оно входит в хеш
+	std::vector<float> apr((size_t)aw * (h + 3));
+	for (int z = -1; z <= h + 1; z++)
+		for (int x = -1; x <= w + 1; x++) apr[(size_t)(z + 1) * aw + x + 1] = GetVertexHeight(d.x0 + x, d.z0 + z);
+	auto ah = [&](int x, int z) { return apr[(size_t)(z + 1) * aw + x + 1]; };
+	std::vector<float> col((size_t)(w + 1) * (h + 1));
+	for (int z = 0; z <= h; z++)
+		for (int x = 0; x <= w; x++) col[(size_t)z * (w + 1) + x] = ah(x, z);
+	std::vector<uint16_t> mat((size_t)w * h);
+	for (int z = 0; z < h; z++)
+		for (int x = 0; x < w; x++) mat[(size_t)z * w + x] = pal.idx.find(tiles[(size_t)(d.z0 + z) * MAP_W + d.x0 + x].tid)->second;
+	std::vector<CookInst> inst(objs.size());
+	for (size_t i = 0; i < objs.size(); i++) {
+		const OBJ& o = OBJS[objs[i]];
+		float16 m = obj_xf(o);
+		memcpy(inst[i].xf, m.v, sizeof(inst[i].xf));
+		inst[i].id = o.id;
+		auto it = pal.idx.find(o.tid.empty() ? std::string("default") : o.tid);
+		inst[i].tid = it == pal.idx.end() ? -1 : it->second;
+	}
+	uint64_t hs = base_hash;
+	hs = (hs ^ hash64(apr.data(), apr.size() * 4)) * 0x9E3779B97F4A7C15ull;
+	hs = (hs ^ hash64(mat.data(), mat.size() * 2)) * 0x9E3779B97F4A7C15ull;
+	hs = (hs ^ hash64(inst.data(), inst.size() * sizeof(CookInst))) * 0x9E3779B97F4A7C15ull;
+	if (old && old->hash == hs && old->w == w && old->h == h && old->off + old->size <= old_size) {
+		ch = *old;
+		blob.assign(old_data + old->off, old_data + old->off + old->size);
+		reused = true;
+		return;
+	}
+	reused = false;
+	ch = CookChunk{};
+	ch.hash = hs;
+	ch.x0 = d.x0; ch.z0 = d.z0; ch.w = w; ch.h = h;
+	ch.hmin = FLT_MAX; ch.hmax = -FLT_MAX;
+	for (float v : col) { ch.hmin = std::min(ch.hmin, v); ch.hmax = std::max(ch.hmax, v); }
+	std::vector<CookVertex> vb(col.size());
+	for (int z = 0; z <= h; z++)
+		for (int x = 0; x <= w; x++) {
+			int gx = d.x0 + x, gz = d.z0 + z;
+			Vector3 n = Vector3Normalize({ ah(x - 1, z) - ah(x + 1, z), 2.0f, ah(x, z - 1) - ah(x, z + 1) });
+			vb[(size_t)z * (w + 1) + x] = { (float)gx, col[(size_t)z * (w + 1) + x], (float)gz, n.x, n.y, n.z, (float)gx, (float)gz };
+		}
+	// как в DrawMap: (x, z) -> (x, z + 1) -> (x + 1, z + 1) -> (x + 1, z)
+	std::vector<uint16_t> ib;
+	ib.reserve((size_t)w * h * 6);
+	std::vector<uint8_t> walk((size_t)w * h);
+	for (int z = 0; z < h; z++)
+		for (int x = 0; x < w; x++) {
+			uint16_t i00 = (uint16_t)(z * (w + 1) + x), i10 = i00 + 1, i01 = (uint16_t)(i00 + w + 1), i11 = i01 + 1;
+			ib.insert(ib.end(), { i00, i01, i11, i00, i11, i10 });
+			float a = col[i00], b = col[i10], cc = col[i01], e = col[i11];
+			float step = std::max({ a, b, cc, e }) - std::min({ a, b, cc, e });
+			walk[(size_t)z * w + x] = step <= cook_set.max_step && pal.names[mat[(size_t)z * w + x]] != "water";
+		}
+	blob.clear();
+	ch.vb_off = cook_put(blob, vb); ch.vb_n = (uint32_t)vb.size();
+	ch.ib_off = cook_put(blob, ib); ch.ib_n = (uint32_t)ib.size();
+	ch.col_off = cook_put(blob, col);
+	ch.walk_off = cook_put(blob, walk);
+	ch.mat_off = cook_put(blob, mat);
+	ch.inst_off = cook_put(blob, inst); ch.inst_n = (uint32_t)inst.size();
+}
+bool cook_export(const std::string& path) {
+	ProfScope ps("cook");
+	auto t0 = std::chrono::steady_clock::now();
+	// материалы и атлас - в главном потоке, текстуры живут на GPU
+	TidPalette pal = tid_palette_build();
+	// текстуры объектов - в той же таблице материалов, CookInst.tid ссылается на нее
+	for (const OBJ& o : OBJS) pal.get(o.tid.empty() ? std::string("default") : o.tid);
+	int nm = (int)pal.names.size(), cell = cook_set.cell;
+	int cols = std::max(1, (int)std::ceil(std::sqrt((double)nm))), rows = std::max(1, (nm + cols - 1) / cols);
+	Image atlas = GenImageColor(cols * cell, rows * cell, BLANK);
+	std::vector<CookMat> mats(nm);
+	for (int i = 0; i < nm; i++) {
+		Texture2D t = tex_get(pal.names[i]);
+		Image im;
+		if (t.id > 0) {
+			im = LoadImageFromTexture(t);
+			ImageResize(&im, cell, cell);
+		}
+		else im = GenImageColor(cell, cell, tex_avg_color(pal.names[i]));
+		Rectangle dst = { (float)(i % cols * cell), (float)(i / cols * cell), (float)cell, (float)cell };
+		ImageDraw(&atlas, im, { 0, 0, (float)cell, (float)cell }, dst, WHITE);
+		UnloadImage(im);
+		CookMat& m = mats[i];
+		strncpy(m.name, pal.names[i].c_str(), sizeof(m.name) - 1);
+		m.u0 = dst.x / atlas.width; m.v0 = dst.y / atlas.height;
+		m.u1 = (dst.x + cell) / atlas.width; m.v1 = (dst.y + cell) / atlas.height;
+	}
+	ImageFormat(&atlas, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+	size_t atlas_bytes = (size_t)atlas.width * atlas.height * 4;
+	uint64_t base_hash = hash64(mats.data(), mats.size() * sizeof(CookMat)) ^ hash64(&cook_set, sizeof(cook_set));
+	int nc = chunks_w() * chunks_h();
+	MappedFile old;
+	const CookChunk* otab = nullptr;
+	if (old.open(path) && old.size >= sizeof(CookHeader)) {
+		CookHeader oh;
+		memcpy(&oh, old.data, sizeof(oh));
+		if (memcmp(oh.magic, "SCK1", 4) == 0 && oh.version == 2 && oh.map_w == MAP_W && oh.map_h == MAP_H && oh.chunk == CHUNK && oh.chunks == (uint32_t)nc
+			&& oh.table_off + (uint64_t)nc * sizeof(CookChunk) <= old.size) otab = (const CookChunk*)(old.data + oh.table_off);
+	}
+	auto a64 = [](uint64_t v) { return (v + 63) & ~(uint64_t)63; };
+	CookHeader hd = {};
+	memcpy(hd.magic, "SCK1", 4);
+	hd.version = 2;
+	hd.map_w = MAP_W; hd.map_h = MAP_H; hd.chunk = CHUNK;
+	hd.chunks = nc; hd.mats = nm;
+	hd.atlas_w = atlas.width; hd.atlas_h = atlas.height;
+	hd.table_off = a64(sizeof(hd));
+	hd.mat_off = hd.table_off + (uint64_t)nc * sizeof(CookChunk);
+	hd.atlas_off = a64(hd.mat_off + mats.size() * sizeof(CookMat));
+	std::string tmp_path = path + ".tmp";
+	std::ofstream f(tmp_path, std::ios::binary | std::ios::trunc);
+	if (!f) { UnloadImage(atlas); return false; }
+	std::vector<CookChunk> tab(nc);
+	std::vector<char> zero(64, 0);
+	f.write((const char*)&hd, sizeof(hd));
+	f.write(zero.data(), hd.table_off - sizeof(hd));
+	f.write((const char*)tab.data(), tab.size() * sizeof(CookChunk));
+	f.write((const char*)mats.data(), mats.size() * sizeof(CookMat));
+	f.write(zero.data(), hd.atlas_off - (hd.mat_off + mats.size() * sizeof(CookMat)));
+	f.write((const char*)atlas.data, atlas_bytes);
+	UnloadImage(atlas);
+	uint64_t off = hd.atlas_off + atlas_bytes;
+	std::vector<std::vector<int>> ob = objs_by_chunk(OBJS, MAP_W, MAP_H);
+	std::atomic<int> reused = 0;
+	const int BATCH = 256;
+	std::vector<std::vector<unsigned char>> blobs;
+	for (int c0 = 0; c0 < nc; c0 += BATCH) {
+		int cn = std::min(BATCH, nc - c0);
+		blobs.assign(cn, {});
+		par_for(cn, [&](int a, int b) {
+			for (int k = a; k < b; k++) {
+				bool re = false;
+				int c = c0 + k;
+				cook_chunk(c, ob[c], pal, base_hash, otab ? &otab[c] : nullptr, old.data, old.size, tab[c], blobs[k], re);
+				if (re) reused++;
+			}
+		}, 1);
+		for (int k = 0; k < cn; k++) {
+			uint64_t al = a64(off);
+			f.write(zero.data(), al - off);
+			tab[c0 + k].off = al;
+			tab[c0 + k].size = (uint32_t)blobs[k].size();
+			f.write((const char*)blobs[k].data(), blobs[k].size());
+			off = al + blobs[k].size();
+		}
+	}
+	f.seekp(hd.table_off);
+	f.write((const char*)tab.data(), tab.size() * sizeof(CookChunk));
+	f.close();
+	old.close();
+	if (!f) return false;
+	std::error_code ec;
+	std::filesystem::rename(tmp_path, path, ec);
+	if (ec) return false;
+	cook_last.reused = reused;
+	cook_last.cooked = nc - reused;
+	cook_last.sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	TraceLog(LOG_INFO, "COOK: %s - %d chunks cooked, %d reused, %.1f MB in %.3f s", path.c_str(), cook_last.cooked, cook_last.reused, off / (1024.0 * 1024.0), cook_last.sec);
+	return true;
+}
+
+// ===== Экспорт рельефа в glTF (.glb): упрощённая сетка по чанкам с LOD =====
+// Упрощение - RTIN (прямоугольные треугольники на сетке 2^k + 1): ошибка каждой вершины считается один раз,
+// затем треугольник делится, пока ошибка середины гипотенузы больше порога. Сетка без T-стыков внутри чанка,
+// швы между чанками разных LOD закрываются юбками. Каждый LOD - отдельная сцена, сцена 0 - самая подробная
+struct GltfSet {
+	float err = 0.1f; // допустимая ошибка высоты LOD0
+	int lods = 3;
+	float lod_mul = 4.0f; // во сколько раз растёт ошибка на каждый следующий LOD
 };
-struct OBJ {
-	int id;
-	int tid;
-	int proch; // 0-100 прочность предмета. Подходит и для еды
-	Vector3 vec3; // x, Y(выс), z 
-	float pov; // поворот 
-	float razm; // размер
-	void (*onclck)(OBJ& self); // колбек на клик 
-	json j;
-	std::string anim; //потом заменить на нормальную анимацию объекта, а пока это просто текстуры по кадрам 1_3_5 (tid)
+GltfSet gltf_set;
+struct GltfStat {
+	std::vector<size_t> tris;
+	double sec = 0.0;
 };
-Vector3 playerPos = { 0.0f, 10.0f, 0.0f };
-std::vector<OBJ>OBJS;
-std::vector<Tile>tiles;
-TOOL ct;
-bool sjw = false;
-char jb[4096] = "{\n\tur json\n}";
-Tile* st = nullptr;
-OBJ* so = nullptr;
-int MAP_W = 1000;
-int MAP_H = 1000;
-int tool_s;
-int sc_idx;
-int act_idx;
-int foc_idx;
+GltfStat gltf_last;
+static_assert((CHUNK + 1) * (CHUNK + 1) + 8 * CHUNK < 65536, "индексы чанка в uint16");
 
-struct generator_set {
-	// 1. Общий масштаб (насколько всё крупное: и горы, и равнины)
-	float gen_frequency = 0.05f;  // Чем меньше, тем больше объекты
+// hgt - сетка (S + 1) x (S + 1), S - степень двойки; err - максимальная ошибка в поддереве каждой вершины
+void rtin_errors(const std::vector<float>& hgt, int S, std::vector<float>& err) {
+	int size = S + 1, nt = S * S * 2 - 2, np = nt - S * S;
+	err.assign((size_t)size * size, 0.0f);
+	std::vector<int> co((size_t)nt * 4);
+	for (int i = 0; i < nt; i++) {
+		int id = i + 2, ax = 0, ay = 0, bx = 0, by = 0, cx = 0, cy = 0;
+		if (id & 1) bx = by = cx = S;
+		else ax = ay = cy = S;
+		while ((id >>= 1) > 1) {
+			int mx = (ax + bx) >> 1, my = (ay + by) >> 1;
+			if (id & 1) { bx = ax; by = ay; ax = cx; ay = cy; }
+			else { ax = bx; ay = by; bx = cx; by = cy; }
+			cx = mx; cy = my;
+		}
+		co[i * 4] = ax; co[i * 4 + 1] = ay; co[i * 4 + 2] = bx; co[i * 4 + 3] = by;
+	}
+	for (int i = nt - 1; i >= 0; i--) {
+		int ax = co[i * 4], ay = co[i * 4 + 1], bx = co[i * 4 + 2], by = co[i * 4 + 3];
+		int mx = (ax + bx) >> 1, my = (ay + by) >> 1;
+		int cx = mx + my - ay, cy = my + ax - mx;
+		int mid = my * size + mx;
+		float e = std::fabs((hgt[ay * size + ax] + hgt[by * size + bx]) * 0.5f - hgt[mid]);
+		err[mid] = std::max(err[mid], e);
+		if (i < np) {
+			int l = ((ay + cy) >> 1) * size + ((ax + cx) >> 1);
+			int r = ((by + cy) >> 1) * size + ((bx + cx) >> 1);
+			err[mid] = std::max({ err[mid], err[l], err[r] });
+		}
+	}
+}
+void rtin_tri(const std::vector<float>& err, int size, float max_err, int ax, int ay, int bx, int by, int cx, int cy, std::vector<int>& out) {
+	int mx = (ax + bx) >> 1, my = (ay + by) >> 1;
+	if (std::abs(ax - cx) + std::abs(ay - cy) > 1 && err[my * size + mx] > max_err) {
+		rtin_tri(err, size, max_err, cx, cy, ax, ay, mx, my, out);
+		rtin_tri(err, size, max_err, bx, by, cx, cy, mx, my, out);
+		return;
+	}
+	out.insert(out.end(), { ay * size + ax, by * size + bx, cy * size + cx });
+}
+// Треугольники как тройки индексов сетки, обход против часовой при взгляде сверху (+Y)
+void rtin_mesh(const std::vector<float>& err, int S, float max_err, std::vector<int>& out) {
+	out.clear();
+	rtin_tri(err, S + 1, max_err, 0, 0, S, S, S, 0, out);
+	rtin_tri(err, S + 1, max_err, S, S, 0, 0, 0, S, out);
+}
 
-	// 2. Интенсивность высот (насколько горы высокие)
-	float gen_amplitude = 15.0f;
+struct GltfMesh {
+	std::vector<float> pos, nrm;
+	std::vector<uint8_t> col;
+	std::vector<uint16_t> idx;
+	float mn[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, mx[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+};
+// Позиции относительно угла чанка; неполный чанк у края карты вписывается в сетку 2^k прижатием координат
+void gltf_chunk(int c, const std::vector<Color>& pal_col, const TidPalette& pal, std::vector<GltfMesh>& lods) {
+	DirtyRect d = chunk_rect(c);
+	int w = d.x1 - d.x0, h = d.z1 - d.z0, S = 1;
+	while (S < std::max(w, h)) S <<= 1;
+	int size = S + 1;
+	std::vector<float> hgt((size_t)size * size);
+	for (int z = 0; z < size; z++)
+		for (int x = 0; x < size; x++) hgt[(size_t)z * size + x] = GetVertexHeight(d.x0 + std::min(x, w), d.z0 + std::min(z, h));
+	std::vector<float> err;
+	rtin_errors(hgt, S, err);
+	std::vector<int> tris, remap;
+	for (int l = 0; l < (int)lods.size(); l++) {
+		float max_err = gltf_set.err * std::pow(gltf_set.lod_mul, (float)l);
+		rtin_mesh(err, S, max_err, tris);
+		GltfMesh& m = lods[l];
+		remap.assign((size_t)size * size, -1);
+		auto vert = [&](int gx, int gz, float dy) -> uint16_t {
+			int px = d.x0 + gx, pz = d.z0 + gz;
+			Vector3 n = Vector3Normalize({ GetVertexHeight(px - 1, pz) - GetVertexHeight(px + 1, pz), 2.0f, GetVertexHeight(px, pz - 1) - GetVertexHeight(px, pz + 1) });
+			float p[3] = { (float)gx, hgt[(size_t)gz * size + gx] - dy, (float)gz };
+			for (int k = 0; k < 3; k++) { m.mn[k] = std::min(m.mn[k], p[k]); m.mx[k] = std::max(m.mx[k], p[k]); }
+			m.pos.insert(m.pos.end(), p, p + 3);
+			m.nrm.insert(m.nrm.end(), { n.x, n.y, n.z });
+			Color cl = pal_col[pal.idx.find(tiles[(size_t)std::min(pz, MAP_H - 1) * MAP_W + std::min(px, MAP_W - 1)].tid)->second];
+			m.col.insert(m.col.end(), { cl.r, cl.g, cl.b, 255 });
+			return (uint16_t)(m.pos.size() / 3 - 1);
+		};
+		auto idx = [&](int g, int& gx, int& gz) -> uint16_t {
+			gx = std::min(g % size, w); gz = std::min(g / size, h);
+			int k = gz * size + gx;
+			if (remap[k] < 0) remap[k] = vert(gx, gz, 0.0f);
+			return (uint16_t)remap[k];
+		};
+		float skirt = std::max(max_err * gltf_set.lod_mul, 0.1f) * 2.0f;
+		for (size_t t = 0; t < tris.size(); t += 3) {
+			int x[3], z[3];
+			uint16_t v[3];
+			for (int k = 0; k < 3; k++) v[k] = idx(tris[t + k], x[k], z[k]);
+			// прижатые к краю треугольники вырождаются - пропускаем
+			if ((x[1] - x[0]) * (z[2] - z[0]) - (x[2] - x[0]) * (z[1] - z[0]) == 0) continue;
+			m.idx.insert(m.idx.end(), v, v + 3);
+			// юбка вниз под каждым ребром на границе чанка, лицом наружу
+			for (int k = 0; k < 3; k++) {
+				int a = k, b = (k + 1) % 3;
+				bool edge = (x[a] == x[b] && (x[a] == 0 || x[a] == w)) || (z[a] == z[b] && (z[a] == 0 || z[a] == h));
+				if (!edge) continue;
+				uint16_t pa = vert(x[a], z[a], skirt), pb = vert(x[b], z[b], skirt);
+				m.idx.insert(m.idx.end(), { v[b], v[a], pa, v[b], pa, pb });
+			}
+		}
+	}
+}
+bool gltf_export(const std::string& path) {
+	ProfScope ps("gltf");
+	auto t0 = std::chrono::steady_clock::now();
+	TidPalette pal = tid_palette_build();
+	std::vector<Color> pal_col;
+	for (auto& n : pal.names) pal_col.push_back(tex_avg_color(n));
+	int nc = chunks_w() * chunks_h(), nl = std::max(1, gltf_set.lods);
+	std::vector<std::vector<GltfMesh>> meshes(nc, std::vector<GltfMesh>(nl));
+	par_for(nc, [&](int a, int b) {
+		for (int c = a; c < b; c++) gltf_chunk(c, pal_col, pal, meshes[c]);
+	}, 4);
 
-	// 3. Порог гор (при каком значении биома начинаются горы)
-	float gen_mountain_cutoff = 0.7f;
+	// cgltf ссылается на всё указателями - массивы размечаются заранее и не растут
+	size_t nm = (size_t)nc * nl;
+	std::vector<cgltf_buffer_view> views(nm * 4);
+	std::vector<cgltf_accessor> accs(nm * 4);
+	std::vector<cgltf_attribute> attrs(nm * 3);
+	std::vector<cgltf_primitive> prims(nm);
+	std::vector<cgltf_mesh> gmeshes(nm);
+	std::vector<cgltf_node> nodes(nm);
+	std::vector<std::vector<cgltf_node*>> roots(nl);
+	std::vector<cgltf_scene> scenes(nl);
+	std::vector<std::string> names(nm), extras(nm), scene_names(nl);
+	char a_pos[] = "POSITION", a_nrm[] = "NORMAL", a_col[] = "COLOR_0", gen[] = "SmapCr", ver[] = "2.0", mat_name[] = "terrain";
+	cgltf_buffer buf = {};
+	cgltf_material mat = {};
+	mat.name = mat_name;
+	mat.has_pbr_metallic_roughness = true;
+	mat.pbr_metallic_roughness.base_color_factor[0] = mat.pbr_metallic_roughness.base_color_factor[1] = 1.0f;
+	mat.pbr_metallic_roughness.base_color_factor[2] = mat.pbr_metallic_roughness.base_color_factor[3] = 1.0f;
+	mat.pbr_metallic_roughness.metallic_factor = 0.0f;
+	mat.pbr_metallic_roughness.roughness_factor = 1.0f;
+	std::vector<unsigned char> bin;
+	gltf_last.tris.assign(nl, 0);
+	size_t nv = 0, na = 0, nat = 0, np = 0;
+	auto put = [&](const void* p, size_t bytes, cgltf_buffer_view_type type) {
+		bin.resize((bin.size() + 3) & ~(size_t)3);
+		cgltf_buffer_view& v = views[nv++];
+		v.buffer = &buf;
+		v.offset = bin.size();
+		v.size = bytes;
+		v.type = type;
+		bin.insert(bin.end(), (const unsigned char*)p, (const unsigned char*)p + bytes);
+		return &v;
+	};
+	auto acc = [&](cgltf_buffer_view* v, cgltf_component_type ct, cgltf_type t, size_t count, bool norm) {
+		cgltf_accessor& a = accs[na++];
+		a.buffer_view = v;
+		a.component_type = ct;
+		a.type = t;
+		a.count = count;
+		a.normalized = norm;
+		return &a;
+	};
+	for (int l = 0; l < nl; l++) {
+		for (int c = 0; c < nc; c++) {
+			GltfMesh& m = meshes[c][l];
+			if (m.idx.empty()) continue;
+			size_t vc = m.pos.size() / 3;
+			cgltf_accessor* ap = acc(put(m.pos.data(), m.pos.size() * 4, cgltf_buffer_view_type_vertices), cgltf_component_type_r_32f, cgltf_type_vec3, vc, false);
+			ap->has_min = ap->has_max = true;
+			memcpy(ap->min, m.mn, sizeof(m.mn));
+			memcpy(ap->max, m.mx, sizeof(m.mx));
+			cgltf_accessor* an = acc(put(m.nrm.data(), m.nrm.size() * 4, cgltf_buffer_view_type_vertices), cgltf_component_type_r_32f, cgltf_type_vec3, vc, false);
+			cgltf_accessor* ac = acc(put(m.col.data(), m.col.size(), cgltf_buffer_view_type_vertices), cgltf_component_type_r_8u, cgltf_type_vec4, vc, true);
+			cgltf_accessor* ai = acc(put(m.idx.data(), m.idx.size() * 2, cgltf_buffer_view_type_indices), cgltf_component_type_r_16u, cgltf_type_scalar, m.idx.size(), false);
+			gltf_last.tris[l] += m.idx.size() / 3;
+			cgltf_attribute* at = &attrs[nat];
+			at[0] = { a_pos, cgltf_attribute_type_position, 0, ap };
+			at[1] = { a_nrm, cgltf_attribute_type_normal, 0, an };
+			at[2] = { a_col, cgltf_attribute_type_color, 0, ac };
+			nat += 3;
+			cgltf_primitive& pr = prims[np];
+			pr.type = cgltf_primitive_type_triangles;
+			pr.indices = ai;
+			pr.material = &mat;
+			pr.attributes = at;
+			pr.attributes_count = 3;
+			DirtyRect d = chunk_rect(c);
+			names[np] = "chunk_" + std::to_string(c % chunks_w()) + "_" + std::to_string(c / chunks_w()) + "_lod" + std::to_string(l);
+			extras[np] = "{\"chunk\":[" + std::to_string(c % chunks_w()) + "," + std::to_string(c / chunks_w()) + "],\"lod\":" + std::to_string(l)
+				+ ",\"max_error\":" + std::to_string(gltf_set.err * std::pow(gltf_set.lod_mul, (float)l)) + "}";
+			cgltf_mesh& gm = gmeshes[np];
+			gm.name = names[np].data();
+			gm.primitives = &pr;
+			gm.primitives_count = 1;
+			cgltf_node& nd = nodes[np];
+			nd.name = names[np].data();
+			nd.mesh = &gm;
+			nd.has_translation = true;
+			nd.translation[0] = (float)d.x0;
+			nd.translation[2] = (float)d.z0;
+			nd.extras.data = extras[np].data();
+			roots[l].push_back(&nd);
+			np++;
+		}
+		scene_names[l] = "LOD" + std::to_string(l);
+		scenes[l].name = scene_names[l].data();
+		scenes[l].nodes = roots[l].data();
+		scenes[l].nodes_count = roots[l].size();
+	}
+	meshes.clear();
+	buf.size = bin.size();
+	cgltf_data data = {};
+	data.asset.generator = gen;
+	data.asset.version = ver;
+	data.buffers = &buf;
+	data.buffers_count = 1;
+	data.buffer_views = views.data();
+	data.buffer_views_count = nv;
+	data.accessors = accs.data();
+	data.accessors_count = na;
+	data.materials = &mat;
+	data.materials_count = 1;
+	data.meshes = gmeshes.data();
+	data.meshes_count = np;
+	data.nodes = nodes.data();
+	data.nodes_count = np;
+	data.scenes = scenes.data();
+	data.scenes_count = nl;
+	data.scene = &scenes[0];
+	data.bin = bin.data();
+	data.bin_size = bin.size();
+	cgltf_options opt = {};
+	opt.type = cgltf_file_type_glb;
+	if (cgltf_write_file(&opt, path.c_str(), &data) != cgltf_result_success) return false;
+	gltf_last.sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	std::string lt;
+	for (int l = 0; l < nl; l++) lt += TextFormat(" %zu", gltf_last.tris[l]);
+	TraceLog(LOG_INFO, "GLTF: %s - triangles per LOD:%s (full grid %lld), %.3f s", path.c_str(), lt.c_str(), (long long)MAP_W * MAP_H * 2, gltf_last.sec);
+	return true;
+}
 
-	// 4. Кривизна (экспонента для холмов, делает их пологими или резкими)
-	float gen_hill_exp = 2.0f;
+// Пустая строка - пользователь отменил
+std::string file_dialog(bool save, const char* name, const char* spec, const char* def_name = nullptr) {
+	nfdu8filteritem_t flt = { name, spec };
+	nfdu8char_t* out = nullptr;
+	nfdresult_t res = save ? NFD_SaveDialogU8(&out, &flt, 1, nullptr, def_name) : NFD_OpenDialogU8(&out, &flt, 1, nullptr);
+	if (res != NFD_OKAY) return std::string();
+	std::string p = out;
+	NFD_FreePathU8(out);
+	return p;
+}
 
-	// 5. Сила искривления рек (насколько они "пьяные")
-	float gen_river_warp = 10.0f;
-	float gen_scale = 0.02f;      // Масштаб всего (меньше = больше объектов)
-	float gen_roughness = 0.5f;   // Насколько поверхность "шершавая"
-	float gen_lacunarity = 2.0f;  // Детализация между слоями
-	float gen_distort = 4.0f;     // Сила искривления (убирает параллельность)
-	float gen_octaves = 4;
+// ===== Кисти: скульпт высот и покраска tid/bid =====
+enum BRUSH_MODE { BR_RAISE, BR_LOWER, BR_SMOOTH, BR_FLATTEN, BR_NOISE, BR_PAINT, BR_BIOME };
+enum BRUSH_FALLOFF { BF_LINEAR, BF_SMOOTH, BF_SPHERE, BF_CONST };
+struct Brush {
+	int mode = BR_RAISE;
+	int falloff = BF_SMOOTH;
+	float radius = 10.0f; // в тайлах
+	float strength = 5.0f; // высоты в секунду для скульпта
+	float flat_h = 0.0f; // высота для FLATTEN, берется в начале мазка
+	int biome = 1;
+	std::string tid = "grass";
 };
-generator_set g_set;
-float GetVertexHeight(int x, int z) {
-	if (x < 0 || x >= MAP_W || z < 0 || z >= MAP_H) return 0.0f;
-	return (float)tiles[z * MAP_W + x].h;
+Brush brush;
+bool brush_stroke = false; // мазок начат над рельефом и открыл шаг undo
+std::vector<float> brush_tmp;
+float smooth_noise(float x, float z);
+
+// d - расстояние до центра в долях радиуса [0, 1]
+float brush_falloff(int f, float d) {
+	switch (f) {
+	case BF_LINEAR: return 1.0f - d;
+	case BF_SMOOTH: { float t = 1.0f - d; return t * t * (3.0f - 2.0f * t); }
+	case BF_SPHERE: return std::sqrt(std::max(0.0f, 1.0f - d * d));
+	default: return 1.0f;
+	}
 }
-float GetInterpolatedHeight(float x, float z) {
-	int x0 = (int)std::floor(x);
-	int z0 = (int)std::floor(z);
-	float h00 = GetVertexHeight(x0, z0);
-	float h10 = GetVertexHeight(x0 + 1, z0);
-	float h01 = GetVertexHeight(x0, z0 + 1);
-	float h11 = GetVertexHeight(x0 + 1, z0 + 1);
-	float sx = x - (float)x0;
-	float sz = z - (float)z0;
-	float lerpTop = h00 + sx * (h10 - h00);
-	float lerpBottom = h01 + sx * (h11 - h01);
-	return lerpTop + sz * (lerpBottom - lerpTop);
+DirtyRect brush_rect(const Brush& b, float cx, float cz) {
+	DirtyRect r;
+	r.x0 = std::max(0, (int)std::floor(cx - b.radius));
+	r.z0 = std::max(0, (int)std::floor(cz - b.radius));
+	r.x1 = std::min(MAP_W, (int)std::ceil(cx + b.radius) + 1);
+	r.z1 = std::min(MAP_H, (int)std::ceil(cz + b.radius) + 1);
+	return r;
+}
+// Один шаг мазка с центром (cx, cz); строки прямоугольника обрабатываются параллельно
+DirtyRect brush_apply(const Brush& b, float cx, float cz, float dt) {
+	DirtyRect r = brush_rect(b, cx, cz);
+	if (r.empty()) return r;
+	undo_touch(r);
+	int w = r.x1 - r.x0;
+	float inv_r = 1.0f / std::max(b.radius, 0.5f);
+	float k = b.strength * dt;
+	if (b.mode == BR_SMOOTH) {
+		// исходные высоты с рамкой в 1 тайл, чтобы соседние строки не читали уже сглаженное
+		brush_tmp.resize((size_t)(w + 2) * (r.z1 - r.z0 + 2));
+		par_for(r.z1 - r.z0 + 2, [&](int a, int bb) {
+			for (int j = a; j < bb; j++)
+				for (int i = 0; i < w + 2; i++)
+					brush_tmp[(size_t)j * (w + 2) + i] = GetVertexHeight(r.x0 + i - 1, r.z0 + j - 1);
+		});
+	}
+	par_for(r.z1 - r.z0, [&](int a, int bb) {
+		for (int j = a; j < bb; j++) {
+			int z = r.z0 + j;
+			Tile* row = &tiles[(size_t)z * MAP_W];
+			for (int x = r.x0; x < r.x1; x++) {
+				float dx = x - cx, dz = z - cz;
+				float d = std::sqrt(dx * dx + dz * dz) * inv_r;
+				if (d > 1.0f) continue;
+				float f = brush_falloff(b.falloff, d);
+				Tile& t = row[x];
+				switch (b.mode) {
+				case BR_RAISE: t.h += k * f; break;
+				case BR_LOWER: t.h -= k * f; break;
+				case BR_SMOOTH: {
+					const float* s = &brush_tmp[(size_t)j * (w + 2) + (x - r.x0)];
+					size_t st2 = (size_t)(w + 2);
+					float avg = (s[0] + s[1] + s[2] + s[st2] + s[st2 + 1] + s[st2 + 2] + s[2 * st2] + s[2 * st2 + 1] + s[2 * st2 + 2]) / 9.0f;
+					t.h += (avg - t.h) * std::min(1.0f, k * 0.2f * f);
+					break;
+				}
+				case BR_FLATTEN: t.h += (b.flat_h - t.h) * std::min(1.0f, k * 0.2f * f); break;
+				case BR_NOISE: t.h += (smooth_noise(x * 0.3f, z * 0.3f) - 0.5f) * 2.0f * k * f; break;
+				case BR_PAINT: if (f > 0.0f) t.tid = b.tid; break;
+				case BR_BIOME: if (f > 0.0f) t.bid = b.biome; break;
+				}
+			}
+		}
+	}, 8);
+	map_changed(r.x0, r.z0, r.x1, r.z1);
+	return r;
+}
+// ===== Заливка и волшебная палочка: сканлайн по сетке тайлов =====
+enum FILL_KEY { FK_TEXTURE, FK_BIOME, FK_HEIGHT };
+struct FillParams {
+	int key = FK_TEXTURE;
+	float tol = 0.5f; // допуск по высоте для FK_HEIGHT
+};
+FillParams fill_p;
+bool fill_mode = false; // TILE: клик заливает область вместо мазка
+int sel_mode = 0; // SELECT: 0 - один тайл, 1 - волшебная палочка, 2 - прямоугольник, 3 - лассо
+// Битовая маска тайлов карты
+struct TileMask {
+	int w = 0, h = 0;
+	std::vector<unsigned long long> bits;
+	void reset(int W, int H) { w = W; h = H; bits.assign(((size_t)W * H + 63) / 64, 0); }
+	bool get(int x, int z) const { size_t i = (size_t)z * w + x; return (bits[i >> 6] >> (i & 63)) & 1; }
+	void set(int x, int z) { size_t i = (size_t)z * w + x; bits[i >> 6] |= 1ull << (i & 63); }
+	void clr(int x, int z) { size_t i = (size_t)z * w + x; bits[i >> 6] &= ~(1ull << (i & 63)); }
+	// [x0, x1) строки z целыми словами где возможно; on - ставить или снимать
+	void span(int z, int x0, int x1, bool on) {
+		size_t a = (size_t)z * w + x0, b = (size_t)z * w + x1;
+		while (a < b && (a & 63)) { on ? bits[a >> 6] |= 1ull << (a & 63) : bits[a >> 6] &= ~(1ull << (a & 63)); a++; }
+		for (; a + 64 <= b; a += 64) bits[a >> 6] = on ? ~0ull : 0ull;
+		for (; a < b; a++) on ? bits[a >> 6] |= 1ull << (a & 63) : bits[a >> 6] &= ~(1ull << (a & 63));
+	}
+};
+bool fill_match(const FillParams& p, const Tile& seed_t, const Tile& t) {
+	switch (p.key) {
+	case FK_TEXTURE: return t.tid == seed_t.tid;
+	case FK_BIOME: return t.bid == seed_t.bid;
+	default: return std::fabs(t.h - seed_t.h) <= p.tol;
+	}
+}
+// Сканлайн без рекурсии: в стеке только затравки отрезков. Результат в out, возвращает bbox
+DirtyRect fill_region(int sx, int sz, const FillParams& p, TileMask& out) {
+	DirtyRect bb;
+	out.reset(MAP_W, MAP_H);
+	if (sx < 0 || sz < 0 || sx >= MAP_W || sz >= MAP_H) return bb;
+	const Tile seed_t = tiles[(size_t)sz * MAP_W + sx];
+	bb = { sx, sz, sx + 1, sz + 1 };
+	std::vector<std::pair<int, int>> stack;
+	stack.push_back({ sx, sz });
+	while (!stack.empty()) {
+		auto [x, z] = stack.back();
+		stack.pop_back();
+		if (out.get(x, z)) continue;
+		const Tile* row = &tiles[(size_t)z * MAP_W];
+		int l = x, r = x;
+		while (l > 0 && !out.get(l - 1, z) && fill_match(p, seed_t, row[l - 1])) l--;
+		while (r < MAP_W - 1 && !out.get(r + 1, z) && fill_match(p, seed_t, row[r + 1])) r++;
+		for (int i = l; i <= r; i++) out.set(i, z);
+		bb.x0 = std::min(bb.x0, l); bb.x1 = std::max(bb.x1, r + 1);
+		bb.z0 = std::min(bb.z0, z); bb.z1 = std::max(bb.z1, z + 1);
+		// соседние строки: одна затравка на каждый подходящий отрезок
+		for (int nz = z - 1; nz <= z + 1; nz += 2) {
+			if (nz < 0 || nz >= MAP_H) continue;
+			const Tile* nrow = &tiles[(size_t)nz * MAP_W];
+			bool in = false;
+			for (int i = l; i <= r; i++) {
+				bool ok = !out.get(i, nz) && fill_match(p, seed_t, nrow[i]);
+				if (ok && !in) stack.push_back({ i, nz });
+				in = ok;
+			}
+		}
+	}
+	return bb;
 }
-void DrawMap(Camera3D camera) {
+TileMask sel_tiles;
+DirtyRect sel_bb;
+
+// Подсветка отмеченных тайлов в видимой области
+void DrawTileMask(const TileMask& m, const DirtyRect& bb, Camera3D camera) {
+	if (m.bits.empty() || bb.empty() || m.w != MAP_W) return;
 	int viewDist = (int)(camera.fovy * 1.5f);
+	int x0 = std::max(bb.x0, (int)camera.target.x - viewDist), x1 = std::min(bb.x1, (int)camera.target.x + viewDist);
+	int z0 = std::max(bb.z0, (int)camera.target.z - viewDist), z1 = std::min(bb.z1, (int)camera.target.z + viewDist);
+	rlBegin(RL_QUADS);
+	rlColor4ub(255, 220, 0, 90);
+	for (int z = z0; z < z1; z++) {
+		for (int x = x0; x < x1; x++) {
+			if (!m.get(x, z)) continue;
+			rlVertex3f((float)x, GetVertexHeight(x, z) + 0.03f, (float)z);
+			rlVertex3f((float)x, GetVertexHeight(x, z + 1) + 0.03f, (float)z + 1.0f);
+			rlVertex3f((float)x + 1.0f, GetVertexHeight(x + 1, z + 1) + 0.03f, (float)z + 1.0f);
+			rlVertex3f((float)x + 1.0f, GetVertexHeight(x + 1, z) + 0.03f, (float)z);
+		}
+	}
+	rlEnd();
+}
+// Заливка выделенной области текущей кистью (tid или bid)
+void fill_apply(const TileMask& m, const DirtyRect& bb, const Brush& b) {
+	if (bb.empty()) return;
+	undo_begin();
+	undo_touch(bb);
+	par_for(bb.z1 - bb.z0, [&](int a, int c) {
+		for (int z = bb.z0 + a; z < bb.z0 + c; z++) {
+			for (int x = bb.x0; x < bb.x1; x++) {
+				if (!m.get(x, z)) continue;
+				Tile& t = tiles[(size_t)z * MAP_W + x];
+				if (b.mode == BR_BIOME) t.bid = b.biome;
+				else t.tid = b.tid;
+			}
+		}
+	});
+	map_changed(bb.x0, bb.z0, bb.x1, bb.z1);
+	undo_end();
+}
+// ===== Мультивыделение SELECT: тайлы - битовая маска, объекты - набор OBJ::id =====
+enum SEL_OP { SO_REPLACE, SO_ADD, SO_SUB };
+std::unordered_set<int> sel_objs;
+std::vector<Vector2> sel_lasso; // точки лассо (x, z)
+Vector2 sel_drag0 = { 0 };
+bool sel_dragging = false;
 
-	int startX = (int)camera.target.x - viewDist;
-	int endX = (int)camera.target.x + viewDist;
-	int startZ = (int)camera.target.z - viewDist;
-	int endZ = (int)camera.target.z + viewDist;
-	startX = std::max(0, startX);
-	endX = std::min(MAP_W - 1, endX);
-	startZ = std::max(0, startZ);
-	endZ = std::min(MAP_H - 1, endZ);
+void sel_clear() {
+	sel_tiles.reset(MAP_W, MAP_H);
+	sel_bb = DirtyRect();
+	sel_objs.clear();
+}
+// Окно подкачки сдвинулось на (dx, dz) тайлов; ушедшее за край из выделения выпадает
+void sel_shift(int dx, int dz) {
+	for (Vector2& p : sel_lasso) { p.x -= dx; p.y -= dz; }
+	sel_drag0.x -= dx;
+	sel_drag0.y -= dz;
+	for (auto it = sel_objs.begin(); it != sel_objs.end();) it = obj_find(*it) < 0 ? sel_objs.erase(it) : std::next(it);
+	if (sel_tiles.w != MAP_W || sel_tiles.h != MAP_H || sel_bb.empty()) {
+		sel_tiles.reset(MAP_W, MAP_H);
+		sel_bb = DirtyRect();
+		return;
+	}
+	TileMask m;
+	m.reset(MAP_W, MAP_H);
+	DirtyRect nb = { std::max(0, sel_bb.x0 - dx), std::max(0, sel_bb.z0 - dz), std::min(MAP_W, sel_bb.x1 - dx), std::min(MAP_H, sel_bb.z1 - dz) };
+	DirtyRect bb;
+	for (int z = nb.z0; z < nb.z1; z++)
+		for (int x = nb.x0; x < nb.x1; x++)
+			if (sel_tiles.get(x + dx, z + dz)) {
+				m.set(x, z);
+				if (bb.empty()) bb = { x, z, x + 1, z + 1 };
+				else bb = { std::min(bb.x0, x), std::min(bb.z0, z), std::max(bb.x1, x + 1), std::max(bb.z1, z + 1) };
+			}
+	sel_tiles = std::move(m);
+	sel_bb = bb;
+}
+int sel_op_from_keys() {
+	if (IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT)) return SO_ADD;
+	if (IsKeyDown(KEY_LEFT_ALT) || IsKeyDown(KEY_RIGHT_ALT)) return SO_SUB;
+	return SO_REPLACE;
+}
+void sel_begin(int op) {
+	if (op == SO_REPLACE || sel_tiles.w != MAP_W || sel_tiles.h != MAP_H) sel_clear();
+}
+void sel_grow_bb(const DirtyRect& r) {
+	if (sel_bb.empty()) sel_bb = r;
+	else sel_bb = { std::min(sel_bb.x0, r.x0), std::min(sel_bb.z0, r.z0), std::max(sel_bb.x1, r.x1), std::max(sel_bb.z1, r.z1) };
+}
+// Маска m (например, результат палочки) в выделение
+void sel_combine(const TileMask& m, const DirtyRect& bb, int op) {
+	sel_begin(op);
+	if (bb.empty()) return;
+	size_t w0 = ((size_t)bb.z0 * MAP_W + bb.x0) >> 6, w1 = (((size_t)(bb.z1 - 1) * MAP_W + bb.x1) >> 6) + 1;
+	for (size_t i = w0; i < w1 && i < m.bits.size(); i++) {
+		if (op == SO_SUB) sel_tiles.bits[i] &= ~m.bits[i];
+		else sel_tiles.bits[i] |= m.bits[i];
+	}
+	if (op != SO_SUB) sel_grow_bb(bb);
+}
+void sel_rect(int x0, int z0, int x1, int z1, int op) {
+	sel_begin(op);
+	DirtyRect r = { std::max(0, std::min(x0, x1)), std::max(0, std::min(z0, z1)), std::min(MAP_W, std::max(x0, x1) + 1), std::min(MAP_H, std::max(z0, z1) + 1) };
+	if (r.empty()) return;
+	// строки в разных словах маски не пересекаются только при ширине карты кратной 64, поэтому без потоков
+	for (int z = r.z0; z < r.z1; z++) sel_tiles.span(z, r.x0, r.x1, op != SO_SUB);
+	if (op != SO_SUB) sel_grow_bb(r);
+	oix_rect((float)r.x0, (float)r.z0, (float)r.x1, (float)r.z1, [&](int i) {
+		if (op == SO_SUB) sel_objs.erase(OBJS[i].id);
+		else sel_objs.insert(OBJS[i].id);
+	});
+}
+bool point_in_poly(const std::vector<Vector2>& poly, float x, float z) {
+	bool in = false;
+	for (size_t i = 0, j = poly.size() - 1; i < poly.size(); j = i++) {
+		if ((poly[i].y > z) != (poly[j].y > z) && x < (poly[j].x - poly[i].x) * (z - poly[i].y) / (poly[j].y - poly[i].y) + poly[i].x) in = !in;
+	}
+	return in;
+}
+// Лассо: растеризация многоугольника по центрам тайлов, чет-нечет по пересечениям строки
+void sel_poly(const std::vector<Vector2>& poly, int op) {
+	sel_begin(op);
+	if (poly.size() < 3) return;
+	float mnx = FLT_MAX, mnz = FLT_MAX, mxx = -FLT_MAX, mxz = -FLT_MAX;
+	for (const Vector2& p : poly) { mnx = std::min(mnx, p.x); mxx = std::max(mxx, p.x); mnz = std::min(mnz, p.y); mxz = std::max(mxz, p.y); }
+	DirtyRect r = { std::max(0, (int)mnx), std::max(0, (int)mnz), std::min(MAP_W, (int)mxx + 1), std::min(MAP_H, (int)mxz + 1) };
+	if (r.empty()) return;
+	std::vector<float> xs;
+	for (int z = r.z0; z < r.z1; z++) {
+		float cz = z + 0.5f;
+		xs.clear();
+		for (size_t i = 0, j = poly.size() - 1; i < poly.size(); j = i++) {
+			const Vector2& a = poly[i];
+			const Vector2& b = poly[j];
+			if ((a.y > cz) != (b.y > cz)) xs.push_back(a.x + (cz - a.y) * (b.x - a.x) / (b.y - a.y));
+		}
+		std::sort(xs.begin(), xs.end());
+		for (size_t k = 0; k + 1 < xs.size(); k += 2) {
+			int xa = std::max(r.x0, (int)std::ceil(xs[k] - 0.5f)), xb = std::min(r.x1, (int)std::ceil(xs[k + 1] - 0.5f));
+			if (xa < xb) sel_tiles.span(z, xa, xb, op != SO_SUB);
+		}
+	}
+	if (op != SO_SUB) sel_grow_bb(r);
+	oix_rect(mnx, mnz, mxx, mxz, [&](int i) {
+		if (!point_in_poly(poly, OBJS[i].vec3.x, OBJS[i].vec3.z)) return;
+		if (op == SO_SUB) sel_objs.erase(OBJS[i].id);
+		else sel_objs.insert(OBJS[i].id);
+	});
+}
+// Индексы выбранных объектов (проход по OBJS параллельно)
+std::vector<int> sel_obj_indices() {
+	std::vector<int> out;
+	if (sel_objs.empty()) return out;
+	std::vector<char> hit(OBJS.size());
+	par_for((int)OBJS.size(), [&](int a, int b) {
+		for (int i = a; i < b; i++) hit[i] = sel_objs.count(OBJS[i].id) ? 1 : 0;
+	}, 4096);
+	for (int i = 0; i < (int)OBJS.size(); i++) if (hit[i]) out.push_back(i);
+	return out;
+}
+// Применяет fn ко всем выделенным тайлам, строки параллельно; шаг undo открывает вызывающий
+template <class F> void sel_for_tiles(F&& fn) {
+	if (sel_bb.empty() || sel_tiles.w != MAP_W) return;
+	undo_touch(sel_bb);
+	par_for(sel_bb.z1 - sel_bb.z0, [&](int a, int b) {
+		for (int z = sel_bb.z0 + a; z < sel_bb.z0 + b; z++)
+			for (int x = sel_bb.x0; x < sel_bb.x1; x++)
+				if (sel_tiles.get(x, z)) fn(tiles[(size_t)z * MAP_W + x]);
+	}, 8);
+	map_changed(sel_bb.x0, sel_bb.z0, sel_bb.x1, sel_bb.z1);
+}
+// Каждая операция выделения - один шаг undo вместе с объектами
+void sel_raise(float dh) {
+	undo_begin();
+	sel_for_tiles([dh](Tile& t) { t.h += dh; });
+	for (int i : sel_obj_indices()) {
+		undo_obj_touch(OBJS[i].id);
+		obj_move(i, { OBJS[i].vec3.x, OBJS[i].vec3.y + dh, OBJS[i].vec3.z });
+	}
+	undo_end();
+}
+// Свойство из JSON: ключи сливаются в j тайлов и объектов
+void sel_set_prop(const json& patch) {
+	if (!patch.is_object()) return;
+	undo_begin();
+	sel_for_tiles([&patch](Tile& t) {
+		if (!t.j.is_object()) t.j = json::object();
+		t.j.update(patch);
+	});
+	for (int i : sel_obj_indices()) {
+		undo_obj_touch(OBJS[i].id);
+		if (!OBJS[i].j.is_object()) OBJS[i].j = json::object();
+		OBJS[i].j.update(patch);
+	}
+	undo_end();
+}
+void sel_delete() {
+	undo_begin();
+	sel_for_tiles([](Tile& t) { t = Tile(); });
+	std::vector<int> ids = sel_obj_indices();
+	// с конца, чтобы swap-удаление не трогало еще не удаленные индексы
+	for (int k = (int)ids.size() - 1; k >= 0; k--) {
+		undo_obj_touch(OBJS[ids[k]].id);
+		obj_remove(ids[k]);
+	}
+	undo_end();
+	sel_objs.clear();
+}
+// Перенос тайлов выделения: map(x, z) -> новая позиция. Источники очищаются, маска переезжает вместе с тайлами
+template <class M> void sel_remap(M&& map, float rot_deg) {
+	if (sel_bb.empty() || sel_tiles.w != MAP_W) return;
+	std::vector<std::pair<int, int>> src; // (x, z)
+	for (int z = sel_bb.z0; z < sel_bb.z1; z++)
+		for (int x = sel_bb.x0; x < sel_bb.x1; x++)
+			if (sel_tiles.get(x, z)) src.push_back({ x, z });
+	DirtyRect dst_bb;
+	for (auto& [x, z] : src) {
+		auto [nx, nz] = map(x, z);
+		DirtyRect t = { nx, nz, nx + 1, nz + 1 };
+		if (dst_bb.empty()) dst_bb = t;
+		else dst_bb = { std::min(dst_bb.x0, nx), std::min(dst_bb.z0, nz), std::max(dst_bb.x1, nx + 1), std::max(dst_bb.z1, nz + 1) };
+	}
+	dst_bb = { std::max(0, dst_bb.x0), std::max(0, dst_bb.z0), std::min(MAP_W, dst_bb.x1), std::min(MAP_H, dst_bb.z1) };
+	DirtyRect all = sel_bb;
+	if (!dst_bb.empty()) all = { std::min(all.x0, dst_bb.x0), std::min(all.z0, dst_bb.z0), std::max(all.x1, dst_bb.x1), std::max(all.z1, dst_bb.z1) };
+	undo_begin();
+	undo_touch(all);
+	std::vector<Tile> buf(src.size());
+	par_for((int)src.size(), [&](int a, int b) {
+		for (int i = a; i < b; i++) {
+			Tile& t = tiles[(size_t)src[i].second * MAP_W + src[i].first];
+			buf[i] = std::move(t);
+			t = Tile();
+		}
+	}, 1024);
+	TileMask nm;
+	nm.reset(MAP_W, MAP_H);
+	for (size_t i = 0; i < src.size(); i++) {
+		auto [nx, nz] = map(src[i].first, src[i].second);
+		if (nx < 0 || nz < 0 || nx >= MAP_W || nz >= MAP_H) continue;
+		tiles[(size_t)nz * MAP_W + nx] = std::move(buf[i]);
+		nm.set(nx, nz);
+	}
+	sel_tiles = std::move(nm);
+	sel_bb = dst_bb;
+	map_changed(all.x0, all.z0, all.x1, all.z1);
+	for (int i : sel_obj_indices()) {
+		undo_obj_touch(OBJS[i].id);
+		Vector3 v = OBJS[i].vec3;
+		int ix = (int)std::floor(v.x), iz = (int)std::floor(v.z);
+		auto [nx, nz] = map(ix, iz);
+		OBJS[i].pov += rot_deg;
+		// смещение внутри тайла поворачиваем вместе с тайлом
+		float fx = v.x - ix, fz = v.z - iz;
+		if (rot_deg != 0.0f) { float t = fx; fx = 1.0f - fz; fz = t; }
+		obj_move(i, { nx + fx, v.y, nz + fz });
+	}
+	undo_end();
+}
+void sel_move(int dx, int dz) {
+	sel_remap([dx, dz](int x, int z) { return std::pair<int, int>(x + dx, z + dz); }, 0.0f);
+}
+// Поворот на 90 по часовой вокруг центра bbox выделения
+void sel_rotate90() {
+	if (sel_bb.empty()) return;
+	int cx = (sel_bb.x0 + sel_bb.x1) / 2, cz = (sel_bb.z0 + sel_bb.z1) / 2;
+	// (dx, dz) -> (-dz, dx) - это MatrixRotateY(-90), в нем же считается pov объектов
+	sel_remap([cx, cz](int x, int z) { return std::pair<int, int>(cx - (z - cz), cz + (x - cx)); }, -90.0f);
+}
+void DrawSelectionTool(const PickHit& h) {
+	if (sel_dragging && sel_mode == 2 && h.hit) {
+		int x0 = (int)sel_drag0.x, z0 = (int)sel_drag0.y;
+		float ax = (float)std::min(x0, h.x), bx = (float)std::max(x0, h.x) + 1.0f;
+		float az = (float)std::min(z0, h.z), bz = (float)std::max(z0, h.z) + 1.0f;
+		float y = h.pos.y + 0.1f;
+		DrawLine3D({ ax, y, az }, { bx, y, az }, YELLOW); DrawLine3D({ bx, y, az }, { bx, y, bz }, YELLOW);
+		DrawLine3D({ bx, y, bz }, { ax, y, bz }, YELLOW); DrawLine3D({ ax, y, bz }, { ax, y, az }, YELLOW);
+	}
+	for (size_t i = 1; i < sel_lasso.size(); i++) {
+		Vector2 a = sel_lasso[i - 1], b = sel_lasso[i];
+		DrawLine3D({ a.x, GetInterpolatedHeight(a.x, a.y) + 0.1f, a.y }, { b.x, GetInterpolatedHeight(b.x, b.y) + 0.1f, b.y }, YELLOW);
+	}
+	for (const OBJ& o : OBJS) {
+		if (sel_objs.empty()) break;
+		if (sel_objs.count(o.id)) DrawCubeWires({ o.vec3.x, o.vec3.y + o.razm * 0.5f, o.vec3.z }, o.razm, o.razm, o.razm, YELLOW);
+	}
+}
+// ===== Штампы: копирование/вставка участков карты с объектами =====
+// Слои лежат отдельными плоскими массивами по строкам (SoA), tid - индексы в палитре штампа
+enum STAMP_BLEND { SB_REPLACE, SB_ADD, SB_MAX };
+struct Stamp {
+	int w = 0, h = 0;
+	float base = 0.0f; // минимальная высота, для SB_ADD высоты берутся относительно нее
+	std::vector<unsigned long long> mask;
+	std::vector<float> hs;
+	std::vector<int> bids;
+	std::vector<unsigned short> tix;
+	std::vector<std::string> pal;
+	std::vector<std::pair<int, json>> props; // разреженные j: индекс клетки -> json
+	std::vector<OBJ> objs; // позиции относительно угла штампа
+	bool has(int i) const { return (mask[i >> 6] >> (i & 63)) & 1; }
+};
+struct StampPaste {
+	bool active = false;
+	int rot = 0; // четверти оборота по часовой
+	bool mirror = false;
+	int blend = SB_REPLACE;
+};
+Stamp clip;
+StampPaste paste;
 
-	for (int z = startZ; z < endZ; z++) {
-		for (int x = startX; x < endX; x++) {
-			int idx = z * MAP_W + x;
-			Tile& t = tiles[idx];
-			float h00 = GetVertexHeight(x, z);        
-			float h10 = GetVertexHeight(x + 1, z);    
-			float h11 = GetVertexHeight(x + 1, z + 1); 
-			float h01 = GetVertexHeight(x, z + 1);    
-			Texture2D texture = { 0 };
-			auto it = texs.find(t.tid);	
-			if (it != texs.end()) texture = it->second.first;
-			rlSetTexture(texture.id);
-			rlBegin(RL_QUADS);
-			rlColor4ub(255, 255, 255, 255);
-			rlTexCoord2f(0.0f, 0.0f);
-			rlVertex3f((float)x, h00, (float)z);
-			rlTexCoord2f(0.0f, 1.0f);
-			rlVertex3f((float)x, h01, (float)z + 1.0f);
-			rlTexCoord2f(1.0f, 1.0f);
-			rlVertex3f((float)x + 1.0f, h11, (float)z + 1.0f);
-			rlTexCoord2f(1.0f, 0.0f);
-			rlVertex3f((float)x + 1.0f, h10, (float)z);
-			rlEnd();
-			rlSetTexture(0);
-			DrawLine3D({ (float)x, h00, (float)z }, { (float)x + 1, h10, (float)z }, DARKGRAY);
-			DrawLine3D({ (float)x, h00, (float)z }, { (float)x, h01, (float)z + 1 }, DARKGRAY);
+// Копия выделения (только отмеченные тайлы bbox и выбранные объекты)
+bool stamp_copy(Stamp& st) {
+	if (sel_bb.empty() || sel_tiles.w != MAP_W) return false;
+	DirtyRect r = sel_bb;
+	st = Stamp();
+	st.w = r.x1 - r.x0; st.h = r.z1 - r.z0;
+	size_t n = (size_t)st.w * st.h;
+	st.mask.assign((n + 63) / 64, 0);
+	st.hs.resize(n); st.bids.resize(n); st.tix.resize(n);
+	st.base = FLT_MAX;
+	std::unordered_map<std::string, unsigned short> pal;
+	for (int z = 0; z < st.h; z++) {
+		const Tile* row = &tiles[(size_t)(r.z0 + z) * MAP_W + r.x0];
+		for (int x = 0; x < st.w; x++) {
+			size_t i = (size_t)z * st.w + x;
+			if (!sel_tiles.get(r.x0 + x, r.z0 + z)) continue;
+			st.mask[i >> 6] |= 1ull << (i & 63);
+			st.hs[i] = row[x].h;
+			st.bids[i] = row[x].bid;
+			auto it = pal.find(row[x].tid);
+			if (it == pal.end()) {
+				it = pal.emplace(row[x].tid, (unsigned short)st.pal.size()).first;
+				st.pal.push_back(row[x].tid);
+			}
+			st.tix[i] = it->second;
+			if (!row[x].j.is_null()) st.props.push_back({ (int)i, row[x].j });
+			st.base = std::min(st.base, row[x].h);
+		}
+	}
+	if (st.base == FLT_MAX) st.base = 0.0f;
+	for (int i : sel_obj_indices()) {
+		OBJ o = OBJS[i];
+		o.vec3.x -= r.x0; o.vec3.z -= r.z0;
+		o.id = 0;
+		st.objs.push_back(o);
+	}
+	return true;
+}
+int stamp_out_w(const Stamp& st, int rot) { return (rot & 1) ? st.h : st.w; }
+int stamp_out_h(const Stamp& st, int rot) { return (rot & 1) ? st.w : st.h; }
+// Клетка результата (i, j) -> клетка штампа (sx, sz): обратное преобразование
+void stamp_src(const Stamp& st, const StampPaste& p, int i, int j, int& sx, int& sz) {
+	int ow = stamp_out_w(st, p.rot);
+	if (p.mirror) i = ow - 1 - i;
+	switch (p.rot & 3) {
+	case 0: sx = i; sz = j; break;
+	case 1: sx = j; sz = st.h - 1 - i; break;
+	case 2: sx = st.w - 1 - i; sz = st.h - 1 - j; break;
+	default: sx = st.w - 1 - j; sz = i; break;
+	}
+}
+// Прямое преобразование непрерывной точки штампа (для объектов)
+Vector2 stamp_fwd(const Stamp& st, const StampPaste& p, float x, float z) {
+	float ox, oz;
+	switch (p.rot & 3) {
+	case 0: ox = x; oz = z; break;
+	case 1: ox = st.h - z; oz = x; break;
+	case 2: ox = st.w - x; oz = st.h - z; break;
+	default: ox = z; oz = st.w - x; break;
+	}
+	if (p.mirror) ox = stamp_out_w(st, p.rot) - ox;
+	return { ox, oz };
+}
+void stamp_paste(const Stamp& st, const StampPaste& p, int x0, int z0) {
+	if (st.w == 0) return;
+	int ow = stamp_out_w(st, p.rot), oh = stamp_out_h(st, p.rot);
+	DirtyRect r = { std::max(0, x0), std::max(0, z0), std::min(MAP_W, x0 + ow), std::min(MAP_H, z0 + oh) };
+	if (r.empty()) return;
+	undo_begin();
+	undo_touch(r);
+	std::unordered_map<int, const json*> props;
+	for (auto& [i, j] : st.props) props[i] = &j;
+	bool ident = p.rot == 0 && !p.mirror;
+	par_for(r.z1 - r.z0, [&](int a, int b) {
+		for (int z = r.z0 + a; z < r.z0 + b; z++) {
+			Tile* row = &tiles[(size_t)z * MAP_W];
+			int j = z - z0;
+			for (int x = r.x0; x < r.x1; x++) {
+				int sx, sz;
+				if (ident) { sx = x - x0; sz = j; }
+				else stamp_src(st, p, x - x0, j, sx, sz);
+				int si = sz * st.w + sx;
+				if (!st.has(si)) continue;
+				Tile& t = row[x];
+				switch (p.blend) {
+				case SB_REPLACE: t.h = st.hs[si]; break;
+				case SB_ADD: t.h += st.hs[si] - st.base; break;
+				default: t.h = std::max(t.h, st.hs[si]); break;
+				}
+				t.bid = st.bids[si];
+				t.tid = st.pal[st.tix[si]];
+				auto it = props.find(si);
+				t.j = it != props.end() ? *it->second : json();
+			}
+		}
+	}, 8);
+	map_changed(r.x0, r.z0, r.x1, r.z1);
+	// объекты - в том же шаге undo, что и тайлы под ними
+	for (OBJ o : st.objs) {
+		Vector2 v = stamp_fwd(st, p, o.vec3.x, o.vec3.z);
+		o.vec3.x = x0 + v.x; o.vec3.z = z0 + v.y;
+		o.pov -= 90.0f * p.rot; // stamp_fwd на каждый шаг крутит как MatrixRotateY(-90)
+		if (p.mirror) o.pov = -o.pov;
+		if (p.blend == SB_ADD) o.vec3.y = GetInterpolatedHeight(o.vec3.x, o.vec3.z);
+		undo_obj_touch(OBJS[obj_add(o)].id, true);
+	}
+	undo_end();
+}
+// Файл штампа: заголовок + сжатое тело
+bool stamp_save(const Stamp& st, const std::string& path) {
+	std::vector<unsigned char> o;
+	put_raw<int>(o, st.w); put_raw<int>(o, st.h); put_raw<float>(o, st.base);
+	size_t n = (size_t)st.w * st.h;
+	auto put_vec = [&o](const void* d, size_t bytes) { size_t k = o.size(); o.resize(k + bytes); if (bytes) memcpy(&o[k], d, bytes); };
+	put_vec(st.mask.data(), st.mask.size() * 8);
+	put_planes(o, (const unsigned char*)st.hs.data(), n);
+	put_planes(o, (const unsigned char*)st.bids.data(), n);
+	put_vec(st.tix.data(), n * 2);
+	json meta;
+	meta["pal"] = st.pal;
+	meta["props"] = json::array();
+	for (auto& [i, j] : st.props) meta["props"].push_back({ i, j });
+	meta["objs"] = json::array();
+	for (const OBJ& ob : st.objs) meta["objs"].push_back({ ob.tid, ob.proch, ob.vec3.x, ob.vec3.y, ob.vec3.z, ob.pov, ob.razm, ob.anim, ob.j });
+	std::string m = meta.dump();
+	put_raw<unsigned int>(o, (unsigned int)m.size());
+	o.insert(o.end(), m.begin(), m.end());
+	// "SMST", размер тела, deflate тела: распаковка сразу в буфер нужного размера
+	std::vector<unsigned char> z;
+	if (!bytes_deflate(o.data(), o.size(), z)) return false;
+	std::ofstream f(path, std::ios::binary);
+	uint64_t raw_n = o.size();
+	f.write("SMST", 4);
+	f.write((const char*)&raw_n, sizeof(raw_n));
+	f.write((const char*)z.data(), z.size());
+	return (bool)f;
+}
+// Файл чужой или битый - все размеры сверяются с телом до чтения, json только через is_*/value
+bool stamp_load(Stamp& out, const std::string& path) {
+	std::ifstream f(path, std::ios::binary);
+	char magic[4];
+	uint64_t raw_n = 0;
+	if (!f.read(magic, 4) || memcmp(magic, "SMST", 4) != 0 || !f.read((char*)&raw_n, sizeof(raw_n))) return false;
+	std::vector<unsigned char> z((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+	// deflate сжимает не больше чем в ~1032 раза - больший размер значит битый заголовок
+	if (raw_n < 12 || raw_n > (uint64_t)INT_MAX || raw_n > z.size() * 1032 + 64) return false;
+	std::vector<unsigned char> raw(raw_n);
+	if (!bytes_inflate(z.data(), z.size(), raw.data(), raw.size())) return false;
+	const unsigned char* p = raw.data();
+	const unsigned char* end = p + raw.size();
+	Stamp st;
+	st.w = get_raw<int>(p); st.h = get_raw<int>(p); st.base = get_raw<float>(p);
+	if (st.w <= 0 || st.h <= 0 || st.w > MAX_MAP_SIDE || st.h > MAX_MAP_SIDE) return false;
+	size_t n = (size_t)st.w * st.h;
+	size_t mask_n = (n + 63) / 64;
+	if ((size_t)(end - p) < mask_n * 8 + n * 4 + n * 4 + n * 2 + 4) return false;
+	st.mask.resize(mask_n); st.hs.resize(n); st.bids.resize(n); st.tix.resize(n);
+	memcpy(st.mask.data(), p, mask_n * 8); p += mask_n * 8;
+	get_planes(p, (unsigned char*)st.hs.data(), n);
+	get_planes(p, (unsigned char*)st.bids.data(), n);
+	memcpy(st.tix.data(), p, n * 2); p += n * 2;
+	unsigned int ml = get_raw<unsigned int>(p);
+	if ((size_t)(end - p) < ml) return false;
+	json meta = json::parse(p, p + ml, nullptr, false);
+	if (meta.is_discarded() || !meta.is_object()) return false;
+	const json& pal = meta.value("pal", json::array());
+	if (!pal.is_array()) return false;
+	for (const json& t : pal) st.pal.push_back(t.is_string() ? t.get<std::string>() : std::string());
+	for (size_t i = 0; i < n; i++)
+		if (st.has((int)i) && st.tix[i] >= st.pal.size()) return false;
+	const json& props = meta.value("props", json::array());
+	if (props.is_array())
+		for (const json& e : props)
+			if (e.is_array() && e.size() == 2 && e[0].is_number_integer() && e[0].get<long long>() >= 0 && e[0].get<long long>() < (long long)n)
+				st.props.push_back({ e[0].get<int>(), e[1] });
+	const json& objs = meta.value("objs", json::array());
+	if (objs.is_array())
+		for (const json& e : objs) {
+			if (!e.is_array() || e.size() < 9) continue;
+			bool num = e[0].is_string();
+			for (int k = 1; k < 7; k++) num = num && e[k].is_number();
+			if (!num) continue;
+			OBJ o = {};
+			o.tid = e[0].get<std::string>();
+			o.proch = e[1].get<int>();
+			o.vec3 = { e[2].get<float>(), e[3].get<float>(), e[4].get<float>() };
+			o.pov = e[5].get<float>(); o.razm = e[6].get<float>();
+			o.anim = e[7].is_string() ? e[7].get<std::string>() : std::string();
+			o.j = e[8];
+			st.objs.push_back(o);
 		}
+	out = std::move(st);
+	return true;
+}
+void DrawStampPreview(const Stamp& st, const StampPaste& p, const PickHit& h) {
+	if (!p.active || !h.hit || st.w == 0) return;
+	float x0 = (float)h.x, z0 = (float)h.z;
+	float x1 = x0 + stamp_out_w(st, p.rot), z1 = z0 + stamp_out_h(st, p.rot);
+	float y = h.pos.y + 0.2f;
+	DrawLine3D({ x0, y, z0 }, { x1, y, z0 }, SKYBLUE); DrawLine3D({ x1, y, z0 }, { x1, y, z1 }, SKYBLUE);
+	DrawLine3D({ x1, y, z1 }, { x0, y, z1 }, SKYBLUE); DrawLine3D({ x0, y, z1 }, { x0, y, z0 }, SKYBLUE);
+	// стрелка "вверх" штампа, чтобы был виден поворот/зеркало
+	Vector2 a = stamp_fwd(st, p, st.w * 0.5f, st.h * 0.5f), b = stamp_fwd(st, p, st.w * 0.5f, 0.0f);
+	DrawLine3D({ x0 + a.x, y, z0 + a.y }, { x0 + b.x, y, z0 + b.y }, SKYBLUE);
+}
+// Кольцо кисти по рельефу
+void DrawBrushPreview(const Brush& b, const PickHit& h) {
+	if (!h.hit) return;
+	const int SEG = 64;
+	Vector3 prev = { 0 };
+	for (int i = 0; i <= SEG; i++) {
+		float a = i * 2.0f * PI / SEG;
+		float x = h.pos.x + std::cos(a) * b.radius, z = h.pos.z + std::sin(a) * b.radius;
+		Vector3 p = { x, GetInterpolatedHeight(x, z) + 0.05f, z };
+		if (i > 0) DrawLine3D(prev, p, ORANGE);
+		prev = p;
 	}
 }
 float rnd_seed() {
@@ -190,6 +5943,8 @@ float smooth_lerp(float a, float b, float t) {
 
 
 void gen_l() {
+	undo_begin();
+	undo_touch({ 0, 0, MAP_W, MAP_H });
 	seed = rnd_seed();
 	// Глобальный уровень моря
 	const float SEA_LEVEL = 0.5f;
@@ -241,16 +5996,28 @@ void gen_l() {
 		// Все, что ниже уровня моря - вода
 		tiles[i].tid = (finalHeight < SEA_LEVEL) ? "water" : "grass";
 	}
+	map_changed(0, 0, MAP_W, MAP_H);
+	undo_end();
 }
 
-int main() {
+float exp_ppu = 8.0f;
+float exp_done = 0.0f;
+bool exp_cancel = false;
+
+int main(int argc, char** argv) {
+	// консольные инструменты - до создания окна, работают и без дисплея
+	int tool = smap_tool_main(argc, argv);
+	if (tool >= 0) return tool;
 	SetConfigFlags(FLAG_WINDOW_RESIZABLE | FLAG_MSAA_4X_HINT);
 	InitWindow(1920, 1000, "S-maps");
 	SetTargetFPS(120);
+	NFD_Init();
+	autos.next = GetTime() + autos.interval;
+	autos.next_set = autos.interval;
 	tiles.resize(MAP_W * MAP_H);
 	//gen_l();
 	Image img = GenImageColor(64, 64, WHITE);
-	texs["default"] = { LoadTextureFromImage(img), "" };
+	texs["default"].tex = LoadTextureFromImage(img);
 	UnloadImage(img);
 	Camera3D camera = { 0 };
 	camera.position = { (float)MAP_W * 0.8f, (float)MAP_W * 0.8f, (float)MAP_H * 0.8f };
@@ -261,65 +6028,317 @@ int main() {
 	Vector2 move;
 	while (!WindowShouldClose()) {
 		Vector2 ws = {GetScreenWidth(), GetScreenHeight()};
-		float dt = GetFrameTime();
-		if (IsMouseButtonDown(MOUSE_BUTTON_RIGHT)) {
-			Vector2 mouseDelta = GetMouseDelta();
+		prof_frame();
+		{
+			ProfScope ps("input");
+			float dt = GetFrameTime();
+			if (IsMouseButtonDown(MOUSE_BUTTON_RIGHT)) {
+				Vector2 mouseDelta = GetMouseDelta();
+				if (IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT)) {
+					float rotationAngle = mouseDelta.x * -0.2f * DEG2RAD;
+					float tiltAngle = mouseDelta.y * -0.2f * DEG2RAD;
+					camera.position = Vector3RotateByAxisAngle(camera.position, { 0, 1, 0 }, rotationAngle);
+					camera.up = Vector3RotateByAxisAngle(camera.up, { 0, 1, 0 }, rotationAngle);
+					Vector3 camRight = Vector3CrossProduct(camera.up, Vector3Subtract(camera.target, camera.position));
+					camRight = Vector3Normalize(camRight);
+					camera.position = Vector3RotateByAxisAngle(camera.position, camRight, tiltAngle);
+					camera.up = Vector3RotateByAxisAngle(camera.up, camRight, tiltAngle);
+				}
+				else {
+					float panSpeed = camera.fovy / 100.0f;
+					Vector3 forward = Vector3Subtract(camera.target, camera.position);
+					Vector3 right = Vector3CrossProduct(forward, camera.up);
+					right = Vector3Normalize(right);
+					Vector3 up = Vector3CrossProduct(right, forward);
+					up = Vector3Normalize(up);
+					Vector3 rightMove = Vector3Scale(right, -mouseDelta.x * panSpeed * dt * 50.0f);
+					Vector3 upMove = Vector3Scale(up, mouseDelta.y * panSpeed * dt * 50.0f); 
+					camera.position = Vector3Add(camera.position, rightMove);
+					camera.target = Vector3Add(camera.target, rightMove);
+					camera.position = Vector3Add(camera.position, upMove);
+					camera.target = Vector3Add(camera.target, upMove);
+				}
+			}
+			camera.fovy = std::clamp(camera.fovy - GetMouseWheelMove() * 2.0f, 2.0f, 1000.0f);
+		}
+		PickHit hover;
+		{
+			ProfScope ps("pick");
+			ct = (TOOL)tool_s;
+			if (!mouse_over_gui(ws) && !mouse_over_minimap(ws)) hover = pick_terrain(GetScreenToWorldRay(GetMousePosition(), camera));
+			if (hover.hit && IsMouseButtonPressed(MOUSE_BUTTON_LEFT) && ct == SELECT && !paste.active) {
+				st = &tiles[(size_t)hover.z * MAP_W + hover.x];
+				if (sel_mode == 1) {
+					TileMask m;
+					DirtyRect bb = fill_region(hover.x, hover.z, fill_p, m);
+					sel_combine(m, bb, sel_op_from_keys());
+				}
+				if (sel_mode >= 2) {
+					sel_dragging = true;
+					sel_drag0 = { (float)hover.x, (float)hover.z };
+					sel_lasso.clear();
+				}
+			}
+			if (ct == SELECT && sel_dragging && hover.hit && sel_mode == 3) {
+				Vector2 p = { hover.pos.x, hover.pos.z };
+				if (sel_lasso.empty() || Vector2Distance(sel_lasso.back(), p) > 0.5f) sel_lasso.push_back(p);
+			}
+			if (ct == SELECT && sel_dragging && IsMouseButtonReleased(MOUSE_BUTTON_LEFT)) {
+				if (sel_mode == 2 && hover.hit) sel_rect((int)sel_drag0.x, (int)sel_drag0.y, hover.x, hover.z, sel_op_from_keys());
+				if (sel_mode == 3) sel_poly(sel_lasso, sel_op_from_keys());
+				sel_dragging = false;
+				sel_lasso.clear();
+			}
+		}
+		if (ct == SELECT && !paste.active && !IsKeyDown(KEY_LEFT_CONTROL) && !IsKeyDown(KEY_RIGHT_CONTROL)) {
+			ProfScope ps("select ops");
+			if (IsKeyPressed(KEY_LEFT)) sel_move(-1, 0);
+			if (IsKeyPressed(KEY_RIGHT)) sel_move(1, 0);
+			if (IsKeyPressed(KEY_UP)) sel_move(0, -1);
+			if (IsKeyPressed(KEY_DOWN)) sel_move(0, 1);
+			if (IsKeyPressed(KEY_PAGE_UP)) sel_raise(1.0f);
+			if (IsKeyPressed(KEY_PAGE_DOWN)) sel_raise(-1.0f);
+			if (IsKeyPressed(KEY_R)) sel_rotate90();
+			if (IsKeyPressed(KEY_DELETE)) sel_delete();
+			if (IsKeyPressed(KEY_BACKSPACE)) sel_clear();
+		}
+		if (ct == OBJP && hover.hit && IsMouseButtonPressed(MOUSE_BUTTON_LEFT) && !paste.active) {
 			if (IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT)) {
-				float rotationAngle = mouseDelta.x * -0.2f * DEG2RAD;
-				float tiltAngle = mouseDelta.y * -0.2f * DEG2RAD;
-				camera.position = Vector3RotateByAxisAngle(camera.position, { 0, 1, 0 }, rotationAngle);
-				camera.up = Vector3RotateByAxisAngle(camera.up, { 0, 1, 0 }, rotationAngle);
-				Vector3 camRight = Vector3CrossProduct(camera.up, Vector3Subtract(camera.target, camera.position));
-				camRight = Vector3Normalize(camRight);
-				camera.position = Vector3RotateByAxisAngle(camera.position, camRight, tiltAngle);
-				camera.up = Vector3RotateByAxisAngle(camera.up, camRight, tiltAngle);
+				std::vector<int> nn = oix_query_knn(hover.pos.x, hover.pos.z, 1, 2.0f);
+				so_idx = nn.empty() ? -1 : nn[0];
+				if (so_idx >= 0) ev_emit({ EV_CLICK, OBJS[so_idx].id, 0, hover.pos });
 			}
 			else {
-				float panSpeed = camera.fovy / 100.0f;
-				Vector3 forward = Vector3Subtract(camera.target, camera.position);
-				Vector3 right = Vector3CrossProduct(forward, camera.up);
-				right = Vector3Normalize(right);
-				Vector3 up = Vector3CrossProduct(right, forward);
-				up = Vector3Normalize(up);
-				Vector3 rightMove = Vector3Scale(right, -mouseDelta.x * panSpeed * dt * 50.0f);
-				Vector3 upMove = Vector3Scale(up, mouseDelta.y * panSpeed * dt * 50.0f); 
-				camera.position = Vector3Add(camera.position, rightMove);
-				camera.target = Vector3Add(camera.target, rightMove);
-				camera.position = Vector3Add(camera.position, upMove);
-				camera.target = Vector3Add(camera.target, upMove);
-			}
-		}
-		camera.fovy = std::clamp(camera.fovy - GetMouseWheelMove() * 2.0f, 2.0f, 1000.0f);
-		 
+				OBJ o = {};
+				if (!texs_for_list.empty()) o.tid = texs_for_list[std::clamp(act_idx, 0, (int)texs_for_list.size() - 1)];
+				o.proch = 100;
+				o.vec3 = hover.pos;
+				o.razm = 1.0f;
+				so_idx = obj_add(o);
+			}
+		}
+		if (ct == OBJP && so_idx >= 0 && IsKeyPressed(KEY_DELETE)) obj_remove(so_idx);
+		so = (so_idx >= 0 && so_idx < (int)OBJS.size()) ? &OBJS[so_idx] : nullptr;
+		if (paste.active) {}
+		else if (ct == TILE && hover.hit && fill_mode) {
+			if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
+				ProfScope ps("fill");
+				if (act_idx >= 0 && act_idx < (int)texs_for_list.size()) brush.tid = texs_for_list[act_idx];
+				TileMask m;
+				DirtyRect bb = fill_region(hover.x, hover.z, fill_p, m);
+				fill_apply(m, bb, brush);
+			}
+		}
+		else if (ct == TILE && hover.hit) {
+			ProfScope ps("brush");
+			if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
+				undo_begin();
+				brush_stroke = true;
+				brush.flat_h = hover.pos.y;
+				st = &tiles[(size_t)hover.z * MAP_W + hover.x];
+			}
+			// нажали над GUI или небом и протащили на рельеф - не рисуем, иначе правка пройдет мимо undo
+			if (brush_stroke && IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
+				if (act_idx >= 0 && act_idx < (int)texs_for_list.size()) brush.tid = texs_for_list[act_idx];
+				brush_apply(brush, hover.pos.x, hover.pos.z, GetFrameTime());
+			}
+		}
 
+		if (IsMouseButtonReleased(MOUSE_BUTTON_LEFT)) {
+			undo_end();
+			brush_stroke = false;
+		}
+		{
+			ProfScope ps("events");
+			ev_dispatch(GetTime());
+		}
+		{
+			ProfScope ps("autosave");
+			autosave_tick(GetTime());
+		}
+		if (pw.active) page_tick(camera, IsMouseButtonDown(MOUSE_BUTTON_LEFT) || undo.open || paste.active || mexp.active);
+		if (paste.active) {
+			if (IsKeyPressed(KEY_R)) paste.rot = (paste.rot + 1) & 3;
+			if (IsKeyPressed(KEY_M)) paste.mirror = !paste.mirror;
+			if (IsKeyPressed(KEY_BACKSPACE)) paste.active = false;
+			if (hover.hit && IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
+				ProfScope ps("paste");
+				stamp_paste(clip, paste, hover.x, hover.z);
+			}
+		}
+		if (IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL)) {
+			bool shift = IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT);
+			if (IsKeyPressed(KEY_C) && ct == SELECT) stamp_copy(clip);
+			if (IsKeyPressed(KEY_V) && clip.w > 0) paste.active = true;
+			if (IsKeyPressed(KEY_S) && clip.w > 0) stamp_save(clip, "clip.stamp");
+			if (IsKeyPressed(KEY_O) && stamp_load(clip, "clip.stamp")) paste.active = true;
+			if (IsKeyPressed(KEY_Z) && !shift) undo_undo();
+			if (IsKeyPressed(KEY_Y) || (IsKeyPressed(KEY_Z) && shift)) undo_redo();
+		}
+		if (mexp.active) {
+			ProfScope ps("export");
+			export_step();
+		}
 		BeginDrawing();
 		BeginMode3D(camera);
 		ClearBackground(SKYBLUE);
 		// тут рисовка
-		DrawMap(camera);
+		{
+			ProfScope ps("DrawMap");
+			if (gpu_terrain) DrawMapGpu(camera);
+			else DrawMap(camera);
+		}
+		{
+			ProfScope ps("DrawObjs");
+			DrawObjs();
+		}
+		DrawPickHover(hover);
+		if (ct == TILE && !fill_mode) DrawBrushPreview(brush, hover);
+		if (so) DrawCubeWires({ so->vec3.x, so->vec3.y + so->razm * 0.5f, so->vec3.z }, so->razm, so->razm, so->razm, ORANGE);
+		if (ct == SELECT) {
+			DrawTileMask(sel_tiles, sel_bb, camera);
+			DrawSelectionTool(hover);
+		}
+		DrawStampPreview(clip, paste, hover);
 
 		EndMode3D();
-		GuiToggleGroup({ 10.0f, 10.0f, ws.x * 0.1f, ws.y * 0.03f }, "TILE;OBJ;SLCT", &tool_s);
-		if (GuiButton({ 10.0f, 50.0f, ws.x * 0.05f, ws.y * 0.03f }, "Generate")) gen_l();
-		if (GuiButton({ 10.0f, 90.0f, ws.x * 0.05f, ws.y * 0.03f }, "Load height map"));
-		GuiSlider({ 10.0f, 130.0f, ws.x * 0.05f, ws.y * 0.03f }, "", "", &g_set.gen_amplitude, 1.0f, 100.0f);
-		GuiSlider({ 10.0f, 170.0f, ws.x * 0.05f, ws.y * 0.03f }, "", "", &g_set.gen_distort, 1.0f, 100.0f);
-		GuiSlider({ 10.0f, 210.0f, ws.x * 0.05f, ws.y * 0.03f }, "", "", &g_set.gen_frequency, 0.00001f, 0.1f);
-		GuiSlider({ 10.0f, 250.0f, ws.x * 0.05f, ws.y * 0.03f }, "", "", &g_set.gen_hill_exp, 1.0f, 100.0f);
-		GuiSlider({ 10.0f, 290.0f, ws.x * 0.05f, ws.y * 0.03f }, "", "", &g_set.gen_lacunarity, 1.0f, 100.0f);
-		GuiSlider({ 10.0f, 330.0f, ws.x * 0.05f, ws.y * 0.03f }, "", "", &g_set.gen_mountain_cutoff, 0.01f, 0.7f);
-		GuiSlider({ 10.0f, 370.0f, ws.x * 0.05f, ws.y * 0.03f }, "", "", &g_set.gen_octaves, 1.0f, 100.0f);
-		GuiSlider({ 10.0f, 410.0f, ws.x * 0.05f, ws.y * 0.03f }, "", "", &g_set.gen_river_warp, 1.0f, 100.0f);
-		GuiSlider({ 10.0f, 450.0f, ws.x * 0.05f, ws.y * 0.03f }, "", "", &g_set.gen_roughness, 0.01f, 1.0f);
-		GuiSlider({ 10.0f, 490.0f, ws.x * 0.05f, ws.y * 0.03f }, "", "", &g_set.gen_scale, 0.000001f, 1.0f);
-		GuiPanel({ ws.x - ws.x * 0.1f, 10.0f, ws.x * 0.1f, ws.y * 0.3f }, "Textures");
-		if (GuiButton({ ws.x - ws.x * 0.1f + 1.0f, 30.0f, ws.x * 0.1f - 1.0f, ws.y * 0.03f }, "Load texture"));
-		GuiListViewEx({ ws.x - ws.x * 0.1f + 1.0f, 70.0f, ws.x * 0.1f - 1.0f, ws.y * 0.26f }, texs_for_list.data(), texs_for_list.size(), &sc_idx, &act_idx, &foc_idx);
-
-
-
-		EndDrawing();
+		{
+			ProfScope ps("gui");
+			GuiToggleGroup({ 10.0f, 10.0f, ws.x * 0.1f, ws.y * 0.03f }, "TILE;OBJ;SLCT", &tool_s);
+			if (GuiButton({ 10.0f, 50.0f, ws.x * 0.05f, ws.y * 0.03f }, "Generate")) gen_l();
+			if (GuiButton({ 10.0f, 90.0f, ws.x * 0.05f, ws.y * 0.03f }, "Load height map"));
+			GuiCheckBox({ 10.0f + ws.x * 0.05f + 10.0f, 50.0f, ws.y * 0.03f, ws.y * 0.03f }, "GPU", &gpu_terrain);
+			if (!mexp.active) {
+				if (GuiButton({ 10.0f + ws.x * 0.05f + 10.0f, 90.0f, ws.x * 0.05f, ws.y * 0.03f }, "Export PNG")) {
+					exp_done = 0.0f;
+					exp_cancel = false;
+					export_begin(TextFormat("map_export_%lld", (long long)std::time(nullptr)), exp_ppu, [](float d) { exp_done = d; return !exp_cancel; });
+				}
+				GuiSlider({ 10.0f + ws.x * 0.05f + 10.0f, 130.0f, ws.x * 0.05f, ws.y * 0.03f }, "", TextFormat("%.0f px", exp_ppu), &exp_ppu, 1.0f, 64.0f);
+			}
+			else {
+				GuiProgressBar({ 10.0f + ws.x * 0.05f + 10.0f, 90.0f, ws.x * 0.05f, ws.y * 0.03f }, "", "", &exp_done, 0.0f, 1.0f);
+				if (GuiButton({ 10.0f + ws.x * 0.05f + 10.0f, 130.0f, ws.x * 0.05f, ws.y * 0.03f }, "Cancel")) exp_cancel = true;
+			}
+			GuiSlider({ 10.0f, 130.0f, ws.x * 0.05f, ws.y * 0.03f }, "", "", &g_set.gen_amplitude, 1.0f, 100.0f);
+			GuiSlider({ 10.0f, 170.0f, ws.x * 0.05f, ws.y * 0.03f }, "", "", &g_set.gen_distort, 1.0f, 100.0f);
+			GuiSlider({ 10.0f, 210.0f, ws.x * 0.05f, ws.y * 0.03f }, "", "", &g_set.gen_frequency, 0.00001f, 0.1f);
+			GuiSlider({ 10.0f, 250.0f, ws.x * 0.05f, ws.y * 0.03f }, "", "", &g_set.gen_hill_exp, 1.0f, 100.0f);
+			GuiSlider({ 10.0f, 290.0f, ws.x * 0.05f, ws.y * 0.03f }, "", "", &g_set.gen_lacunarity, 1.0f, 100.0f);
+			GuiSlider({ 10.0f, 330.0f, ws.x * 0.05f, ws.y * 0.03f }, "", "", &g_set.gen_mountain_cutoff, 0.01f, 0.7f);
+			GuiSlider({ 10.0f, 370.0f, ws.x * 0.05f, ws.y * 0.03f }, "", "", &g_set.gen_octaves, 1.0f, 100.0f);
+			GuiSlider({ 10.0f, 410.0f, ws.x * 0.05f, ws.y * 0.03f }, "", "", &g_set.gen_river_warp, 1.0f, 100.0f);
+			GuiSlider({ 10.0f, 450.0f, ws.x * 0.05f, ws.y * 0.03f }, "", "", &g_set.gen_roughness, 0.01f, 1.0f);
+			GuiSlider({ 10.0f, 490.0f, ws.x * 0.05f, ws.y * 0.03f }, "", "", &g_set.gen_scale, 0.000001f, 1.0f);
+			if (ct == TILE) {
+				GuiToggleGroup({ 10.0f, 540.0f, ws.x * 0.1f / 4.0f, ws.y * 0.03f }, "RAISE;LOWER;SMOOTH;FLAT\nNOISE;PAINT;BIOME", &brush.mode);
+				GuiToggleGroup({ 10.0f, 620.0f, ws.x * 0.1f / 4.0f, ws.y * 0.03f }, "LIN;SMTH;SPH;CONST", &brush.falloff);
+				GuiSlider({ 10.0f, 660.0f, ws.x * 0.05f, ws.y * 0.03f }, "", TextFormat("R %.0f", brush.radius), &brush.radius, 1.0f, 300.0f);
+				GuiSlider({ 10.0f, 700.0f, ws.x * 0.05f, ws.y * 0.03f }, "", TextFormat("S %.1f", brush.strength), &brush.strength, 0.1f, 50.0f);
+				float bio = (float)brush.biome;
+				GuiSlider({ 10.0f, 740.0f, ws.x * 0.05f, ws.y * 0.03f }, "", TextFormat("bid %d", brush.biome), &bio, 0.0f, 5.0f);
+				brush.biome = (int)(bio + 0.5f);
+				GuiCheckBox({ 10.0f, 780.0f, ws.y * 0.03f, ws.y * 0.03f }, "Fill", &fill_mode);
+			}
+			if (ct == TILE || ct == SELECT) {
+				if (ct == SELECT) {
+					GuiToggleGroup({ 10.0f, 540.0f, ws.x * 0.1f / 4.0f, ws.y * 0.03f }, "PICK;WAND;RECT;LASSO", &sel_mode);
+					if (GuiButton({ 10.0f, 580.0f, ws.x * 0.1f / 4.0f, ws.y * 0.03f }, "Up")) sel_raise(1.0f);
+					if (GuiButton({ 10.0f + ws.x * 0.1f / 4.0f, 580.0f, ws.x * 0.1f / 4.0f, ws.y * 0.03f }, "Down")) sel_raise(-1.0f);
+					if (GuiButton({ 10.0f + ws.x * 0.1f / 2.0f, 580.0f, ws.x * 0.1f / 4.0f, ws.y * 0.03f }, "Rot90")) sel_rotate90();
+					if (GuiButton({ 10.0f + ws.x * 0.1f * 0.75f, 580.0f, ws.x * 0.1f / 4.0f, ws.y * 0.03f }, "Del")) sel_delete();
+					if (GuiButton({ 10.0f, 620.0f, ws.x * 0.1f / 2.0f, ws.y * 0.03f }, "Set tid/bid")) {
+						if (act_idx >= 0 && act_idx < (int)texs_for_list.size()) brush.tid = texs_for_list[act_idx];
+						undo_begin();
+						sel_for_tiles([](Tile& t) { t.tid = brush.tid; t.bid = brush.biome; });
+						undo_end();
+					}
+					if (GuiButton({ 10.0f + ws.x * 0.1f / 2.0f, 620.0f, ws.x * 0.1f / 2.0f, ws.y * 0.03f }, "Set json")) {
+						sel_set_prop(json::parse(jb, nullptr, false));
+					}
+					if (GuiButton({ 10.0f, 660.0f, ws.x * 0.1f / 2.0f, ws.y * 0.03f }, "Copy")) stamp_copy(clip);
+					if (GuiButton({ 10.0f + ws.x * 0.1f / 2.0f, 660.0f, ws.x * 0.1f / 2.0f, ws.y * 0.03f }, paste.active ? "Pasting.." : "Paste") && clip.w > 0) paste.active = !paste.active;
+					GuiToggleGroup({ 10.0f, 700.0f, ws.x * 0.1f / 3.0f, ws.y * 0.03f }, "SET;ADD;MAX", &paste.blend);
+				}
+				GuiToggleGroup({ 10.0f, 820.0f, ws.x * 0.1f / 3.0f, ws.y * 0.03f }, "TEX;BIO;HGT", &fill_p.key);
+				GuiSlider({ 10.0f, 860.0f, ws.x * 0.05f, ws.y * 0.03f }, "", TextFormat("tol %.2f", fill_p.tol), &fill_p.tol, 0.0f, 10.0f);
+			}
+			GuiPanel({ ws.x - ws.x * 0.1f, 10.0f, ws.x * 0.1f, ws.y * 0.3f }, "Textures");
+			if (GuiButton({ ws.x - ws.x * 0.1f + 1.0f, 30.0f, ws.x * 0.1f - 1.0f, ws.y * 0.03f }, "Load texture")) {
+				std::string p = file_dialog(false, "Image", "png,jpg,bmp,tga");
+				if (!p.empty() && !tex_add_file(p)) TraceLog(LOG_WARNING, "SAPK: failed to read %s", p.c_str());
+			}
+			GuiListViewEx({ ws.x - ws.x * 0.1f + 1.0f, 70.0f, ws.x * 0.1f - 1.0f, ws.y * 0.26f }, texs_for_list.data(), texs_for_list.size(), &sc_idx, &act_idx, &foc_idx);
+			if (GuiButton({ ws.x - ws.x * 0.1f, 20.0f + ws.y * 0.3f, ws.x * 0.05f, ws.y * 0.03f }, "Save map")) {
+				if (pw.active) {
+					if (!page_flush()) TraceLog(LOG_WARNING, "PAGE: failed to write %s", pw.path.c_str());
+				}
+				else {
+					std::string p = file_dialog(true, "S-map", "smap", "map.smap");
+					if (!p.empty() && !map_save_bin(p)) TraceLog(LOG_WARNING, "SMAP: failed to save %s", p.c_str());
+				}
+			}
+			if (GuiButton({ ws.x - ws.x * 0.05f, 20.0f + ws.y * 0.3f, ws.x * 0.05f, ws.y * 0.03f }, "Open map")) {
+				std::string p = file_dialog(false, "S-map", "smap");
+				if (!p.empty()) {
+					page_close();
+					if (!(smap_pageable(p) ? page_open(p, camera) : map_load_bin(p))) TraceLog(LOG_WARNING, "SMAP: failed to load %s", p.c_str());
+				}
+			}
+			if (GuiButton({ ws.x - ws.x * 0.1f, 30.0f + ws.y * 0.33f, ws.x * 0.05f, ws.y * 0.03f }, "Export JSON")) {
+				std::string p = file_dialog(true, "JSON", "json", "map.json");
+				if (!p.empty() && !map_save_json(p)) TraceLog(LOG_WARNING, "JSON: failed to save %s", p.c_str());
+			}
+			if (GuiButton({ ws.x - ws.x * 0.05f, 30.0f + ws.y * 0.33f, ws.x * 0.05f, ws.y * 0.03f }, "Import JSON")) {
+				std::string p = file_dialog(false, "JSON", "json");
+				if (!p.empty()) page_close();
+				if (!p.empty() && !map_load_json(p)) TraceLog(LOG_WARNING, "JSON: failed to load %s", p.c_str());
+			}
+			GuiSlider({ ws.x - ws.x * 0.1f, 40.0f + ws.y * 0.36f, ws.x * 0.05f, ws.y * 0.03f }, "", TextFormat("auto %.0fs", autos.interval), &autos.interval, 0.0f, 600.0f);
+			if (autos.busy) DrawText("saving..", (int)(ws.x - ws.x * 0.1f), (int)(50.0f + ws.y * 0.39f), 10, DARKGRAY);
+			else if (autos.last_done >= 0.0) DrawText(TextFormat("autosave %.0fs ago (%.2fs)", GetTime() - autos.last_done, autos.last_sec.load()), (int)(ws.x - ws.x * 0.1f), (int)(50.0f + ws.y * 0.39f), 10, DARKGRAY);
+			if (GuiButton({ ws.x - ws.x * 0.1f, 70.0f + ws.y * 0.39f, ws.x * 0.05f, ws.y * 0.03f }, "New 32k world")) {
+				std::string p = file_dialog(true, "S-map", "smap", "world.smap");
+				if (!p.empty() && page_new_world(p, 32768, 32768)) page_open(p, camera);
+			}
+			if (pw.active) DrawText(TextFormat("page %d,%d  cache %.0f MB", pw.ox, pw.oz, pw.bytes / (1024.0 * 1024.0)), (int)(ws.x - ws.x * 0.05f + 4.0f), (int)(76.0f + ws.y * 0.39f), 10, DARKGRAY);
+			if (GuiButton({ ws.x - ws.x * 0.1f, 80.0f + ws.y * 0.42f, ws.x * 0.05f, ws.y * 0.03f }, "HF bench")) hf_bench();
+			GuiSlider({ ws.x - ws.x * 0.05f, 80.0f + ws.y * 0.42f, ws.x * 0.05f, ws.y * 0.03f }, "", hcodec.step > 0.0f ? TextFormat("q %.3f", hcodec.step) : "lossless", &hcodec.step, 0.0f, 0.1f);
+			if (hcodec.step > 0.0f && !pw.active && GuiButton({ ws.x - ws.x * 0.1f, 148.0f + ws.y * 0.48f, ws.x * 0.1f, ws.y * 0.03f }, TextFormat("Export quantized %.3f", hcodec.step))) {
+				std::string p = file_dialog(true, "S-map", "smap", "map_q.smap");
+				if (!p.empty() && !map_save_full(p, true, hcodec.step)) TraceLog(LOG_WARNING, "SMAP: failed to export %s", p.c_str());
+			}
+			if (GuiButton({ ws.x - ws.x * 0.1f, 90.0f + ws.y * 0.45f, ws.x * 0.045f, ws.y * 0.03f }, "Cook")) {
+				std::string p = file_dialog(true, "Cooked map", "cook", "map.cook");
+				if (!p.empty() && !cook_export(p)) TraceLog(LOG_WARNING, "COOK: failed to write %s", p.c_str());
+			}
+			if (GuiButton({ ws.x - ws.x * 0.05f, 90.0f + ws.y * 0.45f, ws.x * 0.045f, ws.y * 0.03f }, "glTF")) {
+				std::string p = file_dialog(true, "glTF binary", "glb", "terrain.glb");
+				if (!p.empty() && !gltf_export(p)) TraceLog(LOG_WARNING, "GLTF: failed to write %s", p.c_str());
+			}
+			if (cook_last.cooked + cook_last.reused) DrawText(TextFormat("cooked %d, reused %d", cook_last.cooked, cook_last.reused), (int)(ws.x - ws.x * 0.1f), (int)(124.0f + ws.y * 0.48f), 10, DARKGRAY);
+			if (!gltf_last.tris.empty()) DrawText(TextFormat("glTF LOD0 %zu tris", gltf_last.tris[0]), (int)(ws.x - ws.x * 0.1f), (int)(136.0f + ws.y * 0.48f), 10, DARKGRAY);
+			if (hf_bench_last.done) DrawText(TextFormat("HF x%.2f (defl x%.2f) %.2f/%.2f GB/s", hf_bench_last.ratio, hf_bench_last.ratio_deflate, hf_bench_last.enc_gbs, hf_bench_last.dec_gbs), (int)(ws.x - ws.x * 0.1f), (int)(100.0f + ws.y * 0.48f), 10, DARKGRAY);
+			if (json_io_last.bytes) DrawText(TextFormat("JSON %.1f MB/s", json_io_last.mbps()), (int)(ws.x - ws.x * 0.1f), (int)(112.0f + ws.y * 0.48f), 10, DARKGRAY);
+			DrawMinimap(ws, camera);
+			prof_overlay(ws);
+		}
+		{
+			ProfScope ps("present");
+			EndDrawing();
+		}
 	}
+	autosave_wait();
+	page_close();
+	NFD_Quit();
 	CloseWindow();
 	return 0;
-}
\ No newline at end of file
+}
+#else
+int main(int argc, char** argv) {
+	int tool = smap_tool_main(argc, argv);
+	if (tool >= 0) return tool;
+	smap_tool_usage(argv[0]);
+	return 2;
+}
+#endif